@@ -0,0 +1,686 @@
+/* art.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace osdb
+{
+    /*
+    Encodes keys as byte strings whose lexicographic order matches the
+    order of the keys, and where no key's bytes prefix another's.
+    */
+    template<typename Key, typename = void>
+    struct radix_key;
+
+    template<typename Key>
+    struct radix_key<Key, std::enable_if_t<std::is_integral<Key>::value>>
+    {
+        static void encode(const Key& key, std::string& output)
+        {
+            using U = std::make_unsigned_t<Key>;
+            auto bits = static_cast<U>(key);
+            if (std::is_signed<Key>::value) {
+                bits ^= static_cast<U>(U(1) << (sizeof(U) * 8 - 1));
+            }
+            output.resize(sizeof(U));
+            for (size_t i = 0; i < sizeof(U); i++) {
+                output[i] = static_cast<char>(bits >> ((sizeof(U) - 1 - i) * 8));
+            }
+        }
+    };
+
+    // 0x00 is escaped as 0x00 0xFF and the key ends with 0x00 0x00
+    template<>
+    struct radix_key<std::string>
+    {
+        static void encode(const std::string& key, std::string& output)
+        {
+            output.clear();
+            output.reserve(key.size() + 2);
+            for (char c : key)
+            {
+                output.push_back(c);
+                if (c == '\0') output.push_back(static_cast<char>(0xFF));
+            }
+            output.push_back('\0');
+            output.push_back('\0');
+        }
+    };
+
+
+    /*
+    An adaptive radix tree mapping keys to values, permitting duplicate
+    keys. Inner nodes hold 4, 16, 48 or 256 children, growing as needed,
+    and compress runs of single-child nodes into a stored prefix. A lookup
+    inspects one byte per level rather than binary searching each node.
+
+    Leaves are also kept in a doubly-linked list in key order, so ranges
+    are iterated as with bplus_tree.
+    */
+    template<typename Key, typename Value>
+    class radix_tree
+    {
+    public:
+        using key_type = Key;
+        using value_type = Value;
+
+        class iterator;
+        class iterable;
+
+    private:
+        using item_type = std::pair<Key, Value>;
+
+        enum class node_type : uint8_t
+        {
+            Leaf, Node4, Node16, Node48, Node256
+        };
+
+        struct node
+        {
+            const node_type type;
+
+            explicit node(node_type type) noexcept
+                : type(type) { }
+        };
+
+        // The first item is held inline, and any duplicates after it
+        struct leaf : node
+        {
+            std::string bytes;
+            item_type item;
+            std::vector<item_type> duplicates{};
+            leaf* prev{};
+            leaf* next{};
+
+            leaf(std::string bytes, item_type item)
+                : node(node_type::Leaf), bytes(std::move(bytes)), item(std::move(item)) { }
+
+            size_t size() const noexcept {
+                return duplicates.size() + 1;
+            }
+
+            const item_type& operator [](size_t index) const noexcept {
+                return index == 0 ? item : duplicates[index - 1];
+            }
+        };
+
+        struct inner : node
+        {
+            std::string prefix{};
+            uint16_t count{};
+
+            explicit inner(node_type type) noexcept
+                : node(type) { }
+        };
+
+        // Node4 and Node16 keep their child bytes sorted
+        template<size_t Size, node_type Type>
+        struct sorted_node : inner
+        {
+            uint8_t keys[Size]{};
+            node* children[Size]{};
+
+            sorted_node() noexcept : inner(Type) { }
+        };
+
+        using node4 = sorted_node<4, node_type::Node4>;
+        using node16 = sorted_node<16, node_type::Node16>;
+
+        struct node48 : inner
+        {
+            // Slot of the child for each byte, plus one, or zero if none
+            uint8_t index[256]{};
+            node* children[48]{};
+
+            node48() noexcept : inner(node_type::Node48) { }
+        };
+
+        struct node256 : inner
+        {
+            node* children[256]{};
+
+            node256() noexcept : inner(node_type::Node256) { }
+        };
+
+        node* root{};
+        leaf* firstLeaf{};
+        leaf* lastLeaf{};
+        size_t _size{};
+
+    public:
+        radix_tree() = default;
+        radix_tree(const radix_tree&) = delete;
+        radix_tree& operator =(const radix_tree&) = delete;
+
+        ~radix_tree() {
+            destroy(root);
+        }
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        void add(Key key, Value value) &
+        {
+            std::string bytes{};
+            radix_key<Key>::encode(key, bytes);
+
+            leaf* existing = find_leaf(bytes);
+            if (existing != nullptr) {
+                existing->duplicates.emplace_back(std::move(key), std::move(value));
+            }
+            else
+            {
+                // Link the new leaf before the first leaf after it
+                existing = new leaf(bytes, item_type(std::move(key), std::move(value)));
+                leaf* next = bound(root, bytes, 0, true);
+                existing->next = next;
+                existing->prev = next != nullptr ? next->prev : lastLeaf;
+                (existing->prev != nullptr ? existing->prev->next : firstLeaf) = existing;
+                (next != nullptr ? next->prev : lastLeaf) = existing;
+
+                insert(root, existing, 0);
+            }
+            _size++;
+        }
+
+        const value_type* find(const key_type& key) const
+        {
+            std::string bytes{};
+            radix_key<Key>::encode(key, bytes);
+
+            const leaf* output = find_leaf(bytes);
+            return output != nullptr ? &output->item.second : nullptr;
+        }
+
+        iterable search_range(range_start = range_start{}, range_end = range_end{},
+            bool = true, bool = true) const &
+        {
+            return iterable(firstLeaf, nullptr);
+        }
+
+        iterable search_range(const key_type& start, range_end = range_end{},
+            bool inclusiveStart = true, bool = true) const &
+        {
+            return iterable(bound(start, !inclusiveStart), nullptr);
+        }
+
+        iterable search_range(range_start, const key_type& end, bool = true,
+            bool inclusiveEnd = true) const &
+        {
+            return iterable(firstLeaf, bound(end, inclusiveEnd));
+        }
+
+        iterable search_range(const key_type& start, const key_type& end,
+            bool inclusiveStart = true, bool inclusiveEnd = true) const &
+        {
+            leaf* last = bound(end, inclusiveEnd);
+            if (end < start || (!(start < end) && !(inclusiveStart && inclusiveEnd))) {
+                return iterable(last, last);
+            }
+            return iterable(bound(start, !inclusiveStart), last);
+        }
+
+    private:
+        static void destroy(node* target) noexcept
+        {
+            if (target == nullptr) return;
+            switch (target->type)
+            {
+                case node_type::Leaf:
+                    delete static_cast<leaf*>(target);
+                    return;
+                case node_type::Node4:
+                {
+                    auto* output = static_cast<node4*>(target);
+                    for (size_t i = 0; i < output->count; i++) destroy(output->children[i]);
+                    delete output;
+                    return;
+                }
+                case node_type::Node16:
+                {
+                    auto* output = static_cast<node16*>(target);
+                    for (size_t i = 0; i < output->count; i++) destroy(output->children[i]);
+                    delete output;
+                    return;
+                }
+                case node_type::Node48:
+                {
+                    auto* output = static_cast<node48*>(target);
+                    for (size_t i = 0; i < output->count; i++) destroy(output->children[i]);
+                    delete output;
+                    return;
+                }
+                case node_type::Node256:
+                {
+                    auto* output = static_cast<node256*>(target);
+                    for (auto* child : output->children) destroy(child);
+                    delete output;
+                    return;
+                }
+            }
+        }
+
+        /*
+        Gets the slot holding the child for the given byte, or nullptr.
+        */
+        static node** find_child(inner& parent, uint8_t byte) noexcept
+        {
+            switch (parent.type)
+            {
+                case node_type::Node4:
+                {
+                    auto& output = static_cast<node4&>(parent);
+                    for (size_t i = 0; i < output.count; i++) {
+                        if (output.keys[i] == byte) return &output.children[i];
+                    }
+                    return nullptr;
+                }
+                case node_type::Node16:
+                {
+                    auto& output = static_cast<node16&>(parent);
+#ifdef __SSE2__
+                    __m128i match = _mm_cmpeq_epi8(_mm_set1_epi8(static_cast<char>(byte)),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(output.keys)));
+                    unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(match)) &
+                        ((1u << output.count) - 1);
+                    return mask != 0 ? &output.children[__builtin_ctz(mask)] : nullptr;
+#else
+                    for (size_t i = 0; i < output.count; i++) {
+                        if (output.keys[i] == byte) return &output.children[i];
+                    }
+                    return nullptr;
+#endif
+                }
+                case node_type::Node48:
+                {
+                    auto& output = static_cast<node48&>(parent);
+                    uint8_t slot = output.index[byte];
+                    return slot != 0 ? &output.children[slot - 1] : nullptr;
+                }
+                case node_type::Node256:
+                {
+                    auto& output = static_cast<node256&>(parent);
+                    return output.children[byte] != nullptr ? &output.children[byte] : nullptr;
+                }
+                default:
+                    return nullptr;
+            }
+        }
+
+        /*
+        Gets the child with the smallest byte greater than (or, if
+        inclusive, equal to) the given byte, or nullptr.
+        */
+        static node* next_child(const inner& parent, unsigned byte, bool inclusive) noexcept
+        {
+            if (!inclusive && ++byte > 0xFF) return nullptr;
+            switch (parent.type)
+            {
+                case node_type::Node4:
+                    return next_sorted_child(static_cast<const node4&>(parent), byte);
+                case node_type::Node16:
+                    return next_sorted_child(static_cast<const node16&>(parent), byte);
+                case node_type::Node48:
+                {
+                    auto& output = static_cast<const node48&>(parent);
+                    for (; byte <= 0xFF; byte++) {
+                        if (output.index[byte] != 0) return output.children[output.index[byte] - 1];
+                    }
+                    return nullptr;
+                }
+                case node_type::Node256:
+                {
+                    auto& output = static_cast<const node256&>(parent);
+                    for (; byte <= 0xFF; byte++) {
+                        if (output.children[byte] != nullptr) return output.children[byte];
+                    }
+                    return nullptr;
+                }
+                default:
+                    return nullptr;
+            }
+        }
+
+        template<typename Sorted>
+        static node* next_sorted_child(const Sorted& parent, unsigned byte) noexcept
+        {
+            for (size_t i = 0; i < parent.count; i++) {
+                if (parent.keys[i] >= byte) return parent.children[i];
+            }
+            return nullptr;
+        }
+
+        static node* last_child(const inner& parent) noexcept
+        {
+            switch (parent.type)
+            {
+                case node_type::Node4:
+                    return static_cast<const node4&>(parent).children[parent.count - 1];
+                case node_type::Node16:
+                    return static_cast<const node16&>(parent).children[parent.count - 1];
+                case node_type::Node48:
+                {
+                    auto& output = static_cast<const node48&>(parent);
+                    for (unsigned byte = 0xFF; ; byte--) {
+                        if (output.index[byte] != 0) return output.children[output.index[byte] - 1];
+                    }
+                }
+                default:
+                {
+                    auto& output = static_cast<const node256&>(parent);
+                    for (unsigned byte = 0xFF; ; byte--) {
+                        if (output.children[byte] != nullptr) return output.children[byte];
+                    }
+                }
+            }
+        }
+
+        static leaf* minimum(node* target) noexcept
+        {
+            while (target->type != node_type::Leaf) {
+                target = next_child(static_cast<inner&>(*target), 0, true);
+            }
+            return static_cast<leaf*>(target);
+        }
+
+        static leaf* maximum(node* target) noexcept
+        {
+            while (target->type != node_type::Leaf) {
+                target = last_child(static_cast<inner&>(*target));
+            }
+            return static_cast<leaf*>(target);
+        }
+
+        leaf* find_leaf(const std::string& bytes) const noexcept
+        {
+            node* current = root;
+            size_t depth = 0;
+            while (current != nullptr)
+            {
+                if (current->type == node_type::Leaf)
+                {
+                    auto* output = static_cast<leaf*>(current);
+                    return output->bytes == bytes ? output : nullptr;
+                }
+
+                auto& parent = static_cast<inner&>(*current);
+                if (bytes.compare(depth, parent.prefix.size(), parent.prefix) != 0) return nullptr;
+
+                depth += parent.prefix.size();
+                if (depth == bytes.size()) return nullptr;
+
+                node** child = find_child(parent, static_cast<uint8_t>(bytes[depth++]));
+                current = child != nullptr ? *child : nullptr;
+            }
+            return nullptr;
+        }
+
+        leaf* bound(const key_type& key, bool upper) const
+        {
+            std::string bytes{};
+            radix_key<Key>::encode(key, bytes);
+            return bound(root, bytes, 0, upper);
+        }
+
+        /*
+        Finds the first leaf not less than (or, if upper, greater than)
+        the given bytes, searching from the given node.
+        */
+        static leaf* bound(node* target, const std::string& bytes, size_t depth, bool upper) noexcept
+        {
+            if (target == nullptr) return nullptr;
+            if (target->type == node_type::Leaf)
+            {
+                auto* output = static_cast<leaf*>(target);
+                int order = output->bytes.compare(bytes);
+                return (upper ? order > 0 : order >= 0) ? output : output->next;
+            }
+
+            auto& parent = static_cast<inner&>(*target);
+            size_t length = std::min(parent.prefix.size(), bytes.size() - depth);
+            int order = parent.prefix.compare(0, length, bytes, depth, length);
+
+            // Either every key below orders before or after bytes
+            if (order < 0) return maximum(target)->next;
+            if (order > 0 || length != parent.prefix.size() ||
+                depth + length == bytes.size()) return minimum(target);
+
+            depth += length;
+            auto byte = static_cast<uint8_t>(bytes[depth]);
+            node** child = find_child(parent, byte);
+            if (child != nullptr) return bound(*child, bytes, depth + 1, upper);
+
+            node* next = next_child(parent, byte, false);
+            return next != nullptr ? minimum(next) : maximum(target)->next;
+        }
+
+        void insert(node*& slot, leaf* output, size_t depth)
+        {
+            if (slot == nullptr)
+            {
+                slot = output;
+                return;
+            }
+
+            auto& bytes = output->bytes;
+            if (slot->type == node_type::Leaf)
+            {
+                // Keys are prefix-free, so both continue past their common prefix
+                auto& other = static_cast<leaf*>(slot)->bytes;
+                size_t shared = 0;
+                while (other[depth + shared] == bytes[depth + shared]) shared++;
+
+                auto* parent = new node4();
+                parent->prefix = bytes.substr(depth, shared);
+                add_sorted_child(*parent, static_cast<uint8_t>(other[depth + shared]), slot);
+                add_sorted_child(*parent, static_cast<uint8_t>(bytes[depth + shared]), output);
+                slot = parent;
+                return;
+            }
+
+            auto& parent = static_cast<inner&>(*slot);
+            size_t shared = 0;
+            while (shared < parent.prefix.size() && parent.prefix[shared] == bytes[depth + shared]) {
+                shared++;
+            }
+
+            // Split the prefix where the new key diverges from it
+            if (shared != parent.prefix.size())
+            {
+                auto* split = new node4();
+                split->prefix = parent.prefix.substr(0, shared);
+                auto byte = static_cast<uint8_t>(parent.prefix[shared]);
+                parent.prefix.erase(0, shared + 1);
+
+                add_sorted_child(*split, byte, slot);
+                add_sorted_child(*split, static_cast<uint8_t>(bytes[depth + shared]), output);
+                slot = split;
+                return;
+            }
+
+            depth += shared;
+            auto byte = static_cast<uint8_t>(bytes[depth]);
+            node** child = find_child(parent, byte);
+            if (child != nullptr) insert(*child, output, depth + 1);
+            else
+            {
+                if (full(parent)) slot = grow(parent);
+                add_child(static_cast<inner&>(*slot), byte, output);
+            }
+        }
+
+        static bool full(const inner& parent) noexcept
+        {
+            switch (parent.type)
+            {
+                case node_type::Node4: return parent.count == 4;
+                case node_type::Node16: return parent.count == 16;
+                case node_type::Node48: return parent.count == 48;
+                default: return false;
+            }
+        }
+
+        template<typename Target>
+        static Target* copy_header(inner& source, Target* output) noexcept
+        {
+            output->prefix = std::move(source.prefix);
+            output->count = source.count;
+            return output;
+        }
+
+        /*
+        Replaces a full node with one of the next size up.
+        */
+        static inner* grow(inner& parent)
+        {
+            switch (parent.type)
+            {
+                case node_type::Node4:
+                {
+                    auto& source = static_cast<node4&>(parent);
+                    auto* output = copy_header(source, new node16());
+                    std::copy(source.keys, source.keys + 4, output->keys);
+                    std::copy(source.children, source.children + 4, output->children);
+                    delete &source;
+                    return output;
+                }
+                case node_type::Node16:
+                {
+                    auto& source = static_cast<node16&>(parent);
+                    auto* output = copy_header(source, new node48());
+                    for (uint8_t i = 0; i < 16; i++)
+                    {
+                        output->index[source.keys[i]] = static_cast<uint8_t>(i + 1);
+                        output->children[i] = source.children[i];
+                    }
+                    delete &source;
+                    return output;
+                }
+                default:
+                {
+                    auto& source = static_cast<node48&>(parent);
+                    auto* output = copy_header(source, new node256());
+                    for (unsigned byte = 0; byte <= 0xFF; byte++)
+                    {
+                        if (source.index[byte] != 0) {
+                            output->children[byte] = source.children[source.index[byte] - 1];
+                        }
+                    }
+                    delete &source;
+                    return output;
+                }
+            }
+        }
+
+        template<typename Sorted>
+        static void add_sorted_child(Sorted& parent, uint8_t byte, node* child) noexcept
+        {
+            size_t i = parent.count;
+            for (; i != 0 && parent.keys[i - 1] > byte; i--)
+            {
+                parent.keys[i] = parent.keys[i - 1];
+                parent.children[i] = parent.children[i - 1];
+            }
+            parent.keys[i] = byte;
+            parent.children[i] = child;
+            parent.count++;
+        }
+
+        static void add_child(inner& parent, uint8_t byte, node* child) noexcept
+        {
+            switch (parent.type)
+            {
+                case node_type::Node4:
+                    add_sorted_child(static_cast<node4&>(parent), byte, child);
+                    break;
+                case node_type::Node16:
+                    add_sorted_child(static_cast<node16&>(parent), byte, child);
+                    break;
+                case node_type::Node48:
+                {
+                    auto& output = static_cast<node48&>(parent);
+                    output.children[output.count] = child;
+                    output.index[byte] = static_cast<uint8_t>(++output.count);
+                    break;
+                }
+                default:
+                    static_cast<node256&>(parent).children[byte] = child;
+                    parent.count++;
+                    break;
+            }
+        }
+
+    public:
+        class iterator
+        {
+            friend iterable;
+
+            const leaf* current;
+            size_t index{};
+
+            explicit iterator(const leaf* current) noexcept
+                : current(current) { }
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = item_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+
+            reference operator *() const noexcept {
+                return (*current)[index];
+            }
+            pointer operator ->() const noexcept {
+                return &(*current)[index];
+            }
+
+            bool operator ==(const iterator& other) const noexcept {
+                return current == other.current && index == other.index;
+            }
+            bool operator !=(const iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            iterator& operator ++() noexcept
+            {
+                if (++index == current->size())
+                {
+                    current = current->next;
+                    index = 0;
+                }
+                return *this;
+            }
+        };
+
+        class iterable
+        {
+            friend radix_tree;
+
+            const leaf* first;
+            const leaf* last;
+
+            iterable(const leaf* first, const leaf* last) noexcept
+                : first(first), last(last) { }
+
+        public:
+            iterator begin() const noexcept {
+                return iterator(first);
+            }
+            iterator end() const noexcept {
+                return iterator(last);
+            }
+        };
+    };
+}
@@ -0,0 +1,75 @@
+/* art-benchmark.cpp - (c) 2018 James Renwick */
+#include <btree.hpp>
+#include <art.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using key_type = int64_t;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Tree>
+static void run(const char* name, const char* keySet, const std::vector<key_type>& keys,
+    const std::vector<key_type>& probes)
+{
+    Tree tree{};
+    double insert = time_ms([&]() {
+        for (size_t i = 0; i < keys.size(); i++) tree.add(keys[i], static_cast<key_type>(i));
+    });
+
+    key_type sum = 0;
+    double lookup = time_ms([&]() {
+        for (auto& key : probes)
+        {
+            auto* value = tree.find(key);
+            if (value != nullptr) sum += *value;
+        }
+    });
+
+    double scan = time_ms([&]() {
+        for (auto& pair : tree.search_range()) sum += pair.second;
+    });
+
+    std::printf("%-12s %-8s insert %9.2f ms  find %9.2f ms  scan %8.2f ms  (%lld)\n",
+        name, keySet, insert, lookup, scan, static_cast<long long>(sum));
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::mt19937_64 random(42);
+
+    // Dense keys are a shuffled 0..n-1, sparse keys are random 64-bit values
+    std::vector<key_type> dense(count), sparse(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        dense[i] = static_cast<key_type>(i);
+        sparse[i] = static_cast<key_type>(random());
+    }
+    std::shuffle(dense.begin(), dense.end(), random);
+
+    std::vector<key_type> denseProbes(dense), sparseProbes(sparse);
+    std::shuffle(denseProbes.begin(), denseProbes.end(), random);
+    std::shuffle(sparseProbes.begin(), sparseProbes.end(), random);
+
+    using btree_type = osdb::bplus_tree<key_type, key_type, 16, 32>;
+    using art_type = osdb::radix_tree<key_type, key_type>;
+
+    run<btree_type>("bplus_tree", "dense", dense, denseProbes);
+    run<art_type>("radix_tree", "dense", dense, denseProbes);
+    run<btree_type>("bplus_tree", "sparse", sparse, sparseProbes);
+    run<art_type>("radix_tree", "sparse", sparse, sparseProbes);
+    return 0;
+}
@@ -0,0 +1,73 @@
+/* fanout-benchmark.cpp - (c) 2018 James Renwick */
+#include <btree.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using key_type = uint64_t;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Tree>
+static void run(const char* name, const std::vector<key_type>& keys,
+    const std::vector<key_type>& probes)
+{
+    Tree tree{};
+    double insert = time_ms([&]() {
+        for (size_t i = 0; i < keys.size(); i++) tree.add(keys[i], i);
+    });
+
+    key_type sum = 0;
+    double lookup = time_ms([&]() {
+        for (auto& key : probes)
+        {
+            auto* value = tree.find(key);
+            if (value != nullptr) sum += *value;
+        }
+    });
+    double scan = time_ms([&]() {
+        tree.search_range().scan([&](const auto& item) { sum += item.second; });
+    });
+
+    auto stats = tree.stats();
+    std::printf("%-10s order %4zu leaf %4zu  add %8.2f ms  find %8.2f ms  "
+        "scan %6.2f ms  %5.1f B/item  fill %.2f  (%llu)\n",
+        name, tree.order(), tree.leaf_size(), insert, lookup, scan,
+        static_cast<double>(stats.bytes) / keys.size(), stats.leafFill,
+        static_cast<unsigned long long>(sum));
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::mt19937_64 random(42);
+
+    std::vector<key_type> keys(count);
+    for (auto& key : keys) key = random();
+    std::vector<key_type> probes(keys);
+    std::shuffle(probes.begin(), probes.end(), random);
+
+    // Hand-picked sizes, then sizes derived from a range of targets
+    run<osdb::bplus_tree<key_type, key_type, 4, 8>>("4/8", keys, probes);
+    run<osdb::bplus_tree<key_type, key_type, 32, 64>>("32/64", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 64>>("64 B", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 128>>("128 B", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 256>>("256 B", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 512>>("512 B", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 1024>>("1 KB", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 2048>>("2 KB", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 4096>>("4 KB", keys, probes);
+    run<osdb::bplus_tree_for<key_type, key_type, 8192>>("8 KB", keys, probes);
+    return 0;
+}
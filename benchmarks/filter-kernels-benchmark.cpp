@@ -0,0 +1,95 @@
+/* filter-kernels-benchmark.cpp - (c) 2018 James Renwick */
+#include <filter_kernels.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace osdb;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* level_name(simd_level level)
+{
+    switch (level)
+    {
+        case simd_level::avx512: return "avx512";
+        case simd_level::avx2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+/*
+Filters batches of 1024 values, as the query executor does, so that the
+values are in cache and the kernel rather than memory bandwidth is timed.
+*/
+template<typename T>
+static void run(const char* type, const char* predicate, filter_op op, T low, T high,
+    const std::vector<T>& values, size_t rounds)
+{
+    constexpr size_t batch = 1024;
+    std::vector<uint32_t> selection(batch);
+    std::vector<uint64_t> mask(batch / 64);
+
+    for (simd_level level : { simd_level::scalar, simd_level::avx2, simd_level::avx512 })
+    {
+        if (level > detect_simd_level()) continue;
+
+        size_t selected = 0;
+        double select = time_ms([&]() {
+            for (size_t round = 0; round < rounds; round++) {
+                for (size_t first = 0; first + batch <= values.size(); first += batch) {
+                    selected += filter_select(op, values.data() + first, batch, low, high,
+                        selection.data(), level);
+                }
+            }
+        });
+        double masked = time_ms([&]() {
+            for (size_t round = 0; round < rounds; round++) {
+                for (size_t first = 0; first + batch <= values.size(); first += batch) {
+                    selected += filter_mask(op, values.data() + first, batch, low, high,
+                        mask.data(), level);
+                }
+            }
+        });
+
+        double rows = static_cast<double>(values.size() / batch * batch * rounds);
+        std::printf("%-7s %-8s %-7s select %8.0f Mrows/s  mask %8.0f Mrows/s  (%zu)\n",
+            type, predicate, level_name(level), rows / select / 1000, rows / masked / 1000,
+            selected);
+    }
+}
+
+template<typename T>
+static void run_type(const char* type, size_t count, size_t rounds)
+{
+    std::mt19937_64 random(42);
+    std::vector<T> values(count);
+    for (auto& value : values) value = static_cast<T>(random() % 1000);
+
+    run<T>(type, "eq 0.1%", filter_op::eq, T(500), T(500), values, rounds);
+    run<T>(type, "lt 50%", filter_op::lt, T(500), T(500), values, rounds);
+    run<T>(type, "between", filter_op::between, T(250), T(749), values, rounds);
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 16;
+    size_t rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 500;
+
+    // A single thread, so rows per second are per core
+    run_type<int32_t>("int32", count, rounds);
+    run_type<int64_t>("int64", count, rounds);
+    run_type<float>("float", count, rounds);
+    run_type<double>("double", count, rounds);
+    return 0;
+}
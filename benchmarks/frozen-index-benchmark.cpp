@@ -0,0 +1,66 @@
+/* frozen-index-benchmark.cpp - (c) 2018 James Renwick */
+#include <frozen_index.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using key_type = int64_t;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Index>
+static void run(const char* name, const Index& index, const std::vector<key_type>& probes)
+{
+    key_type sum = 0;
+    double lookup = time_ms([&]() {
+        for (auto& key : probes)
+        {
+            auto* value = index.find(key);
+            if (value != nullptr) sum += *value;
+        }
+    });
+    std::printf("%-14s find %9.2f ms  (%lld)\n", name, lookup, static_cast<long long>(sum));
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::mt19937_64 random(42);
+
+    std::vector<key_type> keys(count);
+    for (auto& key : keys) key = static_cast<key_type>(random());
+
+    osdb::bplus_tree<key_type, key_type, 16, 32> tree{};
+    for (size_t i = 0; i < count; i++) tree.add(keys[i], static_cast<key_type>(i));
+
+    osdb::frozen_index<key_type, key_type> frozen{};
+    double freeze = time_ms([&]() { frozen = tree.freeze(); });
+    std::printf("freeze %.2f ms, %zu bytes\n", freeze, frozen.bytes());
+
+    // Restarting from a snapshot rather than re-adding every item
+    osdb::bplus_tree<key_type, key_type, 16, 32> loaded{};
+    double rebuild = time_ms([&]() {
+        for (size_t i = 0; i < count; i++) loaded.add(keys[i], static_cast<key_type>(i));
+    });
+    double load = time_ms([&]() {
+        osdb::load_snapshot(loaded, frozen.data(), frozen.bytes());
+    });
+    std::printf("rebuild by add %.2f ms, load_snapshot %.2f ms\n", rebuild, load);
+
+    std::shuffle(keys.begin(), keys.end(), random);
+    run("bplus_tree", tree, keys);
+    run("frozen_index", frozen, keys);
+    run("loaded", loaded, keys);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* hash-join-benchmark.cpp - (c) 2018 James Renwick */
+#include <hash_join.hpp>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace osdb;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+/*
+Joins a build side of unique keys with a probe side four times its size,
+each probe key matching one build key, without partitioning and with
+increasing numbers of radix bits.
+*/
+static void run(size_t buildCount)
+{
+    std::mt19937_64 random(42);
+    std::vector<uint64_t> keys(buildCount);
+    for (size_t i = 0; i < buildCount; i++) keys[i] = i * 7919;
+
+    std::vector<uint64_t> buildHashes(buildCount), probeHashes(buildCount * 4);
+    for (size_t i = 0; i < buildCount; i++) {
+        buildHashes[i] = join_hash(keys[i]);
+    }
+    for (auto& hash : probeHashes) {
+        hash = join_hash(keys[random() % buildCount]);
+    }
+
+    for (size_t bits : { size_t(0), size_t(4), size_t(8), max_join_radix_bits })
+    {
+        size_t matched = 0;
+        double elapsed = time_ms([&]() {
+            hash_join_partitioned(buildHashes.data(), buildHashes.size(), probeHashes.data(),
+                probeHashes.size(), bits, [&](size_t, size_t) { matched++; });
+        });
+        double rows = static_cast<double>(probeHashes.size());
+        std::printf("build %9zu  bits %2zu  %8.1f ms  %8.0f Mprobes/s  (%zu)\n",
+            buildCount, bits, elapsed, rows / elapsed / 1000, matched);
+    }
+
+    size_t matched = 0;
+    double elapsed = time_ms([&]() {
+        hash_join(buildHashes.data(), buildHashes.size(), probeHashes.data(),
+            probeHashes.size(), [&](size_t, size_t) { matched++; });
+    });
+    std::printf("build %9zu  auto     %8.1f ms  %8.0f Mprobes/s  (%zu)\n", buildCount,
+        elapsed, static_cast<double>(probeHashes.size()) / elapsed / 1000, matched);
+}
+
+int main(int argc, char** argv)
+{
+    size_t largest = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1 << 23;
+
+    for (size_t count = 1 << 12; count <= largest; count *= 8) {
+        run(count);
+    }
+    return 0;
+}
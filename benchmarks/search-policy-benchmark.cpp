@@ -0,0 +1,68 @@
+/* search-policy-benchmark.cpp - (c) 2018 James Renwick */
+#include <btree.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using key_type = uint64_t;
+
+template<typename Func>
+static double time_ms(Func&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    func();
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+template<typename Search>
+static void run(const char* name, const char* keySet, const std::vector<key_type>& keys,
+    const std::vector<key_type>& probes)
+{
+    osdb::bplus_tree<key_type, key_type, 32, 64, false, Search> tree{};
+    for (size_t i = 0; i < keys.size(); i++) tree.add(keys[i], i);
+
+    key_type sum = 0;
+    double lookup = time_ms([&]() {
+        for (auto& key : probes)
+        {
+            auto* value = tree.find(key);
+            if (value != nullptr) sum += *value;
+        }
+    });
+
+    std::printf("%-14s %-12s find %9.2f ms  (%llu)\n",
+        name, keySet, lookup, static_cast<unsigned long long>(sum));
+}
+
+int main(int argc, char** argv)
+{
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1000000;
+    std::mt19937_64 random(42);
+
+    // Sequential IDs, timestamps with jittered spacing, and random keys
+    std::vector<key_type> ids(count), times(count), sparse(count);
+    key_type time = 1500000000000;
+    for (size_t i = 0; i < count; i++)
+    {
+        ids[i] = i + 1;
+        time += 900 + random() % 200;
+        times[i] = time;
+        sparse[i] = random();
+    }
+
+    for (auto* keys : { &ids, &times, &sparse })
+    {
+        std::vector<key_type> probes(*keys);
+        std::shuffle(probes.begin(), probes.end(), random);
+        const char* keySet = keys == &ids ? "ids" : keys == &times ? "timestamps" : "sparse";
+
+        run<osdb::binary_search_policy>("binary", keySet, *keys, probes);
+        run<osdb::interpolation_search_policy>("interpolation", keySet, *keys, probes);
+    }
+    return 0;
+}
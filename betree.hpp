@@ -0,0 +1,569 @@
+/* betree.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace osdb
+{
+    /*
+    A write-optimised (B-epsilon) B+ tree. Inner nodes hold a buffer of
+    pending insertions in addition to their separators and children.
+    New items are added to the root's buffer. When a buffer holds
+    BufferSize items, it is sorted and flushed one level down in a single
+    batch. Leaves are therefore written once per batch rather than once
+    per item, and always in key order.
+
+    Queries merge the pending items along their path with the items
+    already in leaves, so search_range sees every item added so far.
+    */
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        size_t BufferSize>
+    class buffered_bplus_tree
+    {
+        static_assert(Order % 2 == 0, "Order must be a factor of two");
+        static_assert(LeafSize >= 2, "LeafSize must be at least two");
+        static_assert(BufferSize != 0, "BufferSize must be non-zero");
+
+    public:
+        using key_type = Key;
+        using value_type = Value;
+
+        class iterator;
+        class iterable;
+
+    private:
+        using item_type = std::pair<Key, Value>;
+
+        struct node
+        {
+            const bool isLeaf;
+
+            explicit node(bool isLeaf) noexcept
+                : isLeaf(isLeaf) { }
+            virtual ~node() = default;
+        };
+
+        struct leaf : node
+        {
+            std::vector<item_type> items{};
+            leaf* rightLeaf{};
+
+            leaf() : node(true) {
+                items.reserve(LeafSize);
+            }
+        };
+
+        /*
+        Separator keys[i] is the first key of children[i + 1] when split.
+        Nodes may briefly hold more than Order + 1 children while being
+        flushed, after which their parent splits them.
+        */
+        struct inner : node
+        {
+            std::vector<Key> keys{};
+            std::vector<std::unique_ptr<node>> children{};
+            std::vector<item_type> buffer{};
+
+            inner() : node(false) { }
+        };
+
+        std::unique_ptr<node> root{};
+        leaf* firstLeaf{};
+        size_t _size{};
+        size_t _height{};
+        size_t _leafWrites{};
+
+    public:
+        constexpr size_t order() const noexcept {
+            return Order;
+        }
+
+        constexpr size_t leaf_size() const noexcept {
+            return LeafSize;
+        }
+
+        constexpr size_t buffer_size() const noexcept {
+            return BufferSize;
+        }
+
+        size_t height() const noexcept {
+            return _height;
+        }
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        /*
+        Gets the number of times any leaf has been written to, which
+        for a page-backed tree is the number of leaf page writes.
+        */
+        size_t leaf_writes() const noexcept {
+            return _leafWrites;
+        }
+
+        void add(Key key, Value value) &
+        {
+            _size++;
+            if (root == nullptr)
+            {
+                auto output = std::make_unique<leaf>();
+                firstLeaf = output.get();
+                root = std::move(output);
+            }
+
+            // Buffer in the root unless it is still a single leaf
+            std::vector<item_type> items{};
+            items.emplace_back(std::move(key), std::move(value));
+
+            if (root->isLeaf) {
+                merge_leaf(root, items);
+            }
+            else
+            {
+                auto& node = static_cast<inner&>(*root);
+                node.buffer.push_back(std::move(items[0]));
+                if (node.buffer.size() >= BufferSize) {
+                    flush(node);
+                }
+            }
+
+            // Grow while the root has too many children
+            while (child_count(*root) > max_children(*root))
+            {
+                auto output = std::make_unique<inner>();
+                output->children.push_back(std::move(root));
+                split_child(*output, 0);
+                root = std::move(output);
+                _height++;
+            }
+        }
+
+        /*
+        Moves all pending items down into the leaves.
+        */
+        void flush_all() &
+        {
+            if (root == nullptr) return;
+            if (!root->isLeaf) flush_all(static_cast<inner&>(*root));
+            while (child_count(*root) > max_children(*root))
+            {
+                auto output = std::make_unique<inner>();
+                output->children.push_back(std::move(root));
+                split_child(*output, 0);
+                root = std::move(output);
+                _height++;
+            }
+        }
+
+        const value_type* find(const key_type& key) const
+        {
+            auto range = search_range(key, key);
+            auto iter = range.begin();
+            return iter != range.end() ? &iter->second : nullptr;
+        }
+
+        iterable search_range(range_start = range_start{}, range_end = range_end{},
+            bool = true, bool = true) const &
+        {
+            return make_range(nullptr, true, nullptr, true);
+        }
+
+        iterable search_range(const key_type& start, range_end = range_end{},
+            bool inclusiveStart = true, bool = true) const &
+        {
+            return make_range(&start, inclusiveStart, nullptr, true);
+        }
+
+        iterable search_range(range_start, const key_type& end, bool = true,
+            bool inclusiveEnd = true) const &
+        {
+            return make_range(nullptr, true, &end, inclusiveEnd);
+        }
+
+        iterable search_range(const key_type& start, const key_type& end,
+            bool inclusiveStart = true, bool inclusiveEnd = true) const &
+        {
+            return make_range(&start, inclusiveStart, &end, inclusiveEnd);
+        }
+
+    private:
+        static size_t child_count(const node& node) noexcept
+        {
+            return node.isLeaf ? static_cast<const leaf&>(node).items.size()
+                : static_cast<const inner&>(node).children.size();
+        }
+
+        static size_t max_children(const node& node) noexcept {
+            return node.isLeaf ? LeafSize : Order + 1;
+        }
+
+        static size_t child_index(const inner& node, const Key& key, bool upper) noexcept
+        {
+            size_t i = 0;
+            for (; i < node.keys.size(); i++) {
+                if (upper ? key < node.keys[i] : !(node.keys[i] < key)) break;
+            }
+            return i;
+        }
+
+        static bool before_start(const Key& key, const Key* start, bool inclusive) noexcept {
+            return start != nullptr && (inclusive ? key < *start : !(*start < key));
+        }
+
+        static bool after_end(const Key& key, const Key* end, bool inclusive) noexcept {
+            return end != nullptr && (inclusive ? *end < key : !(key < *end));
+        }
+
+        /*
+        Merges sorted items into a leaf. The leaf may then hold more than
+        LeafSize items, in which case its parent splits it.
+        */
+        void merge_leaf(std::unique_ptr<node>& child, std::vector<item_type>& items)
+        {
+            auto& target = static_cast<leaf&>(*child).items;
+            size_t middle = target.size();
+
+            for (auto& item : items) target.push_back(std::move(item));
+            std::inplace_merge(target.begin(), target.begin() + middle, target.end(),
+                [](const item_type& a, const item_type& b) { return a.first < b.first; });
+            _leafWrites++;
+        }
+
+        void flush(inner& node)
+        {
+            // Partition pending items by child in key order. The sort is
+            // stable so equal keys keep their insertion order.
+            std::stable_sort(node.buffer.begin(), node.buffer.end(),
+                [](const item_type& a, const item_type& b) { return a.first < b.first; });
+
+            std::vector<item_type> batch{};
+            auto iter = node.buffer.begin();
+
+            // Process children right to left, so that splits do not
+            // disturb the indices of those yet to be flushed
+            std::vector<std::pair<size_t, size_t>> ranges{};
+            while (iter != node.buffer.end())
+            {
+                size_t index = child_index(node, iter->first, true);
+                auto end = iter;
+                while (end != node.buffer.end() &&
+                    child_index(node, end->first, true) == index) ++end;
+
+                ranges.emplace_back(index, static_cast<size_t>(end - iter));
+                iter = end;
+            }
+
+            size_t offset = node.buffer.size();
+            for (auto range = ranges.rbegin(); range != ranges.rend(); ++range)
+            {
+                offset -= range->second;
+                batch.clear();
+                for (size_t i = 0; i < range->second; i++) {
+                    batch.push_back(std::move(node.buffer[offset + i]));
+                }
+
+                auto& child = node.children[range->first];
+                if (child->isLeaf) {
+                    merge_leaf(child, batch);
+                }
+                else
+                {
+                    auto& target = static_cast<inner&>(*child);
+                    for (auto& item : batch) target.buffer.push_back(std::move(item));
+                    if (target.buffer.size() >= BufferSize) flush(target);
+                }
+
+                if (child_count(*child) > max_children(*child)) {
+                    split_child(node, range->first);
+                }
+            }
+            node.buffer.clear();
+        }
+
+        void flush_all(inner& node)
+        {
+            flush(node);
+            for (size_t i = node.children.size(); i != 0; i--)
+            {
+                auto& child = node.children[i - 1];
+                if (child->isLeaf) continue;
+
+                flush_all(static_cast<inner&>(*child));
+                if (child_count(*child) > max_children(*child)) {
+                    split_child(node, i - 1);
+                }
+            }
+        }
+
+        /*
+        Splits an overfull child into as many evenly-filled siblings as
+        needed, inserting them and their separators after it.
+        */
+        void split_child(inner& node, size_t index)
+        {
+            auto& child = node.children[index];
+            size_t count = child_count(*child);
+            size_t limit = max_children(*child);
+            size_t parts = (count + limit - 1) / limit;
+
+            // Pieces are split off from the end, so are built right to left
+            std::vector<std::unique_ptr<buffered_bplus_tree::node>> siblings{};
+            std::vector<Key> separators{};
+
+            if (child->isLeaf)
+            {
+                auto& source = static_cast<leaf&>(*child);
+                leaf* previous = &source;
+
+                for (size_t part = parts - 1; part != 0; part--)
+                {
+                    size_t begin = count * part / parts;
+                    size_t end = count * (part + 1) / parts;
+
+                    auto output = std::make_unique<leaf>();
+                    for (size_t i = begin; i < end; i++) {
+                        output->items.push_back(std::move(source.items[i]));
+                    }
+                    separators.push_back(output->items[0].first);
+                    siblings.push_back(std::move(output));
+                }
+                source.items.resize(count / parts);
+
+                // Link new leaves into the chain in key order
+                for (auto sibling = siblings.rbegin(); sibling != siblings.rend(); ++sibling)
+                {
+                    auto& next = static_cast<leaf&>(**sibling);
+                    next.rightLeaf = previous->rightLeaf;
+                    previous->rightLeaf = &next;
+                    previous = &next;
+                }
+                _leafWrites += siblings.size();
+            }
+            else
+            {
+                auto& source = static_cast<inner&>(*child);
+
+                for (size_t part = parts - 1; part != 0; part--)
+                {
+                    size_t begin = count * part / parts;
+                    size_t end = count * (part + 1) / parts;
+
+                    // Separator before the first child moves up a level
+                    auto output = std::make_unique<inner>();
+                    for (size_t i = begin; i < end; i++) {
+                        output->children.push_back(std::move(source.children[i]));
+                    }
+                    for (size_t i = begin; i + 1 < end; i++) {
+                        output->keys.push_back(std::move(source.keys[i]));
+                    }
+                    separators.push_back(std::move(source.keys[begin - 1]));
+
+                    // Pending items follow the same routing as new items
+                    auto split = std::stable_partition(source.buffer.begin(),
+                        source.buffer.end(), [&](const item_type& item) {
+                            return item.first < separators.back();
+                        });
+                    for (auto i = split; i != source.buffer.end(); ++i) {
+                        output->buffer.push_back(std::move(*i));
+                    }
+                    source.buffer.erase(split, source.buffer.end());
+                    siblings.push_back(std::move(output));
+                }
+                size_t kept = count / parts;
+                source.children.resize(kept);
+                source.keys.resize(kept - 1);
+            }
+
+            std::reverse(siblings.begin(), siblings.end());
+            std::reverse(separators.begin(), separators.end());
+
+            node.children.insert(node.children.begin() + index + 1,
+                std::make_move_iterator(siblings.begin()),
+                std::make_move_iterator(siblings.end()));
+            node.keys.insert(node.keys.begin() + index,
+                std::make_move_iterator(separators.begin()),
+                std::make_move_iterator(separators.end()));
+        }
+
+        void collect_pending(const inner& node, const Key* start, bool inclusiveStart,
+            const Key* end, bool inclusiveEnd, std::vector<const item_type*>& output) const
+        {
+            for (auto& item : node.buffer)
+            {
+                if (!before_start(item.first, start, inclusiveStart) &&
+                    !after_end(item.first, end, inclusiveEnd)) output.push_back(&item);
+            }
+            for (size_t i = 0; i < node.children.size(); i++)
+            {
+                auto& child = *node.children[i];
+                if (child.isLeaf) break;
+
+                // Skip children wholly outside of the range
+                if (start != nullptr && i < node.keys.size() && node.keys[i] < *start) continue;
+                if (end != nullptr && i != 0 && *end < node.keys[i - 1]) break;
+
+                collect_pending(static_cast<const inner&>(child), start, inclusiveStart,
+                    end, inclusiveEnd, output);
+            }
+        }
+
+        iterable make_range(const Key* start, bool inclusiveStart,
+            const Key* end, bool inclusiveEnd) const
+        {
+            iterable output{};
+            if (root == nullptr) return output;
+
+            if (end != nullptr)
+            {
+                output.endKey = *end;
+                output.hasEnd = true;
+                output.inclusiveEnd = inclusiveEnd;
+            }
+
+            // Find the first leaf item in range
+            const node* current = root.get();
+            while (!current->isLeaf)
+            {
+                auto& parent = static_cast<const inner&>(*current);
+                current = parent.children[start != nullptr ?
+                    child_index(parent, *start, !inclusiveStart) : 0].get();
+            }
+            output.first = static_cast<const leaf*>(current);
+            while (output.first != nullptr)
+            {
+                auto& items = output.first->items;
+                output.start = 0;
+                while (output.start != items.size() &&
+                    before_start(items[output.start].first, start, inclusiveStart)) {
+                    output.start++;
+                }
+                if (output.start != items.size()) break;
+                output.first = output.first->rightLeaf;
+                output.start = 0;
+            }
+
+            // Gather pending items in range from the buffers
+            if (!root->isLeaf)
+            {
+                collect_pending(static_cast<const inner&>(*root), start, inclusiveStart,
+                    end, inclusiveEnd, output.pending);
+                std::stable_sort(output.pending.begin(), output.pending.end(),
+                    [](const item_type* a, const item_type* b) { return a->first < b->first; });
+            }
+            return output;
+        }
+
+    public:
+        /*
+        Input iterator merging leaf items with pending items in key order.
+        */
+        class iterator
+        {
+            friend iterable;
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = item_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+
+        private:
+            const leaf* current{};
+            size_t index{};
+            const item_type* const* pending{};
+            const item_type* const* pendingEnd{};
+
+            Key endKey{};
+            bool hasEnd{};
+            bool inclusiveEnd{};
+
+            iterator(const leaf* current, size_t index, const item_type* const* pending,
+                const item_type* const* pendingEnd, const iterable& range)
+                : current(current), index(index), pending(pending), pendingEnd(pendingEnd),
+                  endKey(range.endKey), hasEnd(range.hasEnd), inclusiveEnd(range.inclusiveEnd)
+            {
+                check_bound();
+            }
+
+            void check_bound() noexcept
+            {
+                if (current != nullptr && after_end(current->items[index].first,
+                    hasEnd ? &endKey : nullptr, inclusiveEnd))
+                {
+                    current = nullptr;
+                    index = 0;
+                }
+            }
+
+            bool from_leaf() const noexcept
+            {
+                return current != nullptr && (pending == pendingEnd ||
+                    !((*pending)->first < current->items[index].first));
+            }
+
+        public:
+            reference operator *() const noexcept {
+                return from_leaf() ? current->items[index] : **pending;
+            }
+            pointer operator ->() const noexcept {
+                return &operator*();
+            }
+
+            bool operator ==(const iterator& other) const noexcept
+            {
+                return current == other.current && index == other.index &&
+                    pending == other.pending;
+            }
+            bool operator !=(const iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            iterator& operator ++() noexcept
+            {
+                if (!from_leaf())
+                {
+                    ++pending;
+                    return *this;
+                }
+                if (++index == current->items.size())
+                {
+                    current = current->rightLeaf;
+                    index = 0;
+                }
+                check_bound();
+                return *this;
+            }
+        };
+
+        class iterable
+        {
+            friend buffered_bplus_tree;
+            friend iterator;
+
+            const leaf* first{};
+            size_t start{};
+            std::vector<const item_type*> pending{};
+
+            Key endKey{};
+            bool hasEnd{};
+            bool inclusiveEnd{};
+
+        public:
+            iterator begin() const
+            {
+                return iterator(first, start, pending.data(),
+                    pending.data() + pending.size(), *this);
+            }
+            iterator end() const
+            {
+                auto* pendingEnd = pending.data() + pending.size();
+                return iterator(nullptr, 0, pendingEnd, pendingEnd, *this);
+            }
+        };
+    };
+}
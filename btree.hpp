@@ -1,7 +1,11 @@
 /* btree.hpp - (c) 2018 James Renwick */
 #pragma once
+#include "search_policy.hpp"
 #include <memory>
 #include <array>
+#include <vector>
+#include <limits>
+#include <numeric>
 #include <functional>
 #include <type_traits>
 #include <algorithm>
@@ -11,25 +15,75 @@ namespace osdb
     struct range_start { };
     struct range_end { };
 
-    template<typename T, typename Key, size_t Order, size_t LeafSize>
+    constexpr const size_t cache_line_size = 64;
+
+    // Number of leaves fetched ahead of a sequential scan
+    constexpr const size_t leaf_prefetch_distance = 2;
+
+    template<typename T, typename Key, size_t Order, size_t LeafSize,
+        bool Counted = false, typename Search = binary_search_policy>
     class bplus_node;
 
-    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        bool Counted = false, typename Search = binary_search_policy>
     class bplus_tree;
 
     template<typename Leaf>
     class leaf_iterator;
 
+    template<typename Leaf>
+    class leaf_iterable;
+
+    template<typename Key, typename Value>
+    class frozen_index;
+
+
+    /*
+    Uninitialised storage for up to N items, so that items need not be
+    default-constructible. The owner constructs and destroys each item.
+    */
+    template<typename T, size_t N>
+    class leaf_storage
+    {
+        std::aligned_storage_t<sizeof(T), alignof(T)> slots[N];
+
+    public:
+        T* data() noexcept {
+            return reinterpret_cast<T*>(slots);
+        }
+        const T* data() const noexcept {
+            return reinterpret_cast<const T*>(slots);
+        }
+
+        T& operator [](size_t index) noexcept {
+            return data()[index];
+        }
+        const T& operator [](size_t index) const noexcept {
+            return data()[index];
+        }
 
-    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+        template<typename... Args>
+        void construct(size_t index, Args&&... args) {
+            new (&slots[index]) T(std::forward<Args>(args)...);
+        }
+        void destroy(size_t index) noexcept {
+            data()[index].~T();
+        }
+    };
+
+
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        bool Counted = false, typename Search = binary_search_policy>
     class bplus_leaf
     {
-        using node_type = bplus_node<Key, Value, Order, LeafSize>;
-        using tree_type = bplus_tree<Key, Value, Order, LeafSize>;
+        using node_type = bplus_node<Key, Value, Order, LeafSize, Counted, Search>;
+        using tree_type = bplus_tree<Key, Value, Order, LeafSize, Counted, Search>;
         friend node_type;
         friend tree_type;
         friend leaf_iterator<bplus_leaf>;
         friend leaf_iterator<const bplus_leaf>;
+        friend leaf_iterable<bplus_leaf>;
+        friend leaf_iterable<const bplus_leaf>;
 
     public:
         using value_type = std::pair<Key, Value>;
@@ -37,34 +91,102 @@ namespace osdb
 
     private:
         static_assert(Order % 2 == 0, "Order must be a factor of two");
+        static_assert(LeafSize >= 2, "LeafSize must be at least two");
 
         node_type* parent{};
 
         bplus_leaf* leftLeaf;
         bplus_leaf* rightLeaf;
 
-        std::array<std::pair<Key, Value>, LeafSize> items{};
+        leaf_storage<value_type, LeafSize> items;
         size_t count{};
 
         bplus_leaf(node_type* parent, bplus_leaf* left, bplus_leaf* right)
             : parent(parent), leftLeaf(left), rightLeaf(right) { }
 
-        size_t add(Key key, Value value)
+    public:
+        bplus_leaf(const bplus_leaf&) = delete;
+        bplus_leaf& operator =(const bplus_leaf&) = delete;
+
+        ~bplus_leaf()
+        {
+            for (size_t i = 0; i < count; i++) {
+                items.destroy(i);
+            }
+        }
+
+    private:
+        /*
+        Constructs an item from the key and the arguments for its value
+        after any items with equal keys, so values need not be comparable.
+        Following items are shifted up, but the new item is not moved.
+        */
+        template<typename... Args>
+        Value* emplace(Key key, Args&&... args)
+        {
+            size_t index = upper_bound(key);
+            if (index != count)
+            {
+                items.construct(count, std::move(items[count - 1]));
+                std::move_backward(items.data() + index, items.data() + count - 1,
+                    items.data() + count);
+                items.destroy(index);
+            }
+
+            try
+            {
+                items.construct(index, std::piecewise_construct,
+                    std::forward_as_tuple(std::move(key)),
+                    std::forward_as_tuple(std::forward<Args>(args)...));
+            }
+            catch (...)
+            {
+                // Close the gap again
+                if (index != count)
+                {
+                    items.construct(index, std::move(items[index + 1]));
+                    std::move(items.data() + index + 2, items.data() + count + 1,
+                        items.data() + index + 1);
+                    items.destroy(count);
+                }
+                throw;
+            }
+            count++;
+            return &items[index].second;
+        }
+
+        size_t lower_bound(const Key& key) const noexcept
         {
-            items[count++] = std::pair<Key, Value>(
-                std::move(key), std::move(value));
+            return Search::lower_bound(items.data(), count, key,
+                [](const value_type& item) -> const Key& { return item.first; });
+        }
 
-            std::sort(std::begin(items),
-                count != LeafSize ? (std::begin(items) + count) : std::end(items));
-            return 0;
+        size_t upper_bound(const Key& key) const noexcept
+        {
+            return Search::upper_bound(items.data(), count, key,
+                [](const value_type& item) -> const Key& { return item.first; });
+        }
+
+        const Value* find(const Key& key) const noexcept
+        {
+            // The first item not less than key may be the head of the next leaf
+            size_t i = lower_bound(key);
+            if (i != count) {
+                return items[i].first == key ? &items[i].second : nullptr;
+            }
+            if (rightLeaf != nullptr && rightLeaf->items[0].first == key) {
+                return &rightLeaf->items[0].second;
+            }
+            return nullptr;
         }
     };
 
 
-    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        bool Counted, typename Search>
     class bplus_node
     {
-        friend bplus_tree<Key, Value, Order, LeafSize>;
+        friend bplus_tree<Key, Value, Order, LeafSize, Counted, Search>;
         static_assert(Order % 2 == 0, "Order must be a factor of two");
         static_assert(Order <= std::numeric_limits<size_t>::max() / 2, "");
 
@@ -72,7 +194,7 @@ namespace osdb
         using key_type = Key;
 
     private:
-        using leaf_type = bplus_leaf<Key, Value, Order, LeafSize>;
+        using leaf_type = bplus_leaf<Key, Value, Order, LeafSize, Counted, Search>;
 
         union element
         {
@@ -91,6 +213,9 @@ namespace osdb
         std::array<key_type, Order> keys{};
         std::array<element, Order + 1> nodes{};
 
+        // Number of items beneath each child, only kept when Counted
+        std::array<size_t, Counted ? Order + 1 : 0> counts{};
+
         bplus_node(bplus_node* parent, size_t parentIndex, bool hasLeaves)
             : parent(parent)
         {
@@ -105,6 +230,12 @@ namespace osdb
         bplus_node& operator =(bplus_node&&) = default;
 
         ~bplus_node()
+        {
+            clear();
+        }
+
+    private:
+        void clear() noexcept
         {
             if (_data.hasLeaves)
             {
@@ -118,9 +249,47 @@ namespace osdb
                     if (elem.node != nullptr) delete elem.node;
                 }
             }
+            nodes.fill(element{});
+            if (Counted) counts.fill(0);
+            _data.hasLeaves = true;
+        }
+
+        // Deletes the nodes beneath this one, but not the leaves
+        void release_leaves() noexcept
+        {
+            if (_data.hasLeaves) {
+                nodes.fill(element{});
+            }
+            else
+            {
+                for (auto& elem : nodes) {
+                    if (elem.node != nullptr) elem.node->release_leaves();
+                }
+            }
+            clear();
+        }
+
+        /*
+        Takes children [first, last) of the given level, using the first
+        key beneath each child after the first as its separator. Returns
+        the number of items beneath them.
+        */
+        size_t assign_children(const std::vector<element>& children,
+            const std::vector<key_type>& firstKeys, const std::vector<size_t>& sizes,
+            size_t first, size_t last)
+        {
+            size_t count = 0;
+            for (size_t i = first; i < last; i++)
+            {
+                nodes[i - first] = children[i];
+                adopt(i - first);
+                if (i != first) keys[i - first - 1] = firstKeys[i];
+                if (Counted) counts[i - first] = sizes[i];
+                count += sizes[i];
+            }
+            return count;
         }
 
-    private:
         leaf_type* prev_leaf() noexcept
         {
             if (parent == nullptr) return nullptr;
@@ -183,30 +352,206 @@ namespace osdb
             return *leaf;
         }
 
-        size_t add(Key key, Value value, leaf_type*& first, leaf_type*& last)
+        bool full() const noexcept {
+            return nodes[Order].node != nullptr;
+        }
+
+        /*
+        Gets the index of the child to descend into for the given key.
+        Separator keys[i] is the first key of child i + 1 at the time it was
+        split off, so equal keys may appear on both sides of a separator.
+        When upper is false the leftmost candidate child is chosen,
+        otherwise the child following all equal separators.
+        */
+        size_t child_index(const key_type& key, bool upper) const noexcept
+        {
+            auto identity = [](const key_type& k) -> const key_type& { return k; };
+            size_t count = separator_count();
+            return upper ? Search::upper_bound(keys.data(), count, key, identity) :
+                Search::lower_bound(keys.data(), count, key, identity);
+        }
+
+        size_t separator_count() const noexcept
+        {
+            // Children are contiguous, so count those after the first
+            auto iter = std::partition_point(nodes.begin() + 1, nodes.end(),
+                [](const element& elem) { return elem.node != nullptr; });
+            return static_cast<size_t>(iter - (nodes.begin() + 1));
+        }
+
+        void adopt(size_t index) noexcept
+        {
+            if (_data.hasLeaves)
+            {
+                if (nodes[index].leaf != nullptr) {
+                    nodes[index].leaf->parent = this;
+                }
+            }
+            else if (nodes[index].node != nullptr)
+            {
+                nodes[index].node->parent = this;
+                nodes[index].node->_data.parentIndex = index;
+            }
+        }
+
+        void insert_child(size_t index, key_type key, element child, size_t count)
+        {
+            // Shift following children and separators right
+            for (size_t i = Order; i > index + 1; i--)
+            {
+                nodes[i] = nodes[i-1];
+                adopt(i);
+                if (Counted) counts[i] = counts[i-1];
+            }
+            for (size_t i = Order - 1; i > index; i--) {
+                keys[i] = std::move(keys[i-1]);
+            }
+            keys[index] = std::move(key);
+            nodes[index + 1] = child;
+            adopt(index + 1);
+
+            // Child was split off from its left sibling
+            if (Counted)
+            {
+                counts[index + 1] = count;
+                counts[index] -= count;
+            }
+        }
+
+        void split_child(size_t index, leaf_type*& last)
+        {
+            element right{};
+
+            if (_data.hasLeaves)
+            {
+                leaf_type* leaf = nodes[index].leaf;
+                right.leaf = new leaf_type(this, leaf, leaf->rightLeaf);
+
+                // Move upper half of items into the new leaf
+                constexpr size_t half = LeafSize / 2;
+                for (size_t i = half; i < leaf->count; i++)
+                {
+                    right.leaf->items.construct(i - half, std::move(leaf->items[i]));
+                    leaf->items.destroy(i);
+                }
+                right.leaf->count = leaf->count - half;
+                leaf->count = half;
+
+                // Update linked list
+                if (leaf->rightLeaf != nullptr) {
+                    leaf->rightLeaf->leftLeaf = right.leaf;
+                }
+                else last = right.leaf;
+                leaf->rightLeaf = right.leaf;
+
+                insert_child(index, right.leaf->items[0].first, right,
+                    right.leaf->count);
+            }
+            else
+            {
+                bplus_node* node = nodes[index].node;
+                right.node = new bplus_node(this, index + 1, node->_data.hasLeaves);
+
+                // Move children after the middle separator into the new node
+                constexpr size_t mid = Order / 2;
+                size_t count = 0;
+                for (size_t i = mid + 1; i <= Order; i++)
+                {
+                    right.node->nodes[i - mid - 1] = node->nodes[i];
+                    right.node->adopt(i - mid - 1);
+                    node->nodes[i] = element{};
+
+                    if (Counted)
+                    {
+                        right.node->counts[i - mid - 1] = node->counts[i];
+                        count += node->counts[i];
+                        node->counts[i] = 0;
+                    }
+                }
+                for (size_t i = mid + 1; i < Order; i++) {
+                    right.node->keys[i - mid - 1] = std::move(node->keys[i]);
+                }
+                insert_child(index, std::move(node->keys[mid]), right, count);
+            }
+        }
+
+        void grow(leaf_type*& last)
         {
-            size_t i = 0;
-            for (; i < Order; i++) {
-                if (nodes[i+1].node == nullptr || key < keys[i]) break;
+            // Move contents into a new only child, then split it
+            auto* child = new bplus_node(this, 0, _data.hasLeaves);
+            for (size_t i = 0; i < Order; i++) {
+                child->keys[i] = std::move(keys[i]);
+            }
+            size_t count = 0;
+            for (size_t i = 0; i <= Order; i++)
+            {
+                child->nodes[i] = nodes[i];
+                child->adopt(i);
+                nodes[i] = element{};
+
+                if (Counted)
+                {
+                    child->counts[i] = counts[i];
+                    count += counts[i];
+                    counts[i] = 0;
+                }
             }
+            _data.hasLeaves = false;
+            nodes[0].node = child;
+            if (Counted) counts[0] = count;
+            split_child(0, last);
+        }
+
+        /*
+        Adds an item beneath this node, setting output to its value and
+        returning the depth of the leaf holding it.
+        */
+        template<typename... Args>
+        size_t emplace(Value*& output, leaf_type*& first, leaf_type*& last,
+            Key key, Args&&... args)
+        {
+            size_t i = child_index(key, true);
 
+            // Full children are split on the way down, so there is
+            // always room here for a separator from the level below
             if (_data.hasLeaves)
             {
                 if (nodes[i].leaf == nullptr) {
                     nodes[i].leaf = &insert_leaf(i, first, last);
                 }
-                return nodes[i].leaf->add(std::move(key), std::move(value));
+                else if (nodes[i].leaf->count == LeafSize)
+                {
+                    split_child(i, last);
+                    i = child_index(key, true);
+                }
+                output = nodes[i].leaf->emplace(std::move(key), std::forward<Args>(args)...);
+                if (Counted) counts[i]++;
+                return 0;
             }
             else
             {
-                if (nodes[i].node == nullptr) {
-                    nodes[i].node = new bplus_node(this, i, true);
+                if (nodes[i].node->full())
+                {
+                    split_child(i, last);
+                    i = child_index(key, true);
                 }
-                return nodes[i].node->add(std::move(key), std::move(value), first, last);
+                size_t depth = nodes[i].node->emplace(output, first, last,
+                    std::move(key), std::forward<Args>(args)...) + 1;
+                if (Counted) counts[i]++;
+                return depth;
             }
         }
     };
 
+    template<typename Leaf>
+    void prefetch_leaf(const Leaf* leaf) noexcept
+    {
+        auto* data = reinterpret_cast<const char*>(leaf);
+        for (size_t i = 0; i < sizeof(Leaf); i += cache_line_size) {
+            __builtin_prefetch(data + i);
+        }
+    }
+
     template<typename Leaf>
     class leaf_iterator
     {
@@ -221,9 +566,13 @@ namespace osdb
         Leaf* leaf;
         size_t index;
 
+        // Furthest leaf prefetched, and how many leaves ahead it is
+        Leaf* lookahead;
+        size_t ahead{};
+
     public:
         leaf_iterator(Leaf* leaf, size_t index) noexcept
-            : leaf(leaf), index(index) { }
+            : leaf(leaf), index(index), lookahead(leaf) { }
 
         auto& operator *() noexcept {
             return leaf->items[index];
@@ -245,6 +594,17 @@ namespace osdb
             {
                 leaf = leaf->rightLeaf;
                 index = 0;
+
+                // Keep the next few leaves in flight
+                if (ahead != 0) ahead--;
+                else lookahead = leaf;
+
+                for (; ahead < leaf_prefetch_distance &&
+                    lookahead->rightLeaf != nullptr; ahead++)
+                {
+                    lookahead = lookahead->rightLeaf;
+                    prefetch_leaf(lookahead);
+                }
             }
             return *this;
         }
@@ -262,6 +622,8 @@ namespace osdb
             {
                 leaf = leaf->leftLeaf;
                 index = leaf->count - 1;
+                lookahead = leaf;
+                ahead = 0;
             }
             return *this;
         }
@@ -275,6 +637,28 @@ namespace osdb
     };
 
 
+    template<typename T>
+    class leaf_span
+    {
+        T* first;
+        T* last;
+
+    public:
+        leaf_span(T* first, T* last) noexcept
+            : first(first), last(last) { }
+
+        T* begin() const noexcept {
+            return first;
+        }
+        T* end() const noexcept {
+            return last;
+        }
+        size_t size() const noexcept {
+            return static_cast<size_t>(last - first);
+        }
+    };
+
+
     template<typename Leaf>
     class leaf_iterable
     {
@@ -283,7 +667,8 @@ namespace osdb
         Leaf* last;
         size_t _end;
 
-        template<typename Key, typename Value, size_t Order, size_t LeafSize>
+        template<typename Key, typename Value, size_t Order, size_t LeafSize,
+            bool Counted, typename Search>
         friend class bplus_tree;
 
     public:
@@ -302,9 +687,89 @@ namespace osdb
         auto rend() noexcept {
             return std::reverse_iterator<leaf_iterator<Leaf>>(begin());
         }
+
+        /*
+        Invokes func with a leaf_span of the items in range for each leaf in
+        turn, so that consumers can process whole leaves at once. Leaves
+        are prefetched a fixed distance ahead of the scan.
+        */
+        template<typename Func>
+        void scan_leaves(Func&& func) const
+        {
+            if (first == nullptr) return;
+
+            Leaf* lookahead = first;
+            for (size_t i = 0; i < leaf_prefetch_distance &&
+                lookahead->rightLeaf != nullptr; i++)
+            {
+                lookahead = lookahead->rightLeaf;
+                prefetch_leaf(lookahead);
+            }
+
+            Leaf* leaf = first;
+            size_t index = start;
+            while (true)
+            {
+                size_t end = leaf == last ? _end : leaf->count;
+                if (index < end) {
+                    func(leaf_span<std::remove_reference_t<decltype(leaf->items[0])>>(
+                        leaf->items.data() + index, leaf->items.data() + end));
+                }
+                if (leaf == last || leaf->rightLeaf == nullptr) break;
+
+                leaf = leaf->rightLeaf;
+                index = 0;
+
+                if (lookahead->rightLeaf != nullptr)
+                {
+                    lookahead = lookahead->rightLeaf;
+                    prefetch_leaf(lookahead);
+                }
+            }
+        }
+
+        /*
+        Invokes func with each item in range.
+        */
+        template<typename Func>
+        void scan(Func&& func) const
+        {
+            scan_leaves([&](const auto& span) {
+                for (auto& item : span) func(item);
+            });
+        }
+    };
+
+    /*
+    Shape and memory use of a bplus_tree, as reported by stats().
+    */
+    struct bplus_tree_stats
+    {
+        size_t items{};
+        size_t nodes{};
+        size_t leaves{};
+
+        // Bytes allocated for inner nodes and leaves, excluding the root
+        size_t bytes{};
+
+        // Mean fraction of the item slots of each leaf in use
+        double leafFill{};
+        // Mean fraction of the child slots of each inner node in use
+        double nodeFill{};
+
+        // Number of inner nodes at each depth from the root, then of leaves
+        std::vector<size_t> levels{};
     };
 
-    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+    /*
+    A B+ tree mapping keys to values, permitting duplicate keys. When
+    Counted is true, inner nodes also keep the number of items beneath each
+    child, providing rank, select and count_range in logarithmic time.
+    Search selects how keys are located within each node; see
+    search_policy.hpp.
+    */
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        bool Counted, typename Search>
     class bplus_tree
     {
         static_assert(Order % 2 == 0, "Order must be a factor of two");
@@ -314,15 +779,15 @@ namespace osdb
         using value_type = Value;
 
     private:
-        using node_type = bplus_node<Key, Value, Order, LeafSize>;
+        using node_type = bplus_node<Key, Value, Order, LeafSize, Counted, Search>;
         using leaf_type = typename node_type::leaf_type;
 
         size_t _height{};
         size_t _size{};
         node_type root{nullptr, 0, true};
 
-        leaf_type* firstLeaf;
-        leaf_type* lastLeaf;
+        leaf_type* firstLeaf{};
+        leaf_type* lastLeaf{};
 
     public:
         constexpr size_t order() const noexcept {
@@ -341,11 +806,180 @@ namespace osdb
             return _size;
         }
 
+        /*
+        Gets the number of nodes and leaves, their memory use and how full
+        they are. Only inner nodes are visited, as leaf occupancy follows
+        from the item count, so this costs a small fraction of a scan.
+        */
+        bplus_tree_stats stats() const
+        {
+            bplus_tree_stats output{};
+            output.items = _size;
+
+            size_t children = 0;
+            std::vector<const node_type*> level{ &root };
+            while (!level.empty())
+            {
+                output.levels.push_back(level.size());
+                output.nodes += level.size();
+
+                std::vector<const node_type*> next{};
+                for (auto* node : level)
+                {
+                    for (auto& elem : node->nodes)
+                    {
+                        if (node->_data.hasLeaves)
+                        {
+                            if (elem.leaf == nullptr) continue;
+                            output.leaves++;
+                        }
+                        else
+                        {
+                            if (elem.node == nullptr) continue;
+                            next.push_back(elem.node);
+                        }
+                        children++;
+                    }
+                }
+                level = std::move(next);
+            }
+            output.levels.push_back(output.leaves);
+
+            output.bytes = (output.nodes - 1) * sizeof(node_type) +
+                output.leaves * sizeof(leaf_type);
+            output.nodeFill = static_cast<double>(children) / (output.nodes * (Order + 1));
+            if (output.leaves != 0) {
+                output.leafFill = static_cast<double>(_size) / (output.leaves * LeafSize);
+            }
+            return output;
+        }
+
         void add(Key key, Value value) &
         {
-            _height = root.add(std::move(key), std::move(value),
-                firstLeaf, lastLeaf);
+            emplace(std::move(key), std::move(value));
+        }
+
+        /*
+        Adds an item whose value is constructed in place from the given
+        arguments, returning a pointer to the value. Values need not be
+        default-constructible or copyable.
+        */
+        template<typename... Args>
+        value_type* emplace(Key key, Args&&... args) &
+        {
+            if (root.full()) root.grow(lastLeaf);
+
+            value_type* output{};
+            _height = root.emplace(output, firstLeaf, lastLeaf,
+                std::move(key), std::forward<Args>(args)...);
             _size++;
+            return output;
+        }
+
+        /*
+        Adds an item as emplace does, unless an item with the given key
+        exists, in which case no value is constructed. Returns the value of
+        the new or first existing item, and whether an item was added.
+        */
+        template<typename... Args>
+        std::pair<value_type*, bool> try_emplace(const key_type& key, Args&&... args) &
+        {
+            value_type* existing = find(key);
+            if (existing != nullptr) return { existing, false };
+            return { emplace(key, std::forward<Args>(args)...), true };
+        }
+
+        /*
+        Assigns to the value of the first item with the given key, or adds
+        an item if there is none. Returns the value and whether an item
+        was added.
+        */
+        template<typename T>
+        std::pair<value_type*, bool> insert_or_assign(const key_type& key, T&& value) &
+        {
+            value_type* existing = find(key);
+            if (existing == nullptr) return { emplace(key, std::forward<T>(value)), true };
+
+            *existing = std::forward<T>(value);
+            return { existing, false };
+        }
+
+        void clear() noexcept
+        {
+            root.clear();
+            firstLeaf = lastLeaf = nullptr;
+            _height = _size = 0;
+        }
+
+        /*
+        Replaces the contents of the tree with a range of key-value pairs
+        in key order, which must not refer to this tree. The tree is built
+        bottom-up from full leaves in linear time, without searching for
+        each item.
+        */
+        template<typename Iterable>
+        void assign_sorted(Iterable&& range) &
+        {
+            clear();
+            for (auto&& pair : range)
+            {
+                append_sorted(std::forward<decltype(pair)>(pair).first,
+                    std::forward<decltype(pair)>(pair).second);
+            }
+            build_levels();
+        }
+
+        /*
+        Moves every item of other into this tree, leaving other empty. Items
+        of this tree precede those of other with equal keys. The two chains
+        of leaves are merged in a single pass and the tree is rebuilt
+        bottom-up, in linear rather than O(n log n) time. When the keys of
+        the trees do not overlap, the chains are joined as they are and
+        only the inner nodes are rebuilt.
+        */
+        void merge(bplus_tree& other) &
+        {
+            if (&other == this || other._size == 0) return;
+
+            size_t size = _size + other._size;
+            bool before = _size != 0 &&
+                other.lastLeaf->items[other.lastLeaf->count - 1].first < firstLeaf->items[0].first;
+            bool after = _size == 0 ||
+                !(other.firstLeaf->items[0].first < lastLeaf->items[lastLeaf->count - 1].first);
+
+            leaf_type* left = take_leaves();
+            leaf_type* right = other.take_leaves();
+            if (before || after)
+            {
+                if (before) std::swap(left, right);
+                join_leaves(left);
+                join_leaves(right);
+                _size = size;
+            }
+            else
+            {
+                size_t i = 0, j = 0;
+                while (left != nullptr || right != nullptr)
+                {
+                    bool fromLeft = right == nullptr || (left != nullptr &&
+                        !(right->items[j].first < left->items[i].first));
+                    leaf_type*& leaf = fromLeft ? left : right;
+                    size_t& index = fromLeft ? i : j;
+
+                    auto& item = leaf->items[index];
+                    append_sorted(std::move(item.first), std::move(item.second));
+
+                    // Free each source leaf once it has been consumed
+                    if (++index == leaf->count)
+                    {
+                        leaf_type* next = leaf->rightLeaf;
+                        delete leaf;
+                        leaf = next;
+                        index = 0;
+                    }
+                }
+            }
+            build_levels();
         }
 
         auto search_range(range_start = range_start{}, range_end = range_end{},
@@ -364,7 +998,7 @@ namespace osdb
 
             // Get first leaf and index of first item
             size_t firstIndex = 0;
-            const leaf_type* firstLeaf = find_leaf(start, inclusiveStart);
+            const leaf_type* firstLeaf = find_leaf(start, !inclusiveStart);
 
             if (firstLeaf != nullptr)
             {
@@ -373,7 +1007,7 @@ namespace osdb
                     if ((inclusiveStart && firstLeaf->items[firstIndex].first == start) ||
                         firstLeaf->items[firstIndex].first > start) break;
                 }
-                if (firstIndex == firstLeaf->count)
+                if (firstIndex == firstLeaf->count && firstLeaf->rightLeaf != nullptr)
                 {
                     firstLeaf = firstLeaf->rightLeaf;
                     firstIndex = 0;
@@ -419,27 +1053,405 @@ namespace osdb
             auto leftIter = search_range(start, range_end{}, inclusiveStart);
             auto rightIter = search_range(range_start{}, end, true, inclusiveEnd);
 
+            // An empty range would otherwise begin after its own end
+            if (end < start || (!(start < end) && !(inclusiveStart && inclusiveEnd))) {
+                return leaf_iterable<const leaf_type>(
+                    rightIter.last, rightIter._end, rightIter.last, rightIter._end);
+            }
             return leaf_iterable<const leaf_type>(
                 leftIter.first, leftIter.start, rightIter.last, rightIter._end);
         }
 
-    private:
-        const leaf_type* find_leaf(const key_type& value, bool inclusive) const
+        /*
+        Splits a range into at most the given number of consecutive sub-ranges
+        of roughly equal size, so that each may be scanned by its own thread.
+        The range is divided at the separator keys of the highest tree level
+        which has enough of them within the range.
+        */
+        template<typename T = range_start, typename Y = range_end>
+        std::vector<leaf_iterable<const leaf_type>> partition_range(size_t parts,
+            const T& start = T{}, const Y& end = Y{},
+            bool inclusiveStart = true, bool inclusiveEnd = true) const &
         {
+            auto range = search_range(start, end, inclusiveStart, inclusiveEnd);
+
+            std::vector<leaf_iterable<const leaf_type>> output{};
+            if (parts <= 1 || range.begin() == range.end())
+            {
+                output.push_back(range);
+                return output;
+            }
+
+            // Get keys of the first and last items in range
+            const key_type& low = range.first->items[range.start].first;
+            const leaf_type* highLeaf = range._end != 0 ? range.last : range.last->leftLeaf;
+            const key_type& high = highLeaf->items[
+                (range._end != 0 ? range._end : highLeaf->count) - 1].first;
+
+            // Collect separators within range, one level at a time
+            std::vector<const node_type*> level{&root};
+            std::vector<const key_type*> separators{};
+            while (true)
+            {
+                std::vector<const node_type*> next{};
+                separators.clear();
+
+                for (auto* node : level)
+                {
+                    for (size_t i = 0; i <= Order && node->nodes[i].node != nullptr; i++)
+                    {
+                        // Skip children wholly outside of the range
+                        if (i != Order && node->nodes[i+1].node != nullptr &&
+                            node->keys[i] < low) continue;
+                        if (i != 0 && high < node->keys[i-1]) break;
+
+                        if (i != 0 && low < node->keys[i-1] &&
+                            (separators.empty() || *separators.back() < node->keys[i-1]))
+                        {
+                            separators.push_back(&node->keys[i-1]);
+                        }
+                        if (!node->_data.hasLeaves) next.push_back(node->nodes[i].node);
+                    }
+                }
+                if (separators.size() + 1 >= parts || next.empty()) break;
+                level = std::move(next);
+            }
+
+            // Pick evenly-spaced separators and split the range at each
+            size_t splits = std::min(parts - 1, separators.size());
+            const leaf_type* leaf = range.first;
+            size_t index = range.start;
+
+            for (size_t i = 0; i < splits; i++)
+            {
+                auto split = search_range(*separators[
+                    ((i + 1) * (separators.size() + 1)) / (splits + 1) - 1]);
+
+                output.emplace_back(leaf, index, split.first, split.start);
+                leaf = split.first;
+                index = split.start;
+            }
+            output.emplace_back(leaf, index, range.last, range._end);
+            return output;
+        }
+
+        const value_type* find(const key_type& key) const
+        {
+            const leaf_type* leaf = find_leaf(key, false);
+            return leaf != nullptr ? leaf->find(key) : nullptr;
+        }
+
+        value_type* find(const key_type& key)
+        {
+            return const_cast<value_type*>(
+                static_cast<const bplus_tree&>(*this).find(key));
+        }
+
+        /*
+        Looks up each of the given keys, returning a pointer to the value of
+        the first matching item (or nullptr) for each, in input order.
+        Probes are sorted and descend the tree together one level at a time,
+        prefetching every child before any is visited so that cache misses
+        overlap rather than occurring one after another.
+        */
+        template<typename Keys>
+        std::vector<const value_type*> find_batch(const Keys& keys) const
+        {
+            std::vector<const key_type*> probes{};
+            for (auto& key : keys) probes.push_back(&key);
+
+            std::vector<const value_type*> output(probes.size());
+            if (probes.empty() || firstLeaf == nullptr) return output;
+
+            // Visit probes in key order for locality between neighbours
+            std::vector<size_t> order(probes.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return *probes[a] < *probes[b];
+            });
+
+            std::vector<const node_type*> level(probes.size(), &root);
+            while (!level[0]->_data.hasLeaves)
+            {
+                for (size_t i = 0; i < order.size(); i++)
+                {
+                    auto* node = level[i];
+                    level[i] = node->nodes[node->child_index(
+                        *probes[order[i]], false)].node;
+                    __builtin_prefetch(&level[i]->keys);
+                }
+            }
+
+            std::vector<const leaf_type*> leaves(probes.size());
+            for (size_t i = 0; i < order.size(); i++)
+            {
+                auto* node = level[i];
+                leaves[i] = node->nodes[node->child_index(
+                    *probes[order[i]], false)].leaf;
+                __builtin_prefetch(&leaves[i]->items);
+            }
+            for (size_t i = 0; i < order.size(); i++) {
+                output[order[i]] = leaves[i]->find(*probes[order[i]]);
+            }
+            return output;
+        }
+
+        /*
+        Gets the number of items with keys less than the given key, or not
+        greater than it if inclusive is true. Requires a Counted tree.
+        */
+        size_t rank(const key_type& key, bool inclusive = false) const
+        {
+            static_assert(Counted, "rank requires a Counted tree");
+
+            size_t output = 0;
+            const node_type* node = &root;
+            while (true)
+            {
+                size_t i = node->child_index(key, inclusive);
+                for (size_t j = 0; j < i; j++) {
+                    output += node->counts[j];
+                }
+                if (!node->_data.hasLeaves) {
+                    node = node->nodes[i].node;
+                    continue;
+                }
+
+                const leaf_type* leaf = node->nodes[i].leaf;
+                if (leaf != nullptr) {
+                    output += inclusive ? leaf->upper_bound(key) : leaf->lower_bound(key);
+                }
+                return output;
+            }
+        }
+
+        /*
+        Gets the number of items within the given range without visiting
+        them. Requires a Counted tree.
+        */
+        size_t count_range(const key_type& start, const key_type& end,
+            bool inclusiveStart = true, bool inclusiveEnd = true) const
+        {
+            size_t low = rank(start, !inclusiveStart);
+            size_t high = rank(end, inclusiveEnd);
+            return high > low ? high - low : 0;
+        }
+
+        /*
+        Gets the item at the given position in key order, or nullptr if
+        there is no such item. Requires a Counted tree.
+        */
+        const typename leaf_type::value_type* select(size_t index) const
+        {
+            static_assert(Counted, "select requires a Counted tree");
+            if (index >= _size) return nullptr;
+
             const node_type* node = &root;
             while (true)
             {
                 size_t i = 0;
-                for (; i < Order; i++)
+                for (; index >= node->counts[i]; i++) {
+                    index -= node->counts[i];
+                }
+                if (node->_data.hasLeaves) {
+                    return &node->nodes[i].leaf->items[index];
+                }
+                node = node->nodes[i].node;
+            }
+        }
+
+        /*
+        Builds an immutable, read-optimised copy of the tree. Requires
+        frozen_index.hpp.
+        */
+        frozen_index<Key, Value> freeze() const
+        {
+            return frozen_index<Key, Value>::build(search_range());
+        }
+
+    private:
+        // Appends an item to the last leaf, ignoring the inner nodes
+        template<typename K, typename V>
+        void append_sorted(K&& key, V&& value)
+        {
+            if (lastLeaf == nullptr || lastLeaf->count == LeafSize)
+            {
+                auto* leaf = new leaf_type(nullptr, lastLeaf, nullptr);
+                if (lastLeaf != nullptr) lastLeaf->rightLeaf = leaf;
+                else firstLeaf = leaf;
+                lastLeaf = leaf;
+            }
+            lastLeaf->items.construct(lastLeaf->count,
+                std::forward<K>(key), std::forward<V>(value));
+            lastLeaf->count++;
+            _size++;
+        }
+
+        // Detaches the chain of leaves and clears the tree, returning the first
+        leaf_type* take_leaves() noexcept
+        {
+            leaf_type* first = firstLeaf;
+            root.release_leaves();
+            firstLeaf = lastLeaf = nullptr;
+            _height = _size = 0;
+            return first;
+        }
+
+        // Appends a detached chain of leaves to the last leaf
+        void join_leaves(leaf_type* leaf) noexcept
+        {
+            while (leaf != nullptr)
+            {
+                leaf_type* next = leaf->rightLeaf;
+                if (leaf->count == 0) {
+                    delete leaf;
+                }
+                else
+                {
+                    leaf->leftLeaf = lastLeaf;
+                    leaf->rightLeaf = nullptr;
+                    if (lastLeaf != nullptr) lastLeaf->rightLeaf = leaf;
+                    else firstLeaf = leaf;
+                    lastLeaf = leaf;
+                }
+                leaf = next;
+            }
+        }
+
+        // Builds the inner nodes above the chain of leaves, level by level
+        void build_levels()
+        {
+            using element = typename node_type::element;
+
+            std::vector<element> level{};
+            std::vector<key_type> firstKeys{};
+            std::vector<size_t> sizes{};
+            for (leaf_type* leaf = firstLeaf; leaf != nullptr; leaf = leaf->rightLeaf)
+            {
+                level.emplace_back();
+                level.back().leaf = leaf;
+                firstKeys.push_back(leaf->items[0].first);
+                sizes.push_back(leaf->count);
+            }
+
+            // Spread each level evenly over as few nodes as will hold it
+            bool hasLeaves = true;
+            while (level.size() > Order + 1)
+            {
+                std::vector<element> next{};
+                std::vector<key_type> nextKeys{};
+                std::vector<size_t> nextSizes{};
+
+                size_t groups = (level.size() + Order) / (Order + 1);
+                for (size_t i = 0, first = 0; i < groups; i++)
                 {
-                    if (value < node->keys[i]) continue;
-                    else if (!inclusive && (node->keys[i] == value)) continue;
-                    else break;
+                    size_t last = level.size() * (i + 1) / groups;
+                    auto* node = new node_type(nullptr, i, hasLeaves);
+
+                    next.emplace_back();
+                    next.back().node = node;
+                    nextKeys.push_back(firstKeys[first]);
+                    nextSizes.push_back(node->assign_children(
+                        level, firstKeys, sizes, first, last));
+                    first = last;
                 }
+                level = std::move(next);
+                firstKeys = std::move(nextKeys);
+                sizes = std::move(nextSizes);
+                hasLeaves = false;
+                _height++;
+            }
+            root._data.hasLeaves = hasLeaves;
+            root.assign_children(level, firstKeys, sizes, 0, level.size());
+        }
+
+        /*
+        Finds the leaf at which a search for the given key should begin.
+        When upper is true, the search skips past items equal to the key.
+        */
+        const leaf_type* find_leaf(const key_type& value, bool upper) const
+        {
+            const node_type* node = &root;
+            while (true)
+            {
+                size_t i = node->child_index(value, upper);
                 if (node->_data.hasLeaves) return node->nodes[i].leaf;
                 else node = node->nodes[i].node;
             }
             return nullptr;
         }
     };
+
+    namespace detail
+    {
+        constexpr size_t align_up(size_t offset, size_t alignment) noexcept {
+            return (offset + alignment - 1) / alignment * alignment;
+        }
+    }
+
+    /*
+    Picks the largest Order and LeafSize for which each inner node and
+    each leaf of a bplus_tree fits within TargetBytes, such as a cache line
+    or a disk page, by modelling the layout of the two classes.
+    */
+    template<typename Key, typename Value, size_t TargetBytes, bool Counted = false>
+    struct bplus_fanout
+    {
+    private:
+        using item_type = std::pair<Key, Value>;
+
+        static constexpr size_t node_bytes(size_t order) noexcept
+        {
+            // Parent, packed parent index, keys, children and counts
+            size_t offset = sizeof(void*) + sizeof(size_t);
+            offset = detail::align_up(offset, alignof(Key)) + order * sizeof(Key);
+            offset = detail::align_up(offset, alignof(void*)) + (order + 1) * sizeof(void*);
+            offset += Counted ? (order + 1) * sizeof(size_t) : 1;
+            return detail::align_up(offset, std::max(alignof(Key), alignof(void*)));
+        }
+
+        static constexpr size_t leaf_bytes(size_t size) noexcept
+        {
+            // Parent, siblings, items and count
+            size_t offset = 3 * sizeof(void*);
+            offset = detail::align_up(offset, alignof(item_type)) + size * sizeof(item_type);
+            offset = detail::align_up(offset, alignof(size_t)) + sizeof(size_t);
+            return detail::align_up(offset, std::max(alignof(item_type), alignof(size_t)));
+        }
+
+        static constexpr size_t pick_order() noexcept
+        {
+            size_t order = TargetBytes / (sizeof(Key) + sizeof(void*)) + 2;
+            order -= order % 2;
+            while (order > 2 && node_bytes(order) > TargetBytes) order -= 2;
+            return order;
+        }
+
+        static constexpr size_t pick_leaf_size() noexcept
+        {
+            size_t size = TargetBytes / sizeof(item_type) + 1;
+            while (size > 2 && leaf_bytes(size) > TargetBytes) size--;
+            return size;
+        }
+
+    public:
+        static constexpr const size_t order = pick_order();
+        static constexpr const size_t leaf_size = pick_leaf_size();
+
+        static_assert(order == 2 || sizeof(bplus_node<Key, Value, order,
+            leaf_size, Counted>) <= TargetBytes, "Inner nodes exceed the target size");
+        static_assert(leaf_size == 2 || sizeof(bplus_leaf<Key, Value, order,
+            leaf_size, Counted>) <= TargetBytes, "Leaves exceed the target size");
+    };
+
+    /*
+    A bplus_tree whose inner nodes and leaves are sized to TargetBytes,
+    for instance cache_line_size for an in-memory index, or the page size
+    of a page_manager for one written to disk.
+    */
+    template<typename Key, typename Value, size_t TargetBytes, bool Counted = false,
+        typename Search = binary_search_policy>
+    using bplus_tree_for = bplus_tree<Key, Value,
+        bplus_fanout<Key, Value, TargetBytes, Counted>::order,
+        bplus_fanout<Key, Value, TargetBytes, Counted>::leaf_size, Counted, Search>;
 }
@@ -0,0 +1,507 @@
+/* cow_btree.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <array>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+namespace osdb
+{
+    /*
+    A B+ tree whose nodes are immutable once published. Each add copies the
+    path from the root to the affected leaf and shares every other subtree
+    with the previous version, then atomically publishes the new root.
+
+    snapshot() returns a consistent, read-only view which is unaffected by
+    later writes. Readers take no lock: the root is published through an
+    atomic pointer, and a reader counts itself in while it copies the
+    version, so that a writer frees a superseded version only once no
+    reader can be copying it. Nodes are reference-counted, so a version's
+    nodes are reclaimed once the last snapshot referring to it is
+    released. Writers are serialised by the tree.
+
+    As nodes are shared between versions, leaves hold no sibling links and
+    range iteration instead keeps the path to the current leaf.
+    */
+    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+    class cow_bplus_tree
+    {
+        static_assert(Order % 2 == 0, "Order must be a factor of two");
+        static_assert(LeafSize >= 2, "LeafSize must be at least two");
+
+    public:
+        using key_type = Key;
+        using value_type = Value;
+
+        class iterator;
+        class iterable;
+        class view;
+
+    private:
+        using item_type = std::pair<Key, Value>;
+
+        struct node
+        {
+            const bool isLeaf;
+            size_t count{};
+
+            explicit node(bool isLeaf) noexcept
+                : isLeaf(isLeaf) { }
+        };
+
+        struct leaf : node
+        {
+            std::array<item_type, LeafSize> items{};
+
+            leaf() : node(true) { }
+        };
+
+        struct inner : node
+        {
+            // Separator keys[i] is the first key of children[i + 1] when split
+            std::array<Key, Order> keys{};
+            std::array<std::shared_ptr<const node>, Order + 1> children{};
+
+            inner() : node(false) { }
+        };
+
+        struct version
+        {
+            std::shared_ptr<const node> root;
+            size_t size;
+            size_t height;
+        };
+
+        struct insert_result
+        {
+            std::shared_ptr<const node> left;
+            std::shared_ptr<const node> right;
+            Key separator;
+        };
+
+        using version_ptr = std::shared_ptr<const version>;
+
+        std::mutex writeLock{};
+        std::atomic<version_ptr*> current{
+            new version_ptr(std::make_shared<version>(version{nullptr, 0, 0}))};
+
+        // Readers copying the current version, and versions superseded
+        // while there were any
+        mutable std::atomic<size_t> readers{};
+        std::vector<std::unique_ptr<version_ptr>> retired{};
+
+    public:
+        cow_bplus_tree() = default;
+        cow_bplus_tree(const cow_bplus_tree&) = delete;
+        cow_bplus_tree& operator =(const cow_bplus_tree&) = delete;
+
+        ~cow_bplus_tree() {
+            delete current.load();
+        }
+
+        size_t size() const noexcept {
+            return acquire()->size;
+        }
+
+        size_t height() const noexcept {
+            return acquire()->height;
+        }
+
+        constexpr size_t order() const noexcept {
+            return Order;
+        }
+
+        constexpr size_t leaf_size() const noexcept {
+            return LeafSize;
+        }
+
+        void add(Key key, Value value) &
+        {
+            std::lock_guard<std::mutex> lock(writeLock);
+            const version* ver = current.load()->get();
+
+            auto res = insert(ver->root.get(), std::move(key), std::move(value));
+            auto next = std::make_shared<version>(version{
+                std::move(res.left), ver->size + 1, ver->height});
+
+            // Grow a new root above a split one
+            if (res.right != nullptr)
+            {
+                auto root = std::make_shared<inner>();
+                root->keys[0] = std::move(res.separator);
+                root->children[0] = std::move(next->root);
+                root->children[1] = std::move(res.right);
+                root->count = 2;
+
+                next->root = std::move(root);
+                next->height++;
+            }
+            publish(std::move(next));
+        }
+
+        /*
+        Gets an immutable view of the tree as of now.
+        */
+        view snapshot() const {
+            return view(acquire());
+        }
+
+    private:
+        version_ptr acquire() const noexcept
+        {
+            readers.fetch_add(1);
+            version_ptr output = *current.load();
+            readers.fetch_sub(1);
+            return output;
+        }
+
+        /*
+        Replaces the current version. A reader counted in may still be
+        copying the old one, which is then kept until a later write finds
+        no reader counted in.
+        */
+        void publish(version_ptr next)
+        {
+            retired.emplace_back(current.exchange(new version_ptr(std::move(next))));
+            if (readers.load() == 0) retired.clear();
+        }
+
+        static size_t child_index(const inner& node, const Key& key, bool upper) noexcept
+        {
+            size_t i = 0;
+            for (; i + 1 < node.count; i++) {
+                if (upper ? key < node.keys[i] : !(node.keys[i] < key)) break;
+            }
+            return i;
+        }
+
+        static size_t leaf_index(const leaf& node, const Key& key, bool upper) noexcept
+        {
+            auto end = std::begin(node.items) + node.count;
+            auto iter = upper
+                ? std::upper_bound(std::begin(node.items), end, key,
+                    [](const Key& k, const item_type& item) { return k < item.first; })
+                : std::lower_bound(std::begin(node.items), end, key,
+                    [](const item_type& item, const Key& k) { return item.first < k; });
+            return static_cast<size_t>(iter - std::begin(node.items));
+        }
+
+        static insert_result insert(const node* current, Key key, Value value)
+        {
+            if (current == nullptr)
+            {
+                auto output = std::make_shared<leaf>();
+                output->items[0] = item_type(std::move(key), std::move(value));
+                output->count = 1;
+                return insert_result{std::move(output), nullptr, Key{}};
+            }
+            if (current->isLeaf) {
+                return insert_leaf(static_cast<const leaf&>(*current),
+                    std::move(key), std::move(value));
+            }
+
+            auto& old = static_cast<const inner&>(*current);
+            size_t index = child_index(old, key, true);
+            auto res = insert(old.children[index].get(), std::move(key), std::move(value));
+
+            if (res.right == nullptr)
+            {
+                auto output = std::make_shared<inner>(old);
+                output->children[index] = std::move(res.left);
+                return insert_result{std::move(output), nullptr, Key{}};
+            }
+            if (old.count != Order + 1)
+            {
+                auto output = std::make_shared<inner>(old);
+                for (size_t i = old.count; i > index + 1; i--) {
+                    output->children[i] = std::move(output->children[i-1]);
+                }
+                for (size_t i = old.count - 1; i > index; i--) {
+                    output->keys[i] = std::move(output->keys[i-1]);
+                }
+                output->children[index] = std::move(res.left);
+                output->children[index + 1] = std::move(res.right);
+                output->keys[index] = std::move(res.separator);
+                output->count++;
+                return insert_result{std::move(output), nullptr, Key{}};
+            }
+
+            // Split the Order + 2 children, pushing the middle separator up
+            auto child = [&](size_t i) -> const std::shared_ptr<const node>& {
+                if (i < index) return old.children[i];
+                if (i == index) return res.left;
+                if (i == index + 1) return res.right;
+                return old.children[i - 1];
+            };
+            auto separator = [&](size_t i) -> const Key& {
+                if (i < index) return old.keys[i];
+                if (i == index) return res.separator;
+                return old.keys[i - 1];
+            };
+
+            constexpr size_t mid = Order / 2;
+            auto left = std::make_shared<inner>();
+            auto right = std::make_shared<inner>();
+
+            for (size_t i = 0; i <= mid; i++) {
+                left->children[i] = child(i);
+            }
+            for (size_t i = 0; i < mid; i++) {
+                left->keys[i] = separator(i);
+            }
+            for (size_t i = mid + 1; i < Order + 2; i++) {
+                right->children[i - mid - 1] = child(i);
+            }
+            for (size_t i = mid + 1; i < Order + 1; i++) {
+                right->keys[i - mid - 1] = separator(i);
+            }
+            left->count = mid + 1;
+            right->count = Order + 1 - mid;
+
+            return insert_result{std::move(left), std::move(right), separator(mid)};
+        }
+
+        static insert_result insert_leaf(const leaf& old, Key key, Value value)
+        {
+            size_t index = leaf_index(old, key, true);
+
+            if (old.count != LeafSize)
+            {
+                auto output = std::make_shared<leaf>(old);
+                for (size_t i = old.count; i > index; i--) {
+                    output->items[i] = std::move(output->items[i-1]);
+                }
+                output->items[index] = item_type(std::move(key), std::move(value));
+                output->count++;
+                return insert_result{std::move(output), nullptr, Key{}};
+            }
+
+            // Split the LeafSize + 1 items between two new leaves
+            auto left = std::make_shared<leaf>();
+            auto right = std::make_shared<leaf>();
+            constexpr size_t half = (LeafSize + 1) / 2;
+
+            item_type added(std::move(key), std::move(value));
+            for (size_t i = 0; i < LeafSize + 1; i++)
+            {
+                const item_type& item = i < index ? old.items[i]
+                    : (i == index ? added : old.items[i - 1]);
+
+                if (i < half) left->items[i] = item;
+                else right->items[i - half] = item;
+            }
+            left->count = half;
+            right->count = LeafSize + 1 - half;
+
+            Key separator = right->items[0].first;
+            return insert_result{std::move(left), std::move(right), std::move(separator)};
+        }
+
+    public:
+        /*
+        Input iterator over the items of a single version. Holds the path
+        from the root to the current leaf in place of sibling links.
+        */
+        class iterator
+        {
+            friend iterable;
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = item_type;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+
+        private:
+            std::vector<std::pair<const inner*, size_t>> path{};
+            const leaf* current{};
+            size_t index{};
+
+            // Key of the last item in range, if any
+            const Key* bound{};
+            bool inclusive{};
+
+            iterator(const node* root, const Key* start, bool upper,
+                const Key* bound, bool inclusive)
+                : bound(bound), inclusive(inclusive)
+            {
+                if (root == nullptr) return;
+
+                // Descend to the first item not before start
+                while (!root->isLeaf)
+                {
+                    auto& parent = static_cast<const inner&>(*root);
+                    size_t i = start != nullptr ? child_index(parent, *start, upper) : 0;
+                    path.emplace_back(&parent, i);
+                    root = parent.children[i].get();
+                }
+                current = static_cast<const leaf*>(root);
+                index = start != nullptr ? leaf_index(*current, *start, upper) : 0;
+
+                if (index == current->count) next_leaf();
+                check_bound();
+            }
+
+            void next_leaf() noexcept
+            {
+                // Climb to the nearest ancestor with a following child
+                while (!path.empty() && path.back().second + 1 == path.back().first->count) {
+                    path.pop_back();
+                }
+                if (path.empty())
+                {
+                    current = nullptr;
+                    index = 0;
+                    return;
+                }
+                const node* child = path.back().first->children[++path.back().second].get();
+                while (!child->isLeaf)
+                {
+                    auto& parent = static_cast<const inner&>(*child);
+                    path.emplace_back(&parent, 0);
+                    child = parent.children[0].get();
+                }
+                current = static_cast<const leaf*>(child);
+                index = 0;
+            }
+
+            void check_bound() noexcept
+            {
+                if (current == nullptr || bound == nullptr) return;
+
+                const Key& key = current->items[index].first;
+                if (inclusive ? *bound < key : !(key < *bound))
+                {
+                    current = nullptr;
+                    index = 0;
+                }
+            }
+
+        public:
+            iterator() = default;
+
+            reference operator *() const noexcept {
+                return current->items[index];
+            }
+            pointer operator ->() const noexcept {
+                return &current->items[index];
+            }
+
+            bool operator ==(const iterator& other) const noexcept {
+                return current == other.current && index == other.index;
+            }
+            bool operator !=(const iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            iterator& operator ++() noexcept
+            {
+                if (++index == current->count) next_leaf();
+                check_bound();
+                return *this;
+            }
+        };
+
+        /*
+        A range of items within a single version, keeping it alive
+        for as long as the range is held.
+        */
+        class iterable
+        {
+            friend view;
+
+            std::shared_ptr<const version> ver;
+            Key startKey{};
+            Key endKey{};
+            bool hasStart{};
+            bool hasEnd{};
+            bool inclusiveStart{};
+            bool inclusiveEnd{};
+
+            iterable(std::shared_ptr<const version> ver)
+                : ver(std::move(ver)) { }
+
+        public:
+            iterator begin() const
+            {
+                return iterator(ver->root.get(), hasStart ? &startKey : nullptr,
+                    !inclusiveStart, hasEnd ? &endKey : nullptr, inclusiveEnd);
+            }
+            iterator end() const noexcept {
+                return iterator();
+            }
+        };
+
+        /*
+        An immutable view of the tree at the time it was taken.
+        */
+        class view
+        {
+            friend cow_bplus_tree;
+
+            std::shared_ptr<const version> ver;
+
+            explicit view(std::shared_ptr<const version> ver)
+                : ver(std::move(ver)) { }
+
+        public:
+            size_t size() const noexcept {
+                return ver->size;
+            }
+
+            size_t height() const noexcept {
+                return ver->height;
+            }
+
+            const value_type* find(const key_type& key) const
+            {
+                auto range = search_range(key, key);
+                auto iter = range.begin();
+                return iter != range.end() ? &iter->second : nullptr;
+            }
+
+            iterable search_range(range_start = range_start{}, range_end = range_end{},
+                bool = true, bool = true) const &
+            {
+                return iterable(ver);
+            }
+
+            iterable search_range(const key_type& start, range_end = range_end{},
+                bool inclusiveStart = true, bool = true) const &
+            {
+                iterable output(ver);
+                output.startKey = start;
+                output.hasStart = true;
+                output.inclusiveStart = inclusiveStart;
+                return output;
+            }
+
+            iterable search_range(range_start, const key_type& end, bool = true,
+                bool inclusiveEnd = true) const &
+            {
+                iterable output(ver);
+                output.endKey = end;
+                output.hasEnd = true;
+                output.inclusiveEnd = inclusiveEnd;
+                return output;
+            }
+
+            iterable search_range(const key_type& start, const key_type& end,
+                bool inclusiveStart = true, bool inclusiveEnd = true) const &
+            {
+                iterable output(ver);
+                output.startKey = start;
+                output.endKey = end;
+                output.hasStart = output.hasEnd = true;
+                output.inclusiveStart = inclusiveStart;
+                output.inclusiveEnd = inclusiveEnd;
+                return output;
+            }
+        };
+    };
+}
@@ -1,9 +1,18 @@
 /* ct_database.hpp - (c) 2018 James Renwick */
 #include <stddef.h>
+#include <stdint.h>
 #include <tuple>
 #include <array>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <utility>
 #include <iostream>
 #include <string>
+#include <functional>
+#include <type_traits>
+#include "filter_kernels.hpp"
+#include "hash_join.hpp"
 
 template<char ...cs>
 struct ct_string 
@@ -48,13 +57,15 @@ struct FieldDefinition
     inline static constexpr const size_t width = Width;
 };
 
-template<typename FieldDef, size_t Index>
+template<typename FieldDef, size_t Index, size_t Column = 0>
 struct Field
 {
     using value_type = typename FieldDef::value_type;
     using name_t = typename FieldDef::name;
 
+    // Position of the table within the query, and of the field within the table
     inline static constexpr const size_t index = Index;
+    inline static constexpr const size_t column = Column;
     inline static constexpr const size_t width = FieldDef::width;
 
 private:
@@ -64,8 +75,22 @@ public:
     const std::string& name() const noexcept {
         return _name;
     }
+
+    // Tests whether the field lies within [low, high]
+    template<typename T>
+    auto between(const T& low, const T& high) const;
+
+    // Tests whether the field equals any of the given values
+    template<typename ...Ts>
+    auto in(const Ts& ...values) const;
 };
 
+template<typename T>
+struct is_field : std::false_type { };
+
+template<typename FieldDef, size_t Index, size_t Column>
+struct is_field<Field<FieldDef, Index, Column>> : std::true_type { };
+
 template<typename Name, typename Field, typename ...Fields>
 struct field_for
 {
@@ -84,86 +109,936 @@ struct Table
 {
     using field_types = std::tuple<Fields...>;
     using proxy_types = std::tuple<Field<Fields, 0>...>;
+    using column_types = std::tuple<std::vector<typename Fields::value_type>...>;
+
+    // Values of each field, stored column by column
+    column_types columns{};
+
+    void insert(typename Fields::value_type ...values)
+    {
+        insert(std::index_sequence_for<Fields...>(), std::move(values)...);
+    }
+
+    size_t size() const noexcept {
+        return std::get<0>(columns).size();
+    }
+
+    template<typename Name>
+    auto operator[](const Name&) const
+    {
+        return field<0, Name>(std::index_sequence_for<Fields...>());
+    }
+
+    // Gets the field with the given name, as read from the table at position Index of a query
+    template<size_t Index, typename Name, size_t ...Columns>
+    static auto field(std::index_sequence<Columns...>)
+    {
+        return field_for<Name, Field<Fields, Index, Columns>...>::get();
+    }
 
+private:
+    template<size_t ...Columns>
+    void insert(std::index_sequence<Columns...>, typename Fields::value_type ...values)
+    {
+        (std::get<Columns>(columns).push_back(std::move(values)), ...);
+    }
+};
+
+// Stands in for the table at position Index of a query
+template<typename Table, size_t Index>
+struct table_ref
+{
     template<typename Name>
-    auto operator[](const Name&)
+    auto operator[](const Name&) const
     {
-        return field_for<Name, Field<Fields, 0>...>::get();
+        return Table::template field<Index, Name>(
+            std::make_index_sequence<std::tuple_size_v<typename Table::field_types>>());
     }
 };
 
 
 enum class Op
 {
-    Eq
+    Eq, Ne, Lt, Le, Gt, Ge, Between, In,
+    And, Or, Not
 };
 
 template<typename Lhs, Op op, typename Rhs>
 struct FieldOperation
 {
-    const Lhs& lhs;
-    const Rhs& rhs;
+    Lhs lhs;
+    Rhs rhs;
 
     inline static constexpr const Op oper = op;
 
-    FieldOperation(const Lhs& lhs, const Rhs& rhs)
-        : lhs(lhs), rhs(rhs) { }
+    FieldOperation(Lhs lhs, Rhs rhs)
+        : lhs(std::move(lhs)), rhs(std::move(rhs)) { }
+};
+
+// The type of value an operand yields, be it a field or a constant
+template<typename T>
+struct operand_value
+{
+    using type = T;
+};
+
+template<typename FieldDef, size_t Index, size_t Column>
+struct operand_value<Field<FieldDef, Index, Column>>
+{
+    using type = typename FieldDef::value_type;
+};
+
+template<typename Lhs, typename Rhs>
+inline constexpr const bool is_equality_comparable = std::is_same_v<
+    decltype(std::declval<Lhs>() == std::declval<Rhs>()), bool>;
+
+// Orderings are evaluated with the operator they name, so all four are needed
+template<typename Lhs, typename Rhs>
+inline constexpr const bool is_order_comparable =
+    std::is_same_v<decltype(std::declval<Lhs>() < std::declval<Rhs>()), bool> &&
+    std::is_same_v<decltype(std::declval<Lhs>() <= std::declval<Rhs>()), bool> &&
+    std::is_same_v<decltype(std::declval<Lhs>() > std::declval<Rhs>()), bool> &&
+    std::is_same_v<decltype(std::declval<Lhs>() >= std::declval<Rhs>()), bool>;
+
+template<typename T>
+struct value_range
+{
+    T low;
+    T high;
 };
 
-template<typename FieldDef, size_t Index, typename T>
-auto operator ==(const Field<FieldDef, Index>&, const T& value) noexcept
+template<Op op, typename Field, typename T>
+auto compare(const Field& field, const T& value)
 {
     // Validate operation
-    using Field = Field<FieldDef, Index>;
-    static_assert(std::is_same_v<decltype(std::declval<typename Field::value_type>() == value), bool>,"");
+    using Rhs = std::decay_t<const T&>;
+    using value_type = typename Field::value_type;
+    using rhs_value_type = typename operand_value<Rhs>::type;
+    if constexpr (op == Op::Eq || op == Op::Ne) {
+        static_assert(is_equality_comparable<value_type, rhs_value_type>, "Values cannot be compared");
+    }
+    else {
+        static_assert(is_order_comparable<value_type, rhs_value_type>, "Values cannot be ordered");
+    }
+    return FieldOperation<Field, op, Rhs>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator ==(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Eq>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator !=(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Ne>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator <(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Lt>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator <=(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Le>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator >(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Gt>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename T>
+auto operator >=(const Field<FieldDef, Index, Column>& field, const T& value) {
+    return compare<Op::Ge>(field, value);
+}
+
+template<typename FieldDef, size_t Index, size_t Column>
+template<typename T>
+auto Field<FieldDef, Index, Column>::between(const T& low, const T& high) const
+{
+    using Rhs = std::decay_t<const T&>;
+    static_assert(is_order_comparable<value_type, Rhs> &&
+        is_order_comparable<Rhs, value_type>, "Values cannot be ordered");
 
-    return FieldOperation<Field, Op::Eq, decltype(value)>(Field{}, value);
+    return FieldOperation<Field, Op::Between, value_range<Rhs>>(*this, value_range<Rhs>{ low, high });
+}
+
+template<typename FieldDef, size_t Index, size_t Column>
+template<typename ...Ts>
+auto Field<FieldDef, Index, Column>::in(const Ts& ...values) const
+{
+    static_assert(sizeof...(Ts) != 0, "IN requires at least one value");
+    using Rhs = std::array<std::common_type_t<std::decay_t<const Ts&>...>, sizeof...(Ts)>;
+    static_assert(is_equality_comparable<value_type, typename Rhs::value_type>, "Values cannot be compared");
+
+    return FieldOperation<Field, Op::In, Rhs>(*this, Rhs{ values... });
+}
+
+// Predicates combine only with other predicates
+template<typename L1, Op op1, typename R1, typename L2, Op op2, typename R2>
+auto operator &&(const FieldOperation<L1, op1, R1>& lhs, const FieldOperation<L2, op2, R2>& rhs)
+{
+    return FieldOperation<FieldOperation<L1, op1, R1>, Op::And,
+        FieldOperation<L2, op2, R2>>(lhs, rhs);
+}
+
+template<typename L1, Op op1, typename R1, typename L2, Op op2, typename R2>
+auto operator ||(const FieldOperation<L1, op1, R1>& lhs, const FieldOperation<L2, op2, R2>& rhs)
+{
+    return FieldOperation<FieldOperation<L1, op1, R1>, Op::Or,
+        FieldOperation<L2, op2, R2>>(lhs, rhs);
+}
+
+template<typename Lhs, Op op, typename Rhs>
+auto operator !(const FieldOperation<Lhs, op, Rhs>& operand)
+{
+    return FieldOperation<FieldOperation<Lhs, op, Rhs>, Op::Not, std::nullptr_t>(operand, nullptr);
 }
 
 using PersonTable = Table<
     FieldDefinition<OSDB_STR("Name"), std::string>,
     FieldDefinition<OSDB_STR("age"), int, 2>>;
 
-using instr_type = int;
 
+/*
+Splits a predicate into the terms of its top-level conjunction, which the
+planner may apply separately and in any order.
+*/
 template<typename Operation>
-constexpr auto optimise() noexcept
+struct conjuncts
+{
+    using types = std::tuple<Operation>;
+
+    static auto get(const Operation& operation) noexcept {
+        return std::tuple<const Operation&>(operation);
+    }
+};
+
+template<typename Lhs, typename Rhs>
+struct conjuncts<FieldOperation<Lhs, Op::And, Rhs>>
+{
+    using types = decltype(std::tuple_cat(std::declval<typename conjuncts<Lhs>::types>(),
+        std::declval<typename conjuncts<Rhs>::types>()));
+
+    static auto get(const FieldOperation<Lhs, Op::And, Rhs>& operation) noexcept
+    {
+        return std::tuple_cat(conjuncts<Lhs>::get(operation.lhs),
+            conjuncts<Rhs>::get(operation.rhs));
+    }
+};
+
+// The set of tables, as a bitmask of query positions, an expression reads
+template<typename T>
+struct tables_of
+{
+    inline static constexpr const uint64_t value = 0;
+};
+
+template<typename FieldDef, size_t Index, size_t Column>
+struct tables_of<Field<FieldDef, Index, Column>>
+{
+    static_assert(Index < 64, "Too many tables in query");
+    inline static constexpr const uint64_t value = uint64_t(1) << Index;
+};
+
+template<typename Lhs, Op op, typename Rhs>
+struct tables_of<FieldOperation<Lhs, op, Rhs>>
 {
-    std::array<instr_type, 20> output{};
+    inline static constexpr const uint64_t value = tables_of<Lhs>::value | tables_of<Rhs>::value;
+};
+
+/*
+Estimates the fraction of rows a term passes. Without statistics on the
+stored values, this uses the fixed factors of System R.
+*/
+template<typename Term>
+constexpr double selectivity() noexcept
+{
+    using lhs_type = decltype(Term::lhs);
+    using rhs_type = decltype(Term::rhs);
+    constexpr Op op = Term::oper;
+
+    if constexpr (op == Op::And) {
+        return selectivity<lhs_type>() * selectivity<rhs_type>();
+    }
+    else if constexpr (op == Op::Or)
+    {
+        double lhs = selectivity<lhs_type>(), rhs = selectivity<rhs_type>();
+        return lhs + rhs - lhs * rhs;
+    }
+    else if constexpr (op == Op::Not) {
+        return 1 - selectivity<lhs_type>();
+    }
+    else if constexpr (op == Op::In) {
+        return std::min(0.5, std::tuple_size_v<rhs_type> * 0.1);
+    }
+    else
+    {
+        switch (op)
+        {
+            case Op::Eq: return 0.1;
+            case Op::Ne: return 0.9;
+            case Op::Between: return 0.25;
+            default: return 1.0 / 3;
+        }
+    }
+}
+
+struct term_info
+{
+    uint64_t tables;
+    double selectivity;
+
+    // Whether the term equates fields of the same hashable type from two different tables
+    bool equiJoin;
+    size_t left;
+    size_t right;
+};
+
+// Whether std::hash is enabled for a type, as a hash join needs
+template<typename T>
+inline constexpr const bool is_hashable = std::is_default_constructible_v<std::hash<T>> &&
+    std::is_invocable_r_v<size_t, const std::hash<T>&, const T&>;
+
+template<typename Term>
+constexpr term_info describe_term() noexcept
+{
+    term_info output{ tables_of<Term>::value, selectivity<Term>(), false, 0, 0 };
+    if constexpr (is_field<decltype(Term::lhs)>::value && is_field<decltype(Term::rhs)>::value)
+    {
+        constexpr size_t left = decltype(Term::lhs)::index;
+        constexpr size_t right = decltype(Term::rhs)::index;
+        using lhs_type = typename decltype(Term::lhs)::value_type;
+        constexpr bool hashable = std::is_same_v<lhs_type, typename decltype(Term::rhs)::value_type> &&
+            is_hashable<lhs_type>;
+        if (Term::oper == Op::Eq && left != right && hashable) {
+            output = term_info{ output.tables, output.selectivity, true, left, right };
+        }
+    }
+    return output;
+}
+
+template<typename ...Terms>
+constexpr auto describe_terms(std::tuple<Terms...>*) noexcept
+{
+    return std::array<term_info, sizeof...(Terms)>{ describe_term<Terms>()... };
+}
+
+
+enum class Opcode
+{
+    // Lists every row of a table as a candidate
+    Scan,
+    // Drops candidates of a table failing a term over that table alone
+    Filter,
+    // Pairs every bound row with every candidate of a table
+    Product,
+    // Pairs bound rows with the candidates of a table satisfying a term, by nested loops
+    Join,
+    // Pairs bound rows with the candidates of a table equal under an equi-join term, by hashing
+    HashJoin,
+    // Drops bound rows failing a term over several tables
+    Residual,
+    // Emits the bound rows as the result
+    Project
+};
+
+struct instr_type
+{
+    Opcode code;
+    size_t table;
+    size_t term;
+};
+
+template<size_t Capacity>
+struct plan_builder
+{
+    std::array<instr_type, Capacity> steps{};
+    size_t size{};
+
+    constexpr void emit(Opcode code, size_t table, size_t term) noexcept {
+        steps[size++] = instr_type{ code, table, term };
+    }
+};
+
+/*
+Plans a query over NTables tables at compile-time. Each term of the
+predicate which reads a single table is pushed down to filter that table's
+candidates before any join. The tables are then joined left-deep, taking
+next a table with an equi-join term to those already joined, which is hash
+joined, or else a table with another term linking it to them, which is
+joined by nested loops. Each remaining term is applied as soon as its
+tables are joined. Where several terms apply at once, the most selective
+runs first.
+*/
+template<size_t NTables, typename Operation>
+constexpr auto draft_plan() noexcept
+{
+    using term_types = typename conjuncts<Operation>::types;
+    constexpr size_t terms = std::tuple_size_v<term_types>;
+    constexpr auto info = describe_terms(static_cast<term_types*>(nullptr));
+
+    plan_builder<2 * NTables + terms + 1> output{};
+    std::array<bool, terms> used{};
+
+    // Gets the most selective unused term reading only the given tables
+    auto next_term = [&](uint64_t tables, bool exact)
+    {
+        size_t best = terms;
+        for (size_t i = 0; i < terms; i++)
+        {
+            if (used[i] || (info[i].tables & ~tables) != 0) continue;
+            if (exact && info[i].tables != tables) continue;
+            if (best == terms || info[i].selectivity < info[best].selectivity) best = i;
+        }
+        return best;
+    };
+
+    for (size_t table = 0; table < NTables; table++)
+    {
+        output.emit(Opcode::Scan, table, 0);
+        for (size_t i = next_term(uint64_t(1) << table, true); i != terms;
+            i = next_term(uint64_t(1) << table, true))
+        {
+            output.emit(Opcode::Filter, table, i);
+            used[i] = true;
+        }
+    }
 
-    for (int i = 0; i < 20; i++) {
-        output[i] = i * 4;
+    uint64_t bound = 0;
+    for (size_t n = 0; n < NTables; n++)
+    {
+        size_t table = NTables;
+        size_t term = terms;
+        for (size_t i = 0; i < terms && table == NTables; i++)
+        {
+            if (used[i] || !info[i].equiJoin) continue;
+
+            bool left = (bound >> info[i].left) & 1;
+            bool right = (bound >> info[i].right) & 1;
+            if (left != right) {
+                table = left ? info[i].right : info[i].left;
+                term = i;
+            }
+        }
+
+        if (term != terms)
+        {
+            output.emit(Opcode::HashJoin, table, term);
+            used[term] = true;
+        }
+        else if (bound != 0)
+        {
+            // Otherwise prefer a term linking the joined tables to just one other
+            for (size_t i = 0; i < terms; i++)
+            {
+                uint64_t unbound = info[i].tables & ~bound;
+                if (used[i] || (info[i].tables & bound) == 0 || unbound == 0 ||
+                    (unbound & (unbound - 1)) != 0) continue;
+                if (term == terms || info[i].selectivity < info[term].selectivity) term = i;
+            }
+            if (term != terms)
+            {
+                table = 0;
+                while (((info[term].tables & ~bound) >> table) != 1) table++;
+                output.emit(Opcode::Join, table, term);
+                used[term] = true;
+            }
+        }
+
+        if (term == terms)
+        {
+            table = 0;
+            while ((bound >> table) & 1) table++;
+            output.emit(Opcode::Product, table, 0);
+        }
+        bound |= uint64_t(1) << table;
+
+        for (size_t i = next_term(bound, false); i != terms; i = next_term(bound, false))
+        {
+            output.emit(Opcode::Residual, 0, i);
+            used[i] = true;
+        }
     }
+    output.emit(Opcode::Project, 0, 0);
+    return output;
+}
+
+template<size_t NTables, typename Operation>
+constexpr auto optimise() noexcept
+{
+    constexpr auto draft = draft_plan<NTables, Operation>();
 
+    std::array<instr_type, draft.size> output{};
+    for (size_t i = 0; i < draft.size; i++) {
+        output[i] = draft.steps[i];
+    }
     return output;
 }
 
-template<size_t NSteps, typename Operation>
-void execute(const std::array<instr_type, NSteps>& plan, const Operation& op)
+// The plan of a query, computed once per query type when it is compiled
+template<size_t NTables, typename Operation>
+struct query_plan
+{
+    inline static constexpr const auto steps = optimise<NTables, Operation>();
+};
+
+
+// Number of rows each operator processes at a time
+inline constexpr const size_t batch_size = 1024;
+
+template<size_t NTables>
+using row_type = std::array<size_t, NTables>;
+
+// Positions within a batch
+using selection_type = std::array<uint32_t, batch_size>;
+
+template<size_t NTables>
+struct execution_state
+{
+    // Rows of each table that passed its filters
+    std::array<std::vector<size_t>, NTables> candidates{};
+
+    // Combinations of rows of the tables joined so far
+    std::vector<row_type<NTables>> rows{};
+    bool bound = false;
+
+    std::vector<row_type<NTables>> output{};
+};
+
+// A batch of consecutive rows from each of the tables of a query
+template<typename Tables>
+struct table_batch
+{
+    inline static constexpr const bool contiguous = true;
+
+    const Tables& tables;
+    size_t first;
+
+    template<typename FieldDef, size_t Index, size_t Column>
+    const auto* data(const Field<FieldDef, Index, Column>&) const noexcept
+    {
+        return std::get<Column>(std::get<Index>(tables).columns).data() + first;
+    }
+
+    template<typename FieldDef, size_t Index, size_t Column>
+    auto column(const Field<FieldDef, Index, Column>& field) const noexcept
+    {
+        const auto* values = data(field);
+        return [values](size_t i) -> const auto& { return values[i]; };
+    }
+};
+
+// A batch of combinations of rows, as produced by joins
+template<typename Tables, size_t NTables>
+struct row_batch
+{
+    inline static constexpr const bool contiguous = false;
+
+    const Tables& tables;
+    const row_type<NTables>* rows;
+
+    template<typename FieldDef, size_t Index, size_t Column>
+    auto column(const Field<FieldDef, Index, Column>&) const noexcept
+    {
+        const auto* values = std::get<Column>(std::get<Index>(tables).columns).data();
+        const auto* rows = this->rows;
+        return [values, rows](size_t i) -> const auto& { return values[rows[i][Index]]; };
+    }
+};
+
+// Gets the values of an operand at each position of a batch
+template<typename T, typename Batch>
+auto values_of(const T& value, const Batch&) noexcept
+{
+    return [&value](size_t) -> const T& { return value; };
+}
+
+template<typename FieldDef, size_t Index, size_t Column, typename Batch>
+auto values_of(const Field<FieldDef, Index, Column>& field, const Batch& batch) noexcept
+{
+    return batch.column(field);
+}
+
+template<Op op, typename Lhs, typename Rhs>
+bool matches(const Lhs& lhs, const Rhs& rhs)
+{
+    if constexpr (op == Op::Eq) return lhs == rhs;
+    else if constexpr (op == Op::Ne) return !(lhs == rhs);
+    else if constexpr (op == Op::Lt) return lhs < rhs;
+    else if constexpr (op == Op::Le) return lhs <= rhs;
+    else if constexpr (op == Op::Gt) return lhs > rhs;
+    else if constexpr (op == Op::Ge) return lhs >= rhs;
+    else if constexpr (op == Op::Between) return rhs.low <= lhs && lhs <= rhs.high;
+    else if constexpr (op == Op::In)
+    {
+        bool output = false;
+        for (auto& value : rhs) output |= lhs == value;
+        return output;
+    }
+}
+
+// Gets the filter kernel predicate for a comparison, if there is one
+constexpr bool kernel_op(Op op, osdb::filter_op& output) noexcept
+{
+    switch (op)
+    {
+        case Op::Eq: output = osdb::filter_op::eq; return true;
+        case Op::Ne: output = osdb::filter_op::ne; return true;
+        case Op::Lt: output = osdb::filter_op::lt; return true;
+        case Op::Le: output = osdb::filter_op::le; return true;
+        case Op::Gt: output = osdb::filter_op::gt; return true;
+        case Op::Ge: output = osdb::filter_op::ge; return true;
+        case Op::Between: output = osdb::filter_op::between; return true;
+        default: return false;
+    }
+}
+
+/*
+Whether a comparison of a field with a constant over a batch can be
+handed to the SIMD filter kernels, which need contiguous values of a
+fixed-width type they support.
+*/
+template<typename Lhs, Op op, typename Rhs, typename Batch>
+constexpr bool use_filter_kernel() noexcept
+{
+    if constexpr (is_field<Lhs>::value && !is_field<Rhs>::value && Batch::contiguous)
+    {
+        using value_type = typename Lhs::value_type;
+        using constant_type = std::conditional_t<op == Op::Between, value_range<value_type>, value_type>;
+        osdb::filter_op kernel{};
+        return kernel_op(op, kernel) && osdb::has_simd_filter<value_type>::value &&
+            std::is_same_v<Rhs, constant_type>;
+    }
+    return false;
+}
+
+/*
+Writes the positions listed in selection, or [0, count) when selection is
+null, which are not among the sorted positions in excluded.
+*/
+inline size_t exclude(const uint32_t* selection, size_t count, const uint32_t* excluded,
+    size_t excludedCount, uint32_t* output) noexcept
+{
+    size_t selected = 0;
+    for (size_t k = 0, j = 0; k < count; k++)
+    {
+        uint32_t i = selection != nullptr ? selection[k] : uint32_t(k);
+        if (j != excludedCount && excluded[j] == i) j++;
+        else output[selected++] = i;
+    }
+    return selected;
+}
+
+/*
+Selects the positions of a batch at which a term holds, from the count
+positions listed in selection, or from [0, count) when selection is null.
+Writes them to output in order, which may be the selection itself, and
+returns how many there are. Comparisons select without branching, so
+that the loops over contiguous columns can be vectorised.
+*/
+template<typename Lhs, Op op, typename Rhs, typename Batch>
+size_t select(const FieldOperation<Lhs, op, Rhs>& term, const Batch& batch,
+    const uint32_t* selection, size_t count, uint32_t* output)
 {
-    for (size_t i = 0; i < NSteps; i++) {
-        std::cout << plan[i] << "\n";
+    if constexpr (op == Op::And)
+    {
+        count = select(term.lhs, batch, selection, count, output);
+        return select(term.rhs, batch, output, count, output);
+    }
+    else if constexpr (op == Op::Or)
+    {
+        // Test the right side only where the left fails
+        selection_type matched, rest;
+        size_t matchedCount = select(term.lhs, batch, selection, count, matched.data());
+        size_t restCount = exclude(selection, count, matched.data(), matchedCount, rest.data());
+        restCount = select(term.rhs, batch, rest.data(), restCount, rest.data());
+
+        return static_cast<size_t>(std::merge(matched.data(), matched.data() + matchedCount,
+            rest.data(), rest.data() + restCount, output) - output);
+    }
+    else if constexpr (op == Op::Not)
+    {
+        selection_type matched;
+        size_t matchedCount = select(term.lhs, batch, selection, count, matched.data());
+        return exclude(selection, count, matched.data(), matchedCount, output);
+    }
+    else
+    {
+        if constexpr (use_filter_kernel<Lhs, op, Rhs, Batch>())
+        {
+            // Dense batches of fixed-width values are filtered with SIMD
+            if (selection == nullptr)
+            {
+                osdb::filter_op kernel{};
+                kernel_op(op, kernel);
+                if constexpr (op == Op::Between) {
+                    return osdb::filter_select(kernel, batch.data(term.lhs), count,
+                        term.rhs.low, term.rhs.high, output);
+                }
+                else {
+                    return osdb::filter_select(kernel, batch.data(term.lhs), count,
+                        term.rhs, output);
+                }
+            }
+        }
+
+        auto lhs = values_of(term.lhs, batch);
+        auto rhs = values_of(term.rhs, batch);
+
+        size_t selected = 0;
+        if (selection == nullptr)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                output[selected] = static_cast<uint32_t>(i);
+                selected += matches<op>(lhs(i), rhs(i));
+            }
+        }
+        else
+        {
+            for (size_t k = 0; k < count; k++)
+            {
+                uint32_t i = selection[k];
+                output[selected] = i;
+                selected += matches<op>(lhs(i), rhs(i));
+            }
+        }
+        return selected;
     }
 }
 
-template<typename ...Tables, typename Func>
-void query(Func&& func)
+// Counts the Filter steps immediately following a step
+template<typename Plan, size_t Step>
+constexpr size_t filters_after() noexcept
+{
+    size_t count = 0;
+    while (Step + 1 + count < Plan::steps.size() &&
+        Plan::steps[Step + 1 + count].code == Opcode::Filter) count++;
+    return count;
+}
+
+template<typename Plan, size_t First, typename Terms, typename Batch, size_t ...Filters>
+size_t select_filters(const Terms& terms, const Batch& batch, size_t count,
+    uint32_t* selection, std::index_sequence<Filters...>)
+{
+    const uint32_t* input = nullptr;
+    ((count = select(std::get<Plan::steps[First + Filters].term>(terms), batch,
+        input, count, selection), input = selection), ...);
+    return count;
+}
+
+template<typename Plan, size_t Step, size_t NTables, typename Terms, typename Tables>
+void execute_step(execution_state<NTables>& state, const Terms& terms, const Tables& tables)
+{
+    constexpr instr_type instr = Plan::steps[Step];
+
+    if constexpr (instr.code == Opcode::Scan)
+    {
+        // The filters following a scan are applied to each batch as it is read
+        constexpr size_t filters = filters_after<Plan, Step>();
+
+        auto& candidates = state.candidates[instr.table];
+        size_t size = std::get<instr.table>(tables).size();
+        selection_type selection;
+        for (size_t first = 0; first < size; first += batch_size)
+        {
+            size_t count = std::min(batch_size, size - first);
+            if constexpr (filters == 0)
+            {
+                for (size_t i = 0; i < count; i++) {
+                    candidates.push_back(first + i);
+                }
+            }
+            else
+            {
+                count = select_filters<Plan, Step + 1>(terms, table_batch<Tables>{ tables, first },
+                    count, selection.data(), std::make_index_sequence<filters>());
+                for (size_t k = 0; k < count; k++) {
+                    candidates.push_back(first + selection[k]);
+                }
+            }
+        }
+    }
+    else if constexpr (instr.code == Opcode::Product)
+    {
+        if (!state.bound) state.rows.emplace_back();
+        state.bound = true;
+
+        std::vector<row_type<NTables>> rows{};
+        for (auto row : state.rows)
+        {
+            for (size_t candidate : state.candidates[instr.table])
+            {
+                row[instr.table] = candidate;
+                rows.push_back(row);
+            }
+        }
+        state.rows = std::move(rows);
+    }
+    else if constexpr (instr.code == Opcode::Join)
+    {
+        // Pair each bound row with a batch of candidates at a time
+        const auto& candidates = state.candidates[instr.table];
+        std::vector<row_type<NTables>> rows{};
+        std::vector<row_type<NTables>> batch(batch_size);
+        selection_type selection;
+
+        for (auto& row : state.rows)
+        {
+            for (size_t first = 0; first < candidates.size(); first += batch_size)
+            {
+                size_t count = std::min(batch_size, candidates.size() - first);
+                for (size_t i = 0; i < count; i++)
+                {
+                    batch[i] = row;
+                    batch[i][instr.table] = candidates[first + i];
+                }
+
+                count = select(std::get<instr.term>(terms), row_batch<Tables, NTables>{
+                    tables, batch.data() }, nullptr, count, selection.data());
+                for (size_t k = 0; k < count; k++) {
+                    rows.push_back(batch[selection[k]]);
+                }
+            }
+        }
+        state.rows = std::move(rows);
+    }
+    else if constexpr (instr.code == Opcode::HashJoin)
+    {
+        // Build a hash table over the candidates and probe it with the bound rows
+        const auto& term = std::get<instr.term>(terms);
+        const auto& candidates = state.candidates[instr.table];
+        std::vector<row_type<NTables>> rows{};
+
+        auto run = [&](const auto& buildField, const auto& probeField)
+        {
+            using B = std::decay_t<decltype(buildField)>;
+            using P = std::decay_t<decltype(probeField)>;
+            const auto& buildColumn = std::get<B::column>(std::get<B::index>(tables).columns);
+            const auto& probeColumn = std::get<P::column>(std::get<P::index>(tables).columns);
+
+            std::vector<uint64_t> buildHashes(candidates.size());
+            for (size_t i = 0; i < candidates.size(); i++) {
+                buildHashes[i] = osdb::join_hash(buildColumn[candidates[i]]);
+            }
+            std::vector<uint64_t> probeHashes(state.rows.size());
+            for (size_t i = 0; i < state.rows.size(); i++) {
+                probeHashes[i] = osdb::join_hash(probeColumn[state.rows[i][P::index]]);
+            }
+
+            // Hashes may collide, so the keys of each match are compared
+            osdb::hash_join(buildHashes.data(), buildHashes.size(), probeHashes.data(),
+                probeHashes.size(), [&](size_t probe, size_t build)
+            {
+                size_t candidate = candidates[build];
+                if (buildColumn[candidate] == probeColumn[state.rows[probe][P::index]])
+                {
+                    rows.push_back(state.rows[probe]);
+                    rows.back()[instr.table] = candidate;
+                }
+            });
+        };
+
+        if constexpr (std::decay_t<decltype(term.lhs)>::index == instr.table) {
+            run(term.lhs, term.rhs);
+        }
+        else run(term.rhs, term.lhs);
+        state.rows = std::move(rows);
+    }
+    else if constexpr (instr.code == Opcode::Residual)
+    {
+        auto& rows = state.rows;
+        selection_type selection;
+        size_t kept = 0;
+        for (size_t first = 0; first < rows.size(); first += batch_size)
+        {
+            size_t count = std::min(batch_size, rows.size() - first);
+            count = select(std::get<instr.term>(terms), row_batch<Tables, NTables>{
+                tables, rows.data() + first }, nullptr, count, selection.data());
+            for (size_t k = 0; k < count; k++) {
+                rows[kept++] = rows[first + selection[k]];
+            }
+        }
+        rows.resize(kept);
+    }
+    else if constexpr (instr.code == Opcode::Project) {
+        state.output = std::move(state.rows);
+    }
+    // Filter steps are applied by the scan preceding them
+}
+
+template<typename Plan, size_t NTables, typename Terms, typename Tables, size_t ...Steps>
+void execute(execution_state<NTables>& state, const Terms& terms, const Tables& tables,
+    std::index_sequence<Steps...>)
+{
+    (execute_step<Plan, Steps>(state, terms, tables), ...);
+}
+
+/*
+Runs a planned query against the given tables, returning for each result
+the row of each table it combines.
+*/
+template<typename Plan, typename Operation, typename ...Tables>
+auto execute(const Operation& op, const Tables& ...tables)
+{
+    execution_state<sizeof...(Tables)> state{};
+    execute<Plan>(state, conjuncts<Operation>::get(op), std::forward_as_tuple(tables...),
+        std::make_index_sequence<Plan::steps.size()>());
+    return std::move(state.output);
+}
+
+template<typename Func, size_t ...Indices, typename ...Tables>
+auto run_query(Func&& func, std::index_sequence<Indices...>, const Tables& ...tables)
 {
     // Get the AST for the operations
-    using operation = decltype(std::forward<Func>(func)(Tables{}...));
+    auto operation = std::forward<Func>(func)(table_ref<Tables, Indices>{}...);
 
     // Construct plan for query at compile-time
-    constexpr auto plan = optimise<operation>();
+    using plan = query_plan<sizeof...(Tables), decltype(operation)>;
 
     // Execute plan at run-time
-    return execute(plan, std::forward<Func>(func)(Tables{}...));
+    return execute<plan>(operation, tables...);
+}
+
+template<typename Func, typename ...Tables>
+auto query(Func&& func, const Tables& ...tables)
+{
+    return run_query(std::forward<Func>(func), std::index_sequence_for<Tables...>(), tables...);
 }
 
+// Define CT_DATABASE_NO_MAIN to use the database without this example
+#ifndef CT_DATABASE_NO_MAIN
 int main()
 {
-    auto result = query<PersonTable, PersonTable>([](auto p1, auto p2) {
+    PersonTable people{};
+    people.insert("Alice", 30);
+    people.insert("Bob", 25);
+    people.insert("Carol", 30);
+    people.insert("Dave", 41);
+
+    auto result = query([](auto p1, auto p2) {
         return p1["age"_nm] == p2["age"_nm];
-    });
+    }, people, people);
     //.groupByAsc([](auto p1, auto p2) { return p1["age"_nm]; })
     //.project([](auto p1, auto p2) { return p1["age"_nm]; });
+
+    const auto& names = std::get<0>(people.columns);
+    for (auto& row : result) {
+        std::cout << names[row[0]] << " " << names[row[1]] << "\n";
+    }
+
+    for (auto& row : query([](auto p) { return p["age"_nm] == 30; }, people)) {
+        std::cout << names[row[0]] << "\n";
+    }
+
+    auto older = query([](auto p1, auto p2) {
+        return p1["age"_nm] < p2["age"_nm] && p2["age"_nm].between(25, 40) &&
+            !(p1["Name"_nm].in("Alice", "Dave") || p2["Name"_nm] == "Bob");
+    }, people, people);
+    for (auto& row : older) {
+        std::cout << names[row[0]] << " < " << names[row[1]] << "\n";
+    }
 }
+#endif
@@ -1,4 +1,5 @@
 /* except.hpp - (c) James Renwick */
+#pragma once
 #include <utility>
 #include <string>
 
@@ -0,0 +1,636 @@
+/* filter_kernels.hpp - (c) 2018 James Renwick */
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OSDB_X86_KERNELS 1
+#else
+#define OSDB_X86_KERNELS 0
+#endif
+
+namespace osdb
+{
+    /*
+    Predicates tested by the filter kernels, with the meaning of the C++
+    operators: unordered floating-point values satisfy ne alone.
+    */
+    enum class filter_op
+    {
+        eq, ne, lt, le, gt, ge,
+        // Value within [low, high]
+        between
+    };
+
+    enum class simd_level
+    {
+        scalar, avx2, avx512
+    };
+
+    /*
+    Gets the widest instruction set the kernels may use on this processor.
+    */
+    inline simd_level detect_simd_level() noexcept
+    {
+#if OSDB_X86_KERNELS
+        static const simd_level level =
+            __builtin_cpu_supports("avx512f") ? simd_level::avx512 :
+            __builtin_cpu_supports("avx2") ? simd_level::avx2 : simd_level::scalar;
+        return level;
+#else
+        return simd_level::scalar;
+#endif
+    }
+
+    /*
+    Whether the vector kernels handle values of type T. Other arithmetic
+    types are filtered by the scalar kernels.
+    */
+    template<typename T>
+    struct has_simd_filter : std::integral_constant<bool,
+        std::is_same<T, int32_t>::value || std::is_same<T, int64_t>::value ||
+        std::is_same<T, float>::value || std::is_same<T, double>::value> { };
+
+
+    namespace detail
+    {
+        template<filter_op Op, typename T>
+        inline bool filter_test(T value, T low, T high) noexcept
+        {
+            switch (Op)
+            {
+                case filter_op::eq: return value == low;
+                case filter_op::ne: return !(value == low);
+                case filter_op::lt: return value < low;
+                case filter_op::le: return value <= low;
+                case filter_op::gt: return low < value;
+                case filter_op::ge: return value >= low;
+                case filter_op::between: return low <= value && value <= high;
+            }
+            return false;
+        }
+
+        template<filter_op Op, typename T>
+        size_t select_scalar(const T* values, size_t count, T low, T high,
+            uint32_t* output) noexcept
+        {
+            // Always write, and advance only on a match, to avoid branching
+            size_t selected = 0;
+            for (size_t i = 0; i < count; i++)
+            {
+                output[selected] = static_cast<uint32_t>(i);
+                selected += filter_test<Op>(values[i], low, high);
+            }
+            return selected;
+        }
+
+        template<filter_op Op, typename T>
+        size_t mask_scalar(const T* values, size_t count, T low, T high,
+            uint64_t* mask) noexcept
+        {
+            size_t selected = 0;
+            for (size_t first = 0; first < count; first += 64)
+            {
+                uint64_t word = 0;
+                size_t last = count - first < 64 ? count - first : 64;
+                for (size_t i = 0; i < last; i++) {
+                    word |= uint64_t(filter_test<Op>(values[first + i], low, high)) << i;
+                }
+                mask[first / 64] = word;
+                selected += static_cast<size_t>(__builtin_popcountll(word));
+            }
+            return selected;
+        }
+
+#if OSDB_X86_KERNELS
+        // Positions of the set bits of each byte, for compressing AVX2 selections
+        inline const uint32_t* set_bit_positions() noexcept
+        {
+            static const std::array<uint32_t, 256 * 8> table = []()
+            {
+                std::array<uint32_t, 256 * 8> output{};
+                for (uint32_t mask = 0; mask < 256; mask++)
+                {
+                    uint32_t count = 0;
+                    for (uint32_t bit = 0; bit < 8; bit++) {
+                        if (mask & (1u << bit)) output[mask * 8 + count++] = bit;
+                    }
+                }
+                return output;
+            }();
+            return table.data();
+        }
+#endif
+    }
+}
+
+#if OSDB_X86_KERNELS
+
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace osdb
+{
+    namespace detail
+    {
+        /*
+        Eight values at a time, giving a bit per value. Floating-point
+        comparisons are ordered, so that unordered values fail every
+        predicate but ne, as in filter_test.
+        */
+        template<typename T>
+        struct avx2_lanes;
+
+        template<>
+        struct avx2_lanes<int32_t>
+        {
+            static constexpr const size_t lanes = 8;
+            using vector = __m256i;
+
+            static vector load(const int32_t* values) noexcept {
+                return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+            }
+            static vector broadcast(int32_t value) noexcept {
+                return _mm256_set1_epi32(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, b))));
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(b, a))));
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return ~static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(a, b))));
+            }
+        };
+
+        template<>
+        struct avx2_lanes<int64_t>
+        {
+            static constexpr const size_t lanes = 4;
+            using vector = __m256i;
+
+            static vector load(const int64_t* values) noexcept {
+                return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values));
+            }
+            static vector broadcast(int64_t value) noexcept {
+                return _mm256_set1_epi64x(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(a, b))));
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(b, a))));
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return ~static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(a, b))));
+            }
+        };
+
+        template<>
+        struct avx2_lanes<float>
+        {
+            static constexpr const size_t lanes = 8;
+            using vector = __m256;
+
+            static vector load(const float* values) noexcept {
+                return _mm256_loadu_ps(values);
+            }
+            static vector broadcast(float value) noexcept {
+                return _mm256_set1_ps(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_EQ_OQ)));
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ)));
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(a, b, _CMP_LE_OQ)));
+            }
+        };
+
+        template<>
+        struct avx2_lanes<double>
+        {
+            static constexpr const size_t lanes = 4;
+            using vector = __m256d;
+
+            static vector load(const double* values) noexcept {
+                return _mm256_loadu_pd(values);
+            }
+            static vector broadcast(double value) noexcept {
+                return _mm256_set1_pd(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_EQ_OQ)));
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ)));
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return static_cast<unsigned>(_mm256_movemask_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ)));
+            }
+        };
+
+        // Tests eight values, loaded as one or two vectors
+        template<filter_op Op, typename T>
+        unsigned avx2_test(const T* values, typename avx2_lanes<T>::vector low,
+            typename avx2_lanes<T>::vector high) noexcept
+        {
+            using lanes = avx2_lanes<T>;
+
+            unsigned output = 0;
+            for (size_t i = 0; i < 8; i += lanes::lanes)
+            {
+                auto value = lanes::load(values + i);
+                unsigned mask;
+                switch (Op)
+                {
+                    case filter_op::eq: mask = lanes::eq(value, low); break;
+                    case filter_op::ne: mask = ~lanes::eq(value, low); break;
+                    case filter_op::lt: mask = lanes::lt(value, low); break;
+                    case filter_op::le: mask = lanes::le(value, low); break;
+                    case filter_op::gt: mask = lanes::lt(low, value); break;
+                    case filter_op::ge: mask = lanes::le(low, value); break;
+                    default: mask = lanes::le(low, value) & lanes::le(value, high); break;
+                }
+                output |= (mask & ((1u << lanes::lanes) - 1)) << i;
+            }
+            return output;
+        }
+
+        template<filter_op Op, typename T>
+        size_t select_avx2(const T* values, size_t count, T low, T high,
+            uint32_t* output) noexcept
+        {
+            using lanes = avx2_lanes<T>;
+            auto lowVector = lanes::broadcast(low);
+            auto highVector = lanes::broadcast(high);
+            const uint32_t* positions = set_bit_positions();
+
+            // Each step writes eight positions but keeps only those selected
+            size_t selected = 0, i = 0;
+            for (; i + 8 <= count; i += 8)
+            {
+                unsigned mask = avx2_test<Op>(values + i, lowVector, highVector);
+                __m256i offsets = _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(positions + mask * 8));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + selected),
+                    _mm256_add_epi32(offsets, _mm256_set1_epi32(static_cast<int>(i))));
+                selected += static_cast<size_t>(__builtin_popcount(mask));
+            }
+            for (; i < count; i++)
+            {
+                output[selected] = static_cast<uint32_t>(i);
+                selected += filter_test<Op>(values[i], low, high);
+            }
+            return selected;
+        }
+
+        template<filter_op Op, typename T>
+        size_t mask_avx2(const T* values, size_t count, T low, T high,
+            uint64_t* mask) noexcept
+        {
+            using lanes = avx2_lanes<T>;
+            auto lowVector = lanes::broadcast(low);
+            auto highVector = lanes::broadcast(high);
+
+            size_t selected = 0, first = 0;
+            for (; first + 64 <= count; first += 64)
+            {
+                uint64_t word = 0;
+                for (size_t i = 0; i < 64; i += 8) {
+                    word |= uint64_t(avx2_test<Op>(values + first + i, lowVector, highVector)) << i;
+                }
+                mask[first / 64] = word;
+                selected += static_cast<size_t>(__builtin_popcountll(word));
+            }
+            return selected + mask_scalar<Op>(values + first, count - first, low, high,
+                mask + first / 64);
+        }
+    }
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push(__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+namespace osdb
+{
+    namespace detail
+    {
+        // Sixteen values at a time, the comparisons yielding masks directly
+        template<typename T>
+        struct avx512_lanes;
+
+        template<>
+        struct avx512_lanes<int32_t>
+        {
+            static constexpr const size_t lanes = 16;
+            using vector = __m512i;
+
+            static vector load(const int32_t* values) noexcept {
+                return _mm512_loadu_si512(values);
+            }
+            static vector broadcast(int32_t value) noexcept {
+                return _mm512_set1_epi32(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return _mm512_cmpeq_epi32_mask(a, b);
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return _mm512_cmplt_epi32_mask(a, b);
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return _mm512_cmple_epi32_mask(a, b);
+            }
+        };
+
+        template<>
+        struct avx512_lanes<int64_t>
+        {
+            static constexpr const size_t lanes = 8;
+            using vector = __m512i;
+
+            static vector load(const int64_t* values) noexcept {
+                return _mm512_loadu_si512(values);
+            }
+            static vector broadcast(int64_t value) noexcept {
+                return _mm512_set1_epi64(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return _mm512_cmpeq_epi64_mask(a, b);
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return _mm512_cmplt_epi64_mask(a, b);
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return _mm512_cmple_epi64_mask(a, b);
+            }
+        };
+
+        template<>
+        struct avx512_lanes<float>
+        {
+            static constexpr const size_t lanes = 16;
+            using vector = __m512;
+
+            static vector load(const float* values) noexcept {
+                return _mm512_loadu_ps(values);
+            }
+            static vector broadcast(float value) noexcept {
+                return _mm512_set1_ps(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return _mm512_cmp_ps_mask(a, b, _CMP_EQ_OQ);
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ);
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ);
+            }
+        };
+
+        template<>
+        struct avx512_lanes<double>
+        {
+            static constexpr const size_t lanes = 8;
+            using vector = __m512d;
+
+            static vector load(const double* values) noexcept {
+                return _mm512_loadu_pd(values);
+            }
+            static vector broadcast(double value) noexcept {
+                return _mm512_set1_pd(value);
+            }
+            static unsigned eq(vector a, vector b) noexcept {
+                return _mm512_cmp_pd_mask(a, b, _CMP_EQ_OQ);
+            }
+            static unsigned lt(vector a, vector b) noexcept {
+                return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ);
+            }
+            static unsigned le(vector a, vector b) noexcept {
+                return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ);
+            }
+        };
+
+        // Tests sixteen values, loaded as one or two vectors
+        template<filter_op Op, typename T>
+        unsigned avx512_test(const T* values, typename avx512_lanes<T>::vector low,
+            typename avx512_lanes<T>::vector high) noexcept
+        {
+            using lanes = avx512_lanes<T>;
+
+            unsigned output = 0;
+            for (size_t i = 0; i < 16; i += lanes::lanes)
+            {
+                auto value = lanes::load(values + i);
+                unsigned mask;
+                switch (Op)
+                {
+                    case filter_op::eq: mask = lanes::eq(value, low); break;
+                    case filter_op::ne: mask = ~lanes::eq(value, low); break;
+                    case filter_op::lt: mask = lanes::lt(value, low); break;
+                    case filter_op::le: mask = lanes::le(value, low); break;
+                    case filter_op::gt: mask = lanes::lt(low, value); break;
+                    case filter_op::ge: mask = lanes::le(low, value); break;
+                    default: mask = lanes::le(low, value) & lanes::le(value, high); break;
+                }
+                output |= (mask & ((1u << lanes::lanes) - 1)) << i;
+            }
+            return output;
+        }
+
+        template<filter_op Op, typename T>
+        size_t select_avx512(const T* values, size_t count, T low, T high,
+            uint32_t* output) noexcept
+        {
+            using lanes = avx512_lanes<T>;
+            auto lowVector = lanes::broadcast(low);
+            auto highVector = lanes::broadcast(high);
+            const __m512i offsets = _mm512_setr_epi32(
+                0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+
+            size_t selected = 0, i = 0;
+            for (; i + 16 <= count; i += 16)
+            {
+                unsigned mask = avx512_test<Op>(values + i, lowVector, highVector);
+                _mm512_mask_compressstoreu_epi32(output + selected, static_cast<__mmask16>(mask),
+                    _mm512_add_epi32(offsets, _mm512_set1_epi32(static_cast<int>(i))));
+                selected += static_cast<size_t>(__builtin_popcount(mask));
+            }
+            for (; i < count; i++)
+            {
+                output[selected] = static_cast<uint32_t>(i);
+                selected += filter_test<Op>(values[i], low, high);
+            }
+            return selected;
+        }
+
+        template<filter_op Op, typename T>
+        size_t mask_avx512(const T* values, size_t count, T low, T high,
+            uint64_t* mask) noexcept
+        {
+            using lanes = avx512_lanes<T>;
+            auto lowVector = lanes::broadcast(low);
+            auto highVector = lanes::broadcast(high);
+
+            size_t selected = 0, first = 0;
+            for (; first + 64 <= count; first += 64)
+            {
+                uint64_t word = 0;
+                for (size_t i = 0; i < 64; i += 16) {
+                    word |= uint64_t(avx512_test<Op>(values + first + i, lowVector, highVector)) << i;
+                }
+                mask[first / 64] = word;
+                selected += static_cast<size_t>(__builtin_popcountll(word));
+            }
+            return selected + mask_scalar<Op>(values + first, count - first, low, high,
+                mask + first / 64);
+        }
+    }
+}
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif
+
+namespace osdb
+{
+    namespace detail
+    {
+        template<filter_op Op, typename T>
+        size_t filter_select(const T* values, size_t count, T low, T high,
+            uint32_t* output, simd_level, std::false_type) noexcept
+        {
+            return select_scalar<Op>(values, count, low, high, output);
+        }
+
+        template<filter_op Op, typename T>
+        size_t filter_select(const T* values, size_t count, T low, T high,
+            uint32_t* output, simd_level level, std::true_type) noexcept
+        {
+#if OSDB_X86_KERNELS
+            switch (level)
+            {
+                case simd_level::avx512: return select_avx512<Op>(values, count, low, high, output);
+                case simd_level::avx2: return select_avx2<Op>(values, count, low, high, output);
+                default: break;
+            }
+#endif
+            return select_scalar<Op>(values, count, low, high, output);
+        }
+
+        template<filter_op Op, typename T>
+        size_t filter_mask(const T* values, size_t count, T low, T high,
+            uint64_t* mask, simd_level, std::false_type) noexcept
+        {
+            return mask_scalar<Op>(values, count, low, high, mask);
+        }
+
+        template<filter_op Op, typename T>
+        size_t filter_mask(const T* values, size_t count, T low, T high,
+            uint64_t* mask, simd_level level, std::true_type) noexcept
+        {
+#if OSDB_X86_KERNELS
+            switch (level)
+            {
+                case simd_level::avx512: return mask_avx512<Op>(values, count, low, high, mask);
+                case simd_level::avx2: return mask_avx2<Op>(values, count, low, high, mask);
+                default: break;
+            }
+#endif
+            return mask_scalar<Op>(values, count, low, high, mask);
+        }
+
+        template<typename T>
+        struct type_identity
+        {
+            using type = T;
+        };
+
+        template<typename Func>
+        auto dispatch_filter(filter_op op, Func&& func)
+        {
+            switch (op)
+            {
+                case filter_op::eq: return func(std::integral_constant<filter_op, filter_op::eq>());
+                case filter_op::ne: return func(std::integral_constant<filter_op, filter_op::ne>());
+                case filter_op::lt: return func(std::integral_constant<filter_op, filter_op::lt>());
+                case filter_op::le: return func(std::integral_constant<filter_op, filter_op::le>());
+                case filter_op::gt: return func(std::integral_constant<filter_op, filter_op::gt>());
+                case filter_op::ge: return func(std::integral_constant<filter_op, filter_op::ge>());
+                default: return func(std::integral_constant<filter_op, filter_op::between>());
+            }
+        }
+    }
+
+    /*
+    Writes the positions of the values satisfying a predicate to output, in
+    order, returning how many there are. The value is compared against low,
+    or tested against [low, high] for between. Output must have room for
+    count positions. Values of types without vector kernels, or a level of
+    scalar, are tested one at a time, though without branching.
+    */
+    template<typename T>
+    size_t filter_select(filter_op op, const T* values, size_t count,
+        typename detail::type_identity<T>::type low, typename detail::type_identity<T>::type high,
+        uint32_t* output, simd_level level = detect_simd_level()) noexcept
+    {
+        static_assert(std::is_arithmetic<T>::value, "Filter kernels require arithmetic values");
+        return detail::dispatch_filter(op, [&](auto kind) {
+            return detail::filter_select<decltype(kind)::value, T>(values, count, low, high,
+                output, level, has_simd_filter<T>());
+        });
+    }
+
+    template<typename T>
+    size_t filter_select(filter_op op, const T* values, size_t count,
+        typename detail::type_identity<T>::type constant, uint32_t* output, simd_level level = detect_simd_level()) noexcept
+    {
+        return filter_select<T>(op, values, count, constant, constant, output, level);
+    }
+
+    /*
+    Sets bit i % 64 of word i / 64 of mask where value i satisfies a
+    predicate, as filter_select selects it, and clears the others. Mask
+    must have room for (count + 63) / 64 words. Returns the number of bits
+    set.
+    */
+    template<typename T>
+    size_t filter_mask(filter_op op, const T* values, size_t count,
+        typename detail::type_identity<T>::type low, typename detail::type_identity<T>::type high,
+        uint64_t* mask, simd_level level = detect_simd_level()) noexcept
+    {
+        static_assert(std::is_arithmetic<T>::value, "Filter kernels require arithmetic values");
+        return detail::dispatch_filter(op, [&](auto kind) {
+            return detail::filter_mask<decltype(kind)::value, T>(values, count, low, high,
+                mask, level, has_simd_filter<T>());
+        });
+    }
+
+    template<typename T>
+    size_t filter_mask(filter_op op, const T* values, size_t count,
+        typename detail::type_identity<T>::type constant, uint64_t* mask, simd_level level = detect_simd_level()) noexcept
+    {
+        return filter_mask<T>(op, values, count, constant, constant, mask, level);
+    }
+}
@@ -0,0 +1,318 @@
+/* frozen_index.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include "pages.hpp"
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+namespace osdb
+{
+    template<typename Key, typename Value>
+    class frozen_iterator
+    {
+        const Key* key;
+        const Value* value;
+
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<const Key&, const Value&>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        frozen_iterator(const Key* key, const Value* value) noexcept
+            : key(key), value(value) { }
+
+        value_type operator *() const noexcept {
+            return value_type(*key, *value);
+        }
+
+        bool operator ==(const frozen_iterator& other) const noexcept {
+            return key == other.key;
+        }
+        bool operator !=(const frozen_iterator& other) const noexcept {
+            return key != other.key;
+        }
+
+        frozen_iterator& operator ++() noexcept
+        {
+            ++key;
+            ++value;
+            return *this;
+        }
+    };
+
+    /*
+    An immutable index of sorted key-value pairs, usually built by
+    bplus_tree::freeze(). Keys and values are held in contiguous arrays,
+    divided into blocks of a few cache lines each. The last key of each
+    block is stored in Eytzinger (breadth-first) order, so that a lookup
+    descends an implicit tree without following pointers, prefetching the
+    cache line holding its descendants four levels down, and then searches
+    a single block.
+
+    The whole index occupies one buffer, exposed by data() and bytes(),
+    which may be written to a file as-is. load() opens such a buffer in
+    place without copying or parsing it, so a file can be mmapped straight
+    back in. The buffer is in native byte order. It also serves as the
+    snapshot format of bplus_tree; see load_snapshot.
+    */
+    template<typename Key, typename Value>
+    class frozen_index
+    {
+        static_assert(std::is_trivially_copyable<Key>::value, "Key must be trivially copyable");
+        static_assert(std::is_trivially_copyable<Value>::value, "Value must be trivially copyable");
+        static_assert(alignof(Key) <= cache_line_size && alignof(Value) <= cache_line_size, "");
+
+    public:
+        using key_type = Key;
+        using value_type = Value;
+
+        // Number of keys in each block searched after the implicit tree
+        static constexpr const size_t block_size =
+            sizeof(Key) >= cache_line_size ? 2 : 2 * cache_line_size / sizeof(Key);
+
+    private:
+        static constexpr const uint64_t magic = 0x4E5A4F5242444F53ull;
+
+        struct header
+        {
+            uint64_t magic;
+            uint32_t keySize;
+            uint32_t valueSize;
+            uint64_t count;
+            uint64_t blockSize;
+            uint64_t bytes;
+        };
+
+        std::unique_ptr<uint8_t[]> storage{};
+        const uint8_t* _data{};
+        size_t _bytes{};
+
+        size_t count{};
+        size_t blocks{};
+
+        // Eytzinger-ordered block keys and block numbers, from index 1
+        const Key* separators{};
+        const uint64_t* ranks{};
+
+        const Key* _keys{};
+        const Value* _values{};
+
+        static size_t align(size_t offset) noexcept {
+            return (offset + cache_line_size - 1) / cache_line_size * cache_line_size;
+        }
+
+        static size_t block_count(size_t count) noexcept {
+            return (count + block_size - 1) / block_size;
+        }
+
+        // Gets the offsets of each section of a buffer holding count items
+        static void layout(size_t count, size_t& separatorStart, size_t& rankStart,
+            size_t& keyStart, size_t& valueStart, size_t& bytes) noexcept
+        {
+            size_t blocks = block_count(count);
+            separatorStart = align(sizeof(header));
+            rankStart = align(separatorStart + (blocks + 1) * sizeof(Key));
+            keyStart = align(rankStart + (blocks + 1) * sizeof(uint64_t));
+            valueStart = align(keyStart + count * sizeof(Key));
+            bytes = align(valueStart + count * sizeof(Value));
+        }
+
+        void attach(const uint8_t* data, size_t bytes, size_t items) noexcept
+        {
+            size_t separatorStart, rankStart, keyStart, valueStart, total;
+            layout(items, separatorStart, rankStart, keyStart, valueStart, total);
+
+            _data = data;
+            _bytes = bytes;
+            count = items;
+            blocks = block_count(items);
+            separators = reinterpret_cast<const Key*>(data + separatorStart);
+            ranks = reinterpret_cast<const uint64_t*>(data + rankStart);
+            _keys = reinterpret_cast<const Key*>(data + keyStart);
+            _values = reinterpret_cast<const Value*>(data + valueStart);
+        }
+
+        // Fills the subtree at node with blocks in order, from block next
+        size_t fill(Key* tree, uint64_t* blockRanks, const Key* keys,
+            size_t node, size_t next) const noexcept
+        {
+            if (node > blocks) return next;
+
+            next = fill(tree, blockRanks, keys, node * 2, next);
+            tree[node] = keys[std::min(count, (next + 1) * block_size) - 1];
+            blockRanks[node] = next;
+            return fill(tree, blockRanks, keys, node * 2 + 1, next + 1);
+        }
+
+        /*
+        Gets the index of the first item not less than key, or the first
+        item greater than key when Upper is true.
+        */
+        template<bool Upper>
+        size_t bound(const Key& key) const noexcept
+        {
+            size_t i = 1;
+            while (i <= blocks)
+            {
+                // The descendants four levels down are the 16 from 16i
+                __builtin_prefetch(separators + std::min(i * 16, blocks));
+                bool right = Upper ? !(key < separators[i]) : separators[i] < key;
+                i = 2 * i + (right ? 1 : 0);
+            }
+            // Undo the right turns made after the final left turn
+            i >>= __builtin_ffsll(static_cast<long long>(~i));
+            if (i == 0) return count;
+
+            size_t first = static_cast<size_t>(ranks[i]) * block_size;
+            size_t last = std::min(count, first + block_size);
+            auto iter = Upper ?
+                std::upper_bound(_keys + first, _keys + last, key) :
+                std::lower_bound(_keys + first, _keys + last, key);
+            return static_cast<size_t>(iter - _keys);
+        }
+
+    public:
+        frozen_index() noexcept = default;
+
+        frozen_index(frozen_index&&) noexcept = default;
+        frozen_index& operator =(frozen_index&&) noexcept = default;
+
+        /*
+        Builds an index from a range of key-value pairs in key order.
+        */
+        template<typename Iterable>
+        static frozen_index build(Iterable&& range)
+        {
+            std::vector<Key> keys{};
+            std::vector<Value> values{};
+            for (auto&& pair : range)
+            {
+                keys.push_back(pair.first);
+                values.push_back(pair.second);
+            }
+
+            size_t separatorStart, rankStart, keyStart, valueStart, bytes;
+            layout(keys.size(), separatorStart, rankStart, keyStart, valueStart, bytes);
+
+            // Over-allocate so the buffer can begin on a cache line
+            frozen_index output{};
+            output.storage.reset(new uint8_t[bytes + cache_line_size]());
+            uint8_t* data = output.storage.get();
+            data += (cache_line_size - reinterpret_cast<uintptr_t>(data) % cache_line_size)
+                % cache_line_size;
+
+            write_value(data, header{ magic, sizeof(Key), sizeof(Value),
+                keys.size(), block_size, bytes });
+            if (!keys.empty())
+            {
+                std::memcpy(data + keyStart, keys.data(), keys.size() * sizeof(Key));
+                std::memcpy(data + valueStart, values.data(), values.size() * sizeof(Value));
+            }
+            output.attach(data, bytes, keys.size());
+            output.fill(reinterpret_cast<Key*>(data + separatorStart),
+                reinterpret_cast<uint64_t*>(data + rankStart), keys.data(), 1, 0);
+            return output;
+        }
+
+        /*
+        Opens an index held in a buffer previously written from data().
+        The buffer is used in place and must outlive the index.
+        */
+        static expected<frozen_index, error> load(const uint8_t* data, size_t size)
+        {
+            constexpr size_t alignment = std::max(alignof(header),
+                std::max(alignof(Key), alignof(Value)));
+
+            if (size < sizeof(header) || reinterpret_cast<uintptr_t>(data) % alignment != 0) {
+                return unexpected<error>(error::Some);
+            }
+            auto info = read_value<header>(data);
+            if (info.magic != magic || info.keySize != sizeof(Key) ||
+                info.valueSize != sizeof(Value) || info.blockSize != block_size) {
+                return unexpected<error>(error::Some);
+            }
+
+            size_t separatorStart, rankStart, keyStart, valueStart, bytes;
+            layout(static_cast<size_t>(info.count), separatorStart, rankStart,
+                keyStart, valueStart, bytes);
+            if (info.bytes != bytes || bytes > size) {
+                return unexpected<error>(error::Some);
+            }
+
+            frozen_index output{};
+            output.attach(data, bytes, static_cast<size_t>(info.count));
+            return output;
+        }
+
+        size_t size() const noexcept {
+            return count;
+        }
+
+        /*
+        Gets the buffer holding the index, and its size in bytes.
+        */
+        const uint8_t* data() const noexcept {
+            return _data;
+        }
+        size_t bytes() const noexcept {
+            return _bytes;
+        }
+
+        leaf_span<const Key> keys() const noexcept {
+            return leaf_span<const Key>(_keys, _keys + count);
+        }
+        leaf_span<const Value> values() const noexcept {
+            return leaf_span<const Value>(_values, _values + count);
+        }
+
+        /*
+        Gets the items in key order as pairs of references.
+        */
+        frozen_iterator<Key, Value> begin() const noexcept {
+            return frozen_iterator<Key, Value>(_keys, _values);
+        }
+        frozen_iterator<Key, Value> end() const noexcept {
+            return frozen_iterator<Key, Value>(_keys + count, _values + count);
+        }
+
+        size_t lower_bound(const Key& key) const noexcept {
+            return bound<false>(key);
+        }
+        size_t upper_bound(const Key& key) const noexcept {
+            return bound<true>(key);
+        }
+
+        /*
+        Gets the value of the first item with the given key, or nullptr.
+        */
+        const Value* find(const Key& key) const noexcept
+        {
+            size_t i = lower_bound(key);
+            return i != count && _keys[i] == key ? &_values[i] : nullptr;
+        }
+    };
+
+    /*
+    Replaces the contents of a tree with a snapshot previously written
+    from the data() of its frozen_index. The tree is rebuilt bottom-up in
+    one sequential pass over the snapshot, so that loading costs about as
+    much as reading it.
+    */
+    template<typename Key, typename Value, size_t Order, size_t LeafSize,
+        bool Counted, typename Search>
+    error load_snapshot(bplus_tree<Key, Value, Order, LeafSize, Counted, Search>& tree,
+        const uint8_t* data, size_t size)
+    {
+        auto index = frozen_index<Key, Value>::load(data, size);
+        if (!index) return index.error();
+
+        tree.assign_sorted(index.value());
+        return error::None;
+    }
+}
@@ -0,0 +1,526 @@
+/* hash_index.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "pages.hpp"
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+
+namespace osdb
+{
+    // Largest directory is 2^max_hash_depth entries
+    constexpr const size_t max_hash_depth = 32;
+
+    /*
+    A page-backed extendible hash index mapping keys to record locations.
+    The directory of 2^depth bucket pages is held in memory and mirrored
+    to a chain of directory pages, so a lookup reads a single bucket page
+    unless that bucket has overflowed.
+
+    A full bucket is split in two, doubling the directory when the bucket
+    is already as deep as the directory. A bucket whose items all share
+    one hash, or which is at the maximum depth, instead grows a chain of
+    overflow pages.
+
+    Keys must be trivially copyable. Duplicate keys are permitted.
+    */
+    template<typename Key, typename pid_type, typename size_type,
+        typename page_intf, typename Hash = std::hash<Key>>
+    class hash_index
+    {
+        static_assert(std::is_trivially_copyable<Key>::value, "Key must be trivially copyable");
+
+    public:
+        using key_type = Key;
+        using record_type = record_index<pid_type, size_type>;
+        using manager_type = page_manager<pid_type, size_type, page_intf>;
+
+    private:
+        using pinned_type = typename manager_type::pinned_page;
+        using footer_type = typename manager_type::footer_t;
+
+        struct header
+        {
+            uint64_t items;
+            size_type depth;
+            pid_type directory;
+        };
+
+        struct bucket_header
+        {
+            size_type depth;
+        };
+
+        struct entry
+        {
+            Key key;
+            record_type record;
+        };
+
+        manager_type* mgr;
+        pid_type headerPage{};
+        size_type depth{};
+        uint64_t _size{};
+
+        std::vector<pid_type> directory{};
+        std::vector<pid_type> directoryPages{};
+
+        hash_index(manager_type& mgr, pid_type headerPage) noexcept
+            : mgr(&mgr), headerPage(headerPage) { }
+
+    public:
+        /*
+        Creates an empty hash index, allocating its header, directory and
+        first bucket pages.
+        */
+        static expected<hash_index, error> create(manager_type& mgr)
+        {
+            if (mgr.page_data_size() < sizeof(header) ||
+                mgr.page_data_size() < sizeof(bucket_header) + 2 * sizeof(entry)) {
+                return unexpected<error>(error::Some);
+            }
+
+            auto headerEx = mgr.new_pinned_page();
+            if (!headerEx) return headerEx.forward_error();
+            hash_index output(mgr, headerEx.value().id());
+
+            // New pages are zeroed, so the bucket starts at depth zero
+            auto bucketEx = mgr.new_pinned_page();
+            if (!bucketEx) return bucketEx.forward_error();
+
+            output.directory.push_back(bucketEx.value().id());
+            error e = output.write_directory(0, 1);
+            if (e == error::None) e = output.write_header();
+            if (e != error::None) return unexpected<error>(e);
+            return output;
+        }
+
+        /*
+        Opens a hash index previously created on the given header page.
+        */
+        static expected<hash_index, error> open(manager_type& mgr, pid_type headerPage)
+        {
+            auto ex = mgr.pin_page(headerPage);
+            if (!ex) return ex.forward_error();
+            auto info = read_value<header>(ex.value().data());
+
+            hash_index output(mgr, headerPage);
+            output._size = info.items;
+            output.depth = info.depth;
+            if (output.depth > max_hash_depth) return unexpected<error>(error::Some);
+
+            error e = output.read_directory(info.directory);
+            if (e != error::None) return unexpected<error>(e);
+            return output;
+        }
+
+        pid_type header_page() const noexcept {
+            return headerPage;
+        }
+
+        size_t size() const noexcept {
+            return static_cast<size_t>(_size);
+        }
+
+        size_t global_depth() const noexcept {
+            return depth;
+        }
+
+        size_t bucket_capacity() const noexcept {
+            return (mgr->page_data_size() - sizeof(bucket_header)) / sizeof(entry);
+        }
+
+        error insert(const Key& key, const record_type& record)
+        {
+            uint64_t hash = hash_key(key);
+            while (true)
+            {
+                pid_type bucket = directory[hash & mask()];
+                auto ex = mgr->pin_page(bucket);
+                if (!ex) return ex.error();
+                auto page = std::move(ex.value());
+
+                auto footer = read_footer(page);
+                auto info = read_value<bucket_header>(page.data());
+
+                if (footer.records < bucket_capacity())
+                {
+                    write_entry(page, footer.records, entry{ key, record });
+                    footer.records++;
+                    write_footer(page, footer);
+                    break;
+                }
+
+                // Split unless that could not separate the items
+                bool split = info.depth < max_hash_depth;
+                if (split)
+                {
+                    auto same = same_hash(page, hash);
+                    if (!same) return same.error();
+                    split = !same.value();
+                }
+                if (!split)
+                {
+                    error e = append(std::move(page), entry{ key, record });
+                    if (e != error::None) return e;
+                    break;
+                }
+
+                error e = split_bucket(std::move(page), info.depth);
+                if (e != error::None) return e;
+            }
+
+            _size++;
+            return write_header();
+        }
+
+        /*
+        Gets the location of the first item with the given key.
+        */
+        expected<record_type, error> find(const Key& key)
+        {
+            expected<record_type, error> output = unexpected<error>(error::Some);
+            error e = scan(key, [&](const entry& item) {
+                output = item.record;
+                return false;
+            });
+            if (e != error::None) return unexpected<error>(e);
+            return output;
+        }
+
+        expected<std::vector<record_type>, error> find_all(const Key& key)
+        {
+            std::vector<record_type> output{};
+            error e = scan(key, [&](const entry& item) {
+                output.push_back(item.record);
+                return true;
+            });
+            if (e != error::None) return unexpected<error>(e);
+            return output;
+        }
+
+        /*
+        Removes every item with the given key, returning how many there were.
+        */
+        expected<size_t, error> erase(const Key& key)
+        {
+            size_t removed = 0;
+            pid_type next = directory[hash_key(key) & mask()];
+            while (next != 0)
+            {
+                auto ex = mgr->pin_page(next);
+                if (!ex) return ex.forward_error();
+                auto page = std::move(ex.value());
+
+                // Fill each hole with the last item of the page
+                auto footer = read_footer(page);
+                for (size_type i = 0; i < footer.records; )
+                {
+                    if (read_entry(page, i).key == key)
+                    {
+                        write_entry(page, i, read_entry(page, footer.records - 1));
+                        footer.records--;
+                        removed++;
+                    }
+                    else i++;
+                }
+                write_footer(page, footer);
+                next = footer.next_page;
+            }
+
+            _size -= removed;
+            error e = write_header();
+            if (e != error::None) return unexpected<error>(e);
+            return removed;
+        }
+
+    private:
+        static uint64_t hash_key(const Key& key)
+        {
+            // Mix the bits, as the low bits select the bucket
+            uint64_t output = static_cast<uint64_t>(Hash{}(key));
+            output ^= output >> 33;
+            output *= 0xFF51AFD7ED558CCDull;
+            output ^= output >> 33;
+            output *= 0xC4CEB9FE1A85EC53ull;
+            output ^= output >> 33;
+            return output;
+        }
+
+        uint64_t mask() const noexcept {
+            return (uint64_t(1) << depth) - 1;
+        }
+
+        static footer_type read_footer(pinned_type& page) noexcept {
+            return read_value<footer_type>(page.data() + page.size() - sizeof(footer_type));
+        }
+
+        static void write_footer(pinned_type& page, const footer_type& footer) noexcept
+        {
+            write_value<footer_type>(page.data() + page.size() - sizeof(footer_type), footer);
+            page.mark_dirty();
+        }
+
+        static entry read_entry(pinned_type& page, size_type index) noexcept {
+            return read_value<entry>(page.data() + sizeof(bucket_header) + index * sizeof(entry));
+        }
+
+        static void write_entry(pinned_type& page, size_type index, const entry& item) noexcept
+        {
+            write_value<entry>(page.data() + sizeof(bucket_header) + index * sizeof(entry), item);
+            page.mark_dirty();
+        }
+
+        /*
+        Invokes func for each item with the given key until it returns false.
+        */
+        template<typename Func>
+        error scan(const Key& key, Func&& func)
+        {
+            pid_type next = directory[hash_key(key) & mask()];
+            while (next != 0)
+            {
+                auto ex = mgr->pin_page(next);
+                if (!ex) return ex.error();
+                auto page = std::move(ex.value());
+
+                auto footer = read_footer(page);
+                for (size_type i = 0; i < footer.records; i++)
+                {
+                    auto item = read_entry(page, i);
+                    if (item.key == key && !func(item)) return error::None;
+                }
+                next = footer.next_page;
+            }
+            return error::None;
+        }
+
+        expected<bool, error> same_hash(pinned_type& page, uint64_t hash)
+        {
+            auto footer = read_footer(page);
+            for (size_type i = 0; i < footer.records; i++) {
+                if (hash_key(read_entry(page, i).key) != hash) return false;
+            }
+
+            pid_type next = footer.next_page;
+            while (next != 0)
+            {
+                auto ex = mgr->pin_page(next);
+                if (!ex) return ex.forward_error();
+                auto overflow = std::move(ex.value());
+
+                footer = read_footer(overflow);
+                for (size_type i = 0; i < footer.records; i++) {
+                    if (hash_key(read_entry(overflow, i).key) != hash) return false;
+                }
+                next = footer.next_page;
+            }
+            return true;
+        }
+
+        /*
+        Adds an item to the first page of a bucket's chain with space,
+        extending the chain if there is none.
+        */
+        error append(pinned_type page, const entry& item)
+        {
+            while (true)
+            {
+                auto footer = read_footer(page);
+                if (footer.records < bucket_capacity())
+                {
+                    write_entry(page, footer.records, item);
+                    footer.records++;
+                    write_footer(page, footer);
+                    return error::None;
+                }
+
+                if (footer.next_page == 0)
+                {
+                    auto ex = mgr->new_pinned_page();
+                    if (!ex) return ex.error();
+
+                    footer.next_page = ex.value().id();
+                    write_footer(page, footer);
+                    page = std::move(ex.value());
+                }
+                else
+                {
+                    auto ex = mgr->pin_page(footer.next_page);
+                    if (!ex) return ex.error();
+                    page = std::move(ex.value());
+                }
+            }
+        }
+
+        /*
+        Splits a bucket on bit localDepth of the hash, moving items with that
+        bit set to a new bucket.
+        */
+        error split_bucket(pinned_type page, size_type localDepth)
+        {
+            pid_type bucket = page.id();
+            if (localDepth == depth)
+            {
+                error e = grow_directory();
+                if (e != error::None) return e;
+            }
+
+            // Take every item out of the bucket's chain, keeping its pages
+            std::vector<entry> items{};
+            {
+                pinned_type current = std::move(page);
+                while (true)
+                {
+                    auto footer = read_footer(current);
+                    for (size_type i = 0; i < footer.records; i++) {
+                        items.push_back(read_entry(current, i));
+                    }
+                    footer.records = 0;
+                    write_footer(current, footer);
+                    if (current.id() == bucket) {
+                        write_value<bucket_header>(current.data(), bucket_header{ size_type(localDepth + 1) });
+                    }
+
+                    if (footer.next_page == 0) break;
+                    auto ex = mgr->pin_page(footer.next_page);
+                    if (!ex) return ex.error();
+                    current = std::move(ex.value());
+                }
+            }
+
+            pid_type sibling{};
+            {
+                auto ex = mgr->new_pinned_page();
+                if (!ex) return ex.error();
+                sibling = ex.value().id();
+                write_value<bucket_header>(ex.value().data(), bucket_header{ size_type(localDepth + 1) });
+                ex.value().mark_dirty();
+            }
+
+            for (uint64_t i = 0; i < directory.size(); i++)
+            {
+                if (directory[i] == bucket && ((i >> localDepth) & 1) != 0)
+                {
+                    directory[i] = sibling;
+                    error e = write_directory(i, i + 1);
+                    if (e != error::None) return e;
+                }
+            }
+
+            for (auto& item : items)
+            {
+                bool high = ((hash_key(item.key) >> localDepth) & 1) != 0;
+                auto target = mgr->pin_page(high ? sibling : bucket);
+                if (!target) return target.error();
+
+                error e = append(std::move(target.value()), item);
+                if (e != error::None) return e;
+            }
+            return error::None;
+        }
+
+        error grow_directory()
+        {
+            size_t count = directory.size();
+            directory.resize(count * 2);
+            std::copy(directory.begin(), directory.begin() + count, directory.begin() + count);
+            depth++;
+
+            error e = write_directory(count, directory.size());
+            if (e != error::None) return e;
+            return write_header();
+        }
+
+        /*
+        Writes directory entries [first, last) to the directory pages,
+        extending the chain of pages as needed.
+        */
+        error write_directory(size_t first, size_t last)
+        {
+            size_t perPage = mgr->page_data_size() / sizeof(pid_type);
+            while (directoryPages.size() * perPage < last)
+            {
+                auto ex = mgr->new_pinned_page();
+                if (!ex) return ex.error();
+
+                if (!directoryPages.empty())
+                {
+                    auto prev = mgr->pin_page(directoryPages.back());
+                    if (!prev) return prev.error();
+
+                    auto footer = read_footer(prev.value());
+                    footer.next_page = ex.value().id();
+                    write_footer(prev.value(), footer);
+                }
+                directoryPages.push_back(ex.value().id());
+            }
+
+            for (size_t i = first; i < last; )
+            {
+                auto ex = mgr->pin_page(directoryPages[i / perPage]);
+                if (!ex) return ex.error();
+
+                size_t end = std::min(last, (i / perPage + 1) * perPage);
+                for (; i < end; i++) {
+                    write_value<pid_type>(ex.value().data() + (i % perPage) * sizeof(pid_type),
+                        directory[i]);
+                }
+                ex.value().mark_dirty();
+            }
+            return error::None;
+        }
+
+        error write_header()
+        {
+            auto ex = mgr->pin_page(headerPage);
+            if (!ex) return ex.error();
+
+            write_value<header>(ex.value().data(), header{ _size, depth,
+                directoryPages.empty() ? pid_type{} : directoryPages[0] });
+            ex.value().mark_dirty();
+            return error::None;
+        }
+
+        error read_directory(pid_type first)
+        {
+            size_t count = size_t(1) << depth;
+            size_t perPage = mgr->page_data_size() / sizeof(pid_type);
+
+            directory.resize(count);
+            for (size_t i = 0; i < count; )
+            {
+                if (first == 0) return error::Some;
+
+                auto ex = mgr->pin_page(first);
+                if (!ex) return ex.error();
+                directoryPages.push_back(first);
+
+                size_t end = std::min(count, i + perPage);
+                for (size_t j = 0; i < end; i++, j++) {
+                    directory[i] = read_value<pid_type>(ex.value().data() + j * sizeof(pid_type));
+                }
+                first = read_footer(ex.value()).next_page;
+            }
+            return error::None;
+        }
+    };
+
+    /*
+    Creates an empty hash index. The page pool must hold at least four
+    pages, as a split pins up to four at once.
+    */
+    template<typename Key, typename Hash = std::hash<Key>, typename pid_type,
+        typename size_type, typename page_intf>
+    auto make_hash_index(page_manager<pid_type, size_type, page_intf>& mgr)
+    {
+        return hash_index<Key, pid_type, size_type, page_intf, Hash>::create(mgr);
+    }
+
+    template<typename Key, typename Hash = std::hash<Key>, typename pid_type,
+        typename size_type, typename page_intf>
+    auto open_hash_index(page_manager<pid_type, size_type, page_intf>& mgr, pid_type headerPage)
+    {
+        return hash_index<Key, pid_type, size_type, page_intf, Hash>::open(mgr, headerPage);
+    }
+}
@@ -0,0 +1,212 @@
+/* hash_join.hpp - (c) 2018 James Renwick */
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace osdb
+{
+    // Cache a join's hash table should fit within, roughly that of L2
+    constexpr const size_t join_cache_bytes = 256 * 1024;
+
+    // Number of probes whose slots are prefetched together
+    constexpr const size_t join_probe_batch = 32;
+
+    // Most partitions made by a single radix pass, bounded by TLB entries
+    constexpr const size_t max_join_radix_bits = 10;
+
+    /*
+    Hashes a join key. The result of std::hash is mixed, since it may be
+    the identity for integers, leaving the high bits used for partitioning
+    and the low bits used for slots poorly distributed.
+    */
+    template<typename T, typename Hash = std::hash<T>>
+    uint64_t join_hash(const T& value)
+    {
+        uint64_t hash = static_cast<uint64_t>(Hash()(value));
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    /*
+    The hash table of the build side of a join, mapping the hashes of
+    build keys to their positions. Slots are held in one array and probed
+    linearly, at most half full, so that a probe usually reads a single
+    cache line. Keys themselves are not stored: each probe reports every
+    position whose hash may equal its own, and the caller compares the keys.
+    */
+    class join_hash_table
+    {
+        struct slot
+        {
+            // Zero marks an empty slot
+            uint64_t hash;
+            size_t position;
+        };
+
+        std::vector<slot> slots{};
+        size_t mask{};
+
+        static uint64_t stored_hash(uint64_t hash) noexcept {
+            return hash != 0 ? hash : 1;
+        }
+
+    public:
+        /*
+        Builds the table from count hashes. Positions gives the position
+        reported for each hash, or is null to report its index.
+        */
+        void build(const uint64_t* hashes, const size_t* positions, size_t count)
+        {
+            size_t capacity = 2;
+            while (capacity < count * 2) capacity *= 2;
+
+            slots.assign(capacity, slot{});
+            mask = capacity - 1;
+            for (size_t i = 0; i < count; i++)
+            {
+                uint64_t hash = stored_hash(hashes[i]);
+                size_t index = static_cast<size_t>(hash) & mask;
+                while (slots[index].hash != 0) index = (index + 1) & mask;
+                slots[index] = slot{ hash, positions != nullptr ? positions[i] : i };
+            }
+        }
+
+        /*
+        Calls match(probe, position) for each probe hash and the position of
+        each build hash equal to it, where probe is taken from positions or
+        is the probe's index when positions is null. Probes are taken in
+        batches, prefetching the slots of a whole batch before reading any,
+        so that their cache misses overlap.
+        */
+        template<typename Match>
+        void probe(const uint64_t* hashes, const size_t* positions, size_t count,
+            Match&& match) const
+        {
+            if (slots.empty()) return;
+
+            size_t indexes[join_probe_batch];
+            for (size_t first = 0; first < count; first += join_probe_batch)
+            {
+                size_t last = count - first < join_probe_batch ? count : first + join_probe_batch;
+                for (size_t i = first; i < last; i++)
+                {
+                    indexes[i - first] = static_cast<size_t>(stored_hash(hashes[i])) & mask;
+                    __builtin_prefetch(&slots[indexes[i - first]]);
+                }
+
+                for (size_t i = first; i < last; i++)
+                {
+                    uint64_t hash = stored_hash(hashes[i]);
+                    size_t probe = positions != nullptr ? positions[i] : i;
+                    for (size_t index = indexes[i - first]; slots[index].hash != 0;
+                        index = (index + 1) & mask)
+                    {
+                        if (slots[index].hash == hash) match(probe, slots[index].position);
+                    }
+                }
+            }
+        }
+
+        size_t capacity() const noexcept {
+            return slots.size();
+        }
+    };
+
+    namespace detail
+    {
+        /*
+        Scatters the indexes of count hashes into 2^bits partitions by the
+        top bits of each hash, in a single counting pass. Partition i spans
+        [starts[i], starts[i + 1]) of the output arrays.
+        */
+        inline void radix_partition(const uint64_t* hashes, size_t count, size_t bits,
+            std::vector<uint64_t>& outputHashes, std::vector<size_t>& outputPositions,
+            std::vector<size_t>& starts)
+        {
+            size_t partitions = size_t(1) << bits;
+            size_t shift = 64 - bits;
+
+            starts.assign(partitions + 1, 0);
+            for (size_t i = 0; i < count; i++) {
+                starts[static_cast<size_t>(hashes[i] >> shift) + 1]++;
+            }
+            for (size_t i = 0; i < partitions; i++) {
+                starts[i + 1] += starts[i];
+            }
+
+            std::vector<size_t> next(starts.begin(), starts.end() - 1);
+            outputHashes.resize(count);
+            outputPositions.resize(count);
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t index = next[static_cast<size_t>(hashes[i] >> shift)]++;
+                outputHashes[index] = hashes[i];
+                outputPositions[index] = i;
+            }
+        }
+    }
+
+    /*
+    Joins two sides by hash, partitioning both by the top radix bits of
+    their hashes first so that the table of each build partition fits in
+    cache. Calls match(probe, build) with the index of each probe hash and
+    of each build hash equal to it, in no particular order.
+    */
+    template<typename Match>
+    void hash_join_partitioned(const uint64_t* buildHashes, size_t buildCount,
+        const uint64_t* probeHashes, size_t probeCount, size_t bits, Match&& match)
+    {
+        if (bits == 0 || buildCount == 0 || probeCount == 0)
+        {
+            join_hash_table table{};
+            table.build(buildHashes, nullptr, buildCount);
+            table.probe(probeHashes, nullptr, probeCount, match);
+            return;
+        }
+
+        std::vector<uint64_t> buildPartitioned{}, probePartitioned{};
+        std::vector<size_t> buildPositions{}, probePositions{};
+        std::vector<size_t> buildStarts{}, probeStarts{};
+        detail::radix_partition(buildHashes, buildCount, bits,
+            buildPartitioned, buildPositions, buildStarts);
+        detail::radix_partition(probeHashes, probeCount, bits,
+            probePartitioned, probePositions, probeStarts);
+
+        join_hash_table table{};
+        for (size_t i = 0; i + 1 < buildStarts.size(); i++)
+        {
+            size_t buildFirst = buildStarts[i], probeFirst = probeStarts[i];
+            if (buildStarts[i + 1] == buildFirst || probeStarts[i + 1] == probeFirst) continue;
+
+            table.build(buildPartitioned.data() + buildFirst, buildPositions.data() + buildFirst,
+                buildStarts[i + 1] - buildFirst);
+            table.probe(probePartitioned.data() + probeFirst, probePositions.data() + probeFirst,
+                probeStarts[i + 1] - probeFirst, match);
+        }
+    }
+
+    /*
+    Joins two sides by hash as hash_join_partitioned does, partitioning
+    only when the build side's table would not fit in cacheBytes.
+    */
+    template<typename Match>
+    void hash_join(const uint64_t* buildHashes, size_t buildCount,
+        const uint64_t* probeHashes, size_t probeCount, Match&& match,
+        size_t cacheBytes = join_cache_bytes)
+    {
+        // Tables are at most half full, of a hash and position per slot
+        size_t tableBytes = buildCount * 2 * (sizeof(uint64_t) + sizeof(size_t));
+
+        size_t bits = 0;
+        while (bits < max_join_radix_bits && (tableBytes >> bits) > cacheBytes) bits++;
+        hash_join_partitioned(buildHashes, buildCount, probeHashes, probeCount, bits,
+            std::forward<Match>(match));
+    }
+}
@@ -0,0 +1,184 @@
+/* normalized_key.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <array>
+#include <string>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <type_traits>
+
+namespace osdb
+{
+    /*
+    A key encoded as a byte string whose memcmp order matches the order
+    of the values it was built from. Composite keys are built by appending
+    each column in turn, so (tenant, timestamp, id) compares as one
+    memcmp rather than as a chain of per-column comparisons.
+
+    Columns are encoded as follows:
+      - unsigned integers as big-endian bytes
+      - signed integers as big-endian bytes with the sign bit flipped
+      - floating-point values with the sign bit flipped when positive and
+        every bit flipped when negative. -0.0 is stored as 0.0 and every
+        NaN as a single NaN ordered after infinity.
+      - strings with each 0x00 byte escaped as 0x00 0xFF and terminated by
+        0x00 0x00, so that a string orders before any string it prefixes
+        whatever column follows it
+
+    The bytes are stored inline, so keys can be held directly in tree
+    nodes. Appending a column which does not fit fails and leaves the key
+    unchanged.
+    */
+    template<size_t Capacity>
+    class normalized_key
+    {
+        static_assert(Capacity != 0, "Capacity must be non-zero");
+
+        std::array<unsigned char, Capacity> bytes{};
+        size_t length{};
+
+    public:
+        constexpr size_t capacity() const noexcept {
+            return Capacity;
+        }
+
+        size_t size() const noexcept {
+            return length;
+        }
+
+        const unsigned char* data() const noexcept {
+            return bytes.data();
+        }
+
+        void clear() noexcept {
+            length = 0;
+        }
+
+        template<typename T>
+        std::enable_if_t<std::is_integral<T>::value, bool> append(T value) noexcept
+        {
+            using U = std::make_unsigned_t<T>;
+            auto bits = static_cast<U>(value);
+            if (std::is_signed<T>::value) {
+                bits ^= static_cast<U>(U(1) << (sizeof(U) * 8 - 1));
+            }
+            return append_big_endian(bits);
+        }
+
+        template<typename T>
+        std::enable_if_t<std::is_floating_point<T>::value, bool> append(T value) noexcept
+        {
+            static_assert(sizeof(T) == 4 || sizeof(T) == 8, "Unsupported floating-point type");
+            using U = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+            constexpr const U sign = U(1) << (sizeof(U) * 8 - 1);
+
+            if (value == 0) value = 0;
+            if (value != value) value = std::numeric_limits<T>::quiet_NaN();
+
+            U bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bits = (bits & sign) != 0 ? ~bits : (bits | sign);
+            return append_big_endian(bits);
+        }
+
+        bool append(const char* string, size_t size) noexcept
+        {
+            size_t required = size + 2;
+            for (size_t i = 0; i < size; i++) {
+                if (string[i] == '\0') required++;
+            }
+            if (required > Capacity - length) return false;
+
+            for (size_t i = 0; i < size; i++)
+            {
+                bytes[length++] = static_cast<unsigned char>(string[i]);
+                if (string[i] == '\0') bytes[length++] = 0xFF;
+            }
+            bytes[length++] = 0;
+            bytes[length++] = 0;
+            return true;
+        }
+
+        bool append(const std::string& string) noexcept {
+            return append(string.data(), string.size());
+        }
+
+        bool append(const char* string) noexcept {
+            return append(string, std::strlen(string));
+        }
+
+        friend bool operator <(const normalized_key& a, const normalized_key& b) noexcept
+        {
+            int result = std::memcmp(a.bytes.data(), b.bytes.data(),
+                a.length < b.length ? a.length : b.length);
+            return result < 0 || (result == 0 && a.length < b.length);
+        }
+
+        friend bool operator ==(const normalized_key& a, const normalized_key& b) noexcept {
+            return a.length == b.length && std::memcmp(a.bytes.data(), b.bytes.data(), a.length) == 0;
+        }
+
+        friend bool operator !=(const normalized_key& a, const normalized_key& b) noexcept {
+            return !(a == b);
+        }
+        friend bool operator >(const normalized_key& a, const normalized_key& b) noexcept {
+            return b < a;
+        }
+        friend bool operator <=(const normalized_key& a, const normalized_key& b) noexcept {
+            return !(b < a);
+        }
+        friend bool operator >=(const normalized_key& a, const normalized_key& b) noexcept {
+            return !(a < b);
+        }
+
+    private:
+        template<typename U>
+        bool append_big_endian(U bits) noexcept
+        {
+            if (sizeof(U) > Capacity - length) return false;
+            for (size_t i = sizeof(U); i != 0; i--) {
+                bytes[length++] = static_cast<unsigned char>(bits >> ((i - 1) * 8));
+            }
+            return true;
+        }
+    };
+
+    namespace detail
+    {
+        template<size_t Capacity>
+        bool normalize_columns(normalized_key<Capacity>&) noexcept {
+            return true;
+        }
+
+        template<size_t Capacity, typename T, typename... Ts>
+        bool normalize_columns(normalized_key<Capacity>& key, const T& column,
+            const Ts&... columns) noexcept
+        {
+            return key.append(column) && normalize_columns(key, columns...);
+        }
+    }
+
+    /*
+    Encodes the given columns, in order, into output. Returns false, leaving
+    output empty, if they do not fit.
+    */
+    template<size_t Capacity, typename... Ts>
+    bool normalize(normalized_key<Capacity>& output, const Ts&... columns) noexcept
+    {
+        output.clear();
+        if (detail::normalize_columns(output, columns...)) return true;
+
+        output.clear();
+        return false;
+    }
+
+    /*
+    A B+ tree keyed on normalized keys of up to KeySize bytes. Keys are
+    held inline in each node and compared with a single memcmp.
+    */
+    template<size_t KeySize, typename Value, size_t Order, size_t LeafSize,
+        bool Counted = false>
+    using normalized_bplus_tree = bplus_tree<normalized_key<KeySize>, Value,
+        Order, LeafSize, Counted>;
+}
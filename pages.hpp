@@ -1,4 +1,5 @@
 /* pages.hpp - (c) 2018 James Renwick */
+#pragma once
 #include "expected.hpp"
 #include <vector>
 #include <memory>
@@ -31,10 +32,11 @@ namespace osdb
         size_type offset;
         size_type size;
 
-        bool operator ==(const record_index& other) noexcept {
-            return std::memcmp(this, &other, sizeof(record_index)) == 0;
+        bool operator ==(const record_index& other) const noexcept {
+            return pageid == other.pageid && slot_index == other.slot_index &&
+                offset == other.offset && size == other.size;
         }
-        bool operator !=(const record_index& other) noexcept {
+        bool operator !=(const record_index& other) const noexcept {
             return !(*this == other);
         }
     };
@@ -437,9 +439,12 @@ namespace osdb
                 // Move entry to end (LIFO)
                 auto iter = directory.begin() + i;
                 std::rotate(iter, iter + 1, directory.end());
-                return i;
+                return directory.size() - 1;
             }
-            else return unexpected<error>(e);
+            // Release the reserved entry
+            directory[i].page = 0;
+            directory[i].pinCount = 0;
+            return unexpected<error>(e);
         }
     };
 
@@ -560,7 +565,7 @@ namespace osdb
                     // Update linked list
                     pageFooter.next_page = pageEx.value().id();
                     write_value<page_footer<pid_type, size_type>>(footerStart, pageFooter);
-                    page.mark_dirty();
+                    curPage.mark_dirty();
 
                     // Move to new page
                     page = std::move(pageEx.value());
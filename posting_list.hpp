@@ -0,0 +1,522 @@
+/* posting_list.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <iterator>
+#include <algorithm>
+#include <type_traits>
+
+namespace osdb
+{
+    template<typename pid_type, typename size_type>
+    struct record_index;
+
+    namespace detail
+    {
+        inline void write_varint(std::vector<uint8_t>& output, uint64_t value)
+        {
+            while (value >= 0x80)
+            {
+                output.push_back(static_cast<uint8_t>(value | 0x80));
+                value >>= 7;
+            }
+            output.push_back(static_cast<uint8_t>(value));
+        }
+
+        inline uint64_t read_varint(const uint8_t*& input) noexcept
+        {
+            uint64_t output = 0;
+            for (unsigned shift = 0; ; shift += 7)
+            {
+                uint8_t byte = *input++;
+                output |= static_cast<uint64_t>(byte & 0x7F) << shift;
+                if ((byte & 0x80) == 0) return output;
+            }
+        }
+    }
+
+    /*
+    Describes how a posting list orders and delta-encodes its values.
+    Values without a codec are stored uncompressed, in insertion order.
+    */
+    template<typename Value, typename = void>
+    struct posting_codec
+    {
+        static constexpr bool compressed = false;
+    };
+
+    template<typename Value>
+    struct posting_codec<Value, std::enable_if_t<std::is_integral<Value>::value>>
+    {
+        static constexpr bool compressed = true;
+        using unsigned_type = std::make_unsigned_t<Value>;
+
+        static bool less(const Value& a, const Value& b) noexcept {
+            return a < b;
+        }
+
+        static void encode(std::vector<uint8_t>& output, const Value* previous, const Value& value)
+        {
+            auto bits = static_cast<unsigned_type>(value);
+            if (previous != nullptr) bits -= static_cast<unsigned_type>(*previous);
+            detail::write_varint(output, bits);
+        }
+
+        static Value decode(const uint8_t*& input, const Value* previous) noexcept
+        {
+            auto bits = static_cast<unsigned_type>(detail::read_varint(input));
+            if (previous != nullptr) bits += static_cast<unsigned_type>(*previous);
+            return static_cast<Value>(bits);
+        }
+    };
+
+    /*
+    Record indices are ordered by page and slot. Each stores the distance
+    to the previous page, then its slot relative to the previous slot
+    when on the same page, and finally its offset and size.
+    */
+    template<typename pid_type, typename size_type>
+    struct posting_codec<record_index<pid_type, size_type>>
+    {
+        static constexpr bool compressed = true;
+        using value_type = record_index<pid_type, size_type>;
+
+        static bool less(const value_type& a, const value_type& b) noexcept
+        {
+            return a.pageid < b.pageid ||
+                (a.pageid == b.pageid && a.slot_index < b.slot_index);
+        }
+
+        static void encode(std::vector<uint8_t>& output, const value_type* previous,
+            const value_type& value)
+        {
+            bool samePage = previous != nullptr && previous->pageid == value.pageid;
+            detail::write_varint(output, static_cast<uint64_t>(value.pageid) -
+                (previous != nullptr ? static_cast<uint64_t>(previous->pageid) : 0));
+            detail::write_varint(output, static_cast<uint64_t>(value.slot_index) -
+                (samePage ? static_cast<uint64_t>(previous->slot_index) : 0));
+            detail::write_varint(output, static_cast<uint64_t>(value.offset));
+            detail::write_varint(output, static_cast<uint64_t>(value.size));
+        }
+
+        static value_type decode(const uint8_t*& input, const value_type* previous) noexcept
+        {
+            value_type output{};
+            uint64_t page = detail::read_varint(input);
+            bool samePage = previous != nullptr && page == 0;
+
+            output.pageid = static_cast<pid_type>(page +
+                (previous != nullptr ? static_cast<uint64_t>(previous->pageid) : 0));
+            output.slot_index = static_cast<size_type>(detail::read_varint(input) +
+                (samePage ? static_cast<uint64_t>(previous->slot_index) : 0));
+            output.offset = static_cast<size_type>(detail::read_varint(input));
+            output.size = static_cast<size_type>(detail::read_varint(input));
+            return output;
+        }
+    };
+
+
+    /*
+    The values held under a single key. Values with a posting_codec are
+    kept sorted and delta-encoded, and are iterated in ascending order.
+    Others are kept as-is in insertion order.
+    */
+    template<typename Value, bool Compressed = posting_codec<Value>::compressed>
+    class posting_list
+    {
+        std::vector<Value> values{};
+
+    public:
+        using value_type = Value;
+        using const_iterator = typename std::vector<Value>::const_iterator;
+
+        size_t size() const noexcept {
+            return values.size();
+        }
+
+        bool empty() const noexcept {
+            return values.empty();
+        }
+
+        size_t bytes() const noexcept {
+            return values.size() * sizeof(Value);
+        }
+
+        void add(Value value) {
+            values.push_back(std::move(value));
+        }
+
+        bool contains(const Value& value) const {
+            return std::find(values.begin(), values.end(), value) != values.end();
+        }
+
+        bool remove(const Value& value)
+        {
+            auto iter = std::find(values.begin(), values.end(), value);
+            if (iter == values.end()) return false;
+
+            values.erase(iter);
+            return true;
+        }
+
+        const_iterator begin() const noexcept {
+            return values.begin();
+        }
+        const_iterator end() const noexcept {
+            return values.end();
+        }
+    };
+
+    template<typename Value>
+    class posting_list<Value, true>
+    {
+        using codec = posting_codec<Value>;
+
+        std::vector<uint8_t> data{};
+        size_t count{};
+        Value last{};
+
+    public:
+        using value_type = Value;
+
+        class const_iterator
+        {
+            friend posting_list;
+
+            // Values are decoded as they are reached, so next points
+            // just past the current value
+            const uint8_t* next{};
+            const uint8_t* end{};
+            Value current{};
+            bool atEnd{true};
+
+            const_iterator(const uint8_t* next, const uint8_t* end) noexcept
+                : next(next), end(end), atEnd(next == end)
+            {
+                if (!atEnd) current = codec::decode(this->next, nullptr);
+            }
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = Value;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Value*;
+            using reference = const Value&;
+
+            const_iterator() = default;
+
+            reference operator *() const noexcept {
+                return current;
+            }
+            pointer operator ->() const noexcept {
+                return &current;
+            }
+
+            bool operator ==(const const_iterator& other) const noexcept {
+                return atEnd == other.atEnd && (atEnd || next == other.next);
+            }
+            bool operator !=(const const_iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            const_iterator& operator ++() noexcept
+            {
+                if (next == end) atEnd = true;
+                else current = codec::decode(next, &current);
+                return *this;
+            }
+        };
+
+        size_t size() const noexcept {
+            return count;
+        }
+
+        bool empty() const noexcept {
+            return count == 0;
+        }
+
+        size_t bytes() const noexcept {
+            return data.size();
+        }
+
+        void add(Value value)
+        {
+            // Values usually arrive in ascending order and are appended
+            if (count == 0 || !codec::less(value, last))
+            {
+                codec::encode(data, count != 0 ? &last : nullptr, value);
+                last = std::move(value);
+                count++;
+                return;
+            }
+
+            auto values = unpack();
+            values.insert(std::upper_bound(values.begin(), values.end(), value, codec::less),
+                std::move(value));
+            pack(values);
+        }
+
+        bool contains(const Value& value) const
+        {
+            for (auto& other : *this)
+            {
+                if (codec::less(value, other)) break;
+                if (other == value) return true;
+            }
+            return false;
+        }
+
+        bool remove(const Value& value)
+        {
+            auto values = unpack();
+            auto iter = std::lower_bound(values.begin(), values.end(), value, codec::less);
+            for (; iter != values.end() && !codec::less(value, *iter); ++iter)
+            {
+                if (*iter == value)
+                {
+                    values.erase(iter);
+                    pack(values);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const_iterator begin() const noexcept {
+            return const_iterator(data.data(), data.data() + data.size());
+        }
+        const_iterator end() const noexcept {
+            return const_iterator(data.data() + data.size(), data.data() + data.size());
+        }
+
+    private:
+        std::vector<Value> unpack() const
+        {
+            std::vector<Value> output{};
+            output.reserve(count);
+            for (auto& value : *this) output.push_back(value);
+            return output;
+        }
+
+        void pack(const std::vector<Value>& values)
+        {
+            data.clear();
+            count = 0;
+            for (auto& value : values)
+            {
+                codec::encode(data, count != 0 ? &last : nullptr, value);
+                last = value;
+                count++;
+            }
+        }
+    };
+
+
+    /*
+    A B+ tree for non-unique keys which stores each distinct key once,
+    along with a posting_list of its values. Iteration still yields one
+    (key, value) pair per value added.
+    */
+    template<typename Key, typename Value, size_t Order, size_t LeafSize>
+    class posting_bplus_tree
+    {
+    public:
+        using key_type = Key;
+        using value_type = Value;
+        using list_type = posting_list<Value>;
+
+    private:
+        using tree_type = bplus_tree<Key, list_type, Order, LeafSize>;
+
+        tree_type tree{};
+        size_t _size{};
+
+    public:
+        template<typename Range>
+        class iterable;
+
+        template<typename Outer>
+        class iterator
+        {
+            template<typename Range>
+            friend class posting_bplus_tree::iterable;
+
+            Outer outer;
+            Outer outerEnd;
+            typename list_type::const_iterator inner{};
+
+            iterator(Outer outer, Outer outerEnd)
+                : outer(outer), outerEnd(outerEnd)
+            {
+                skip_empty();
+            }
+
+            void skip_empty()
+            {
+                for (; outer != outerEnd; ++outer)
+                {
+                    if (!outer->second.empty())
+                    {
+                        inner = outer->second.begin();
+                        return;
+                    }
+                }
+            }
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::pair<const Key&, const Value&>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            value_type operator *() {
+                return value_type(outer->first, *inner);
+            }
+
+            bool operator ==(const iterator& other) const noexcept {
+                return outer == other.outer && (outer == outerEnd || inner == other.inner);
+            }
+            bool operator !=(const iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            iterator& operator ++()
+            {
+                if (++inner == outer->second.end())
+                {
+                    ++outer;
+                    skip_empty();
+                }
+                return *this;
+            }
+        };
+
+        template<typename Range>
+        class iterable
+        {
+            friend posting_bplus_tree;
+            using outer_type = decltype(std::declval<Range&>().begin());
+
+            Range range;
+
+            explicit iterable(Range range)
+                : range(range) { }
+
+        public:
+            iterator<outer_type> begin() {
+                return iterator<outer_type>(range.begin(), range.end());
+            }
+            iterator<outer_type> end() {
+                return iterator<outer_type>(range.end(), range.end());
+            }
+        };
+
+        constexpr size_t order() const noexcept {
+            return Order;
+        }
+
+        constexpr size_t leaf_size() const noexcept {
+            return LeafSize;
+        }
+
+        size_t height() const noexcept {
+            return tree.height();
+        }
+
+        /*
+        Gets the number of (key, value) pairs held.
+        */
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        /*
+        Gets the number of distinct keys held, including any whose values
+        have all been removed.
+        */
+        size_t key_count() const noexcept {
+            return tree.size();
+        }
+
+        void add(Key key, Value value) &
+        {
+            auto* list = tree.find(key);
+            if (list != nullptr) list->add(std::move(value));
+            else
+            {
+                list_type output{};
+                output.add(std::move(value));
+                tree.add(std::move(key), std::move(output));
+            }
+            _size++;
+        }
+
+        void clear() noexcept
+        {
+            tree.clear();
+            _size = 0;
+        }
+
+        /*
+        Replaces the contents of the tree with a range of (key, value)
+        pairs sorted by key, building each posting list in turn and then
+        the tree bottom-up.
+        */
+        template<typename Iterable>
+        void assign_sorted(Iterable&& range) &
+        {
+            std::vector<std::pair<Key, list_type>> lists{};
+            _size = 0;
+            for (auto&& pair : range)
+            {
+                if (lists.empty() || lists.back().first < pair.first) {
+                    lists.emplace_back(pair.first, list_type{});
+                }
+                lists.back().second.add(pair.second);
+                _size++;
+            }
+            tree.assign_sorted(lists);
+        }
+
+        /*
+        Removes a single matching (key, value) pair. Returns false if there
+        was none.
+        */
+        bool remove(const Key& key, const Value& value) &
+        {
+            auto* list = tree.find(key);
+            if (list == nullptr || !list->remove(value)) return false;
+
+            _size--;
+            return true;
+        }
+
+        /*
+        Gets whether the given (key, value) pair is held.
+        */
+        bool contains(const Key& key, const Value& value) const
+        {
+            auto* list = tree.find(key);
+            return list != nullptr && list->contains(value);
+        }
+
+        /*
+        Gets the values held under the given key, or nullptr if there are none.
+        */
+        const list_type* find(const key_type& key) const
+        {
+            auto* list = tree.find(key);
+            return list != nullptr && !list->empty() ? list : nullptr;
+        }
+
+        template<typename... Args>
+        auto search_range(const Args&... args) const &
+        {
+            using range_type = decltype(tree.search_range(args...));
+            return iterable<range_type>(tree.search_range(args...));
+        }
+    };
+}
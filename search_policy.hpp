@@ -0,0 +1,124 @@
+/* search_policy.hpp - (c) 2018 James Renwick */
+#pragma once
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+
+namespace osdb
+{
+    /*
+    Search policies locate keys within the sorted arrays of tree nodes.
+    Each provides lower_bound and upper_bound over count items, where
+    proj(item) yields the key of an item.
+    */
+
+    /*
+    Binary search, suitable for any key type.
+    */
+    struct binary_search_policy
+    {
+        template<typename T, typename Key, typename Proj>
+        static size_t lower_bound(const T* items, size_t count, const Key& key,
+            Proj&& proj) noexcept
+        {
+            auto iter = std::lower_bound(items, items + count, key,
+                [&](const T& item, const Key& k) { return proj(item) < k; });
+            return static_cast<size_t>(iter - items);
+        }
+
+        template<typename T, typename Key, typename Proj>
+        static size_t upper_bound(const T* items, size_t count, const Key& key,
+            Proj&& proj) noexcept
+        {
+            auto iter = std::upper_bound(items, items + count, key,
+                [&](const Key& k, const T& item) { return k < proj(item); });
+            return static_cast<size_t>(iter - items);
+        }
+    };
+
+    /*
+    Interpolation search for arithmetic keys. The slot is predicted from a
+    line through the first and last keys, then found by galloping outward
+    from the prediction and bisecting the bracket this yields. Near-uniform
+    keys, such as sequential IDs and timestamps, are typically found within
+    a probe or two; skewed keys degrade gracefully to a logarithmic search.
+    */
+    struct interpolation_search_policy
+    {
+        template<typename T, typename Key, typename Proj>
+        static size_t lower_bound(const T* items, size_t count, const Key& key,
+            Proj&& proj) noexcept
+        {
+            return bound(items, count, key, [&](const T& item) {
+                return proj(item) < key;
+            }, proj);
+        }
+
+        template<typename T, typename Key, typename Proj>
+        static size_t upper_bound(const T* items, size_t count, const Key& key,
+            Proj&& proj) noexcept
+        {
+            return bound(items, count, key, [&](const T& item) {
+                return !(key < proj(item));
+            }, proj);
+        }
+
+    private:
+        /*
+        Gets the index of the first item for which before(item) is false.
+        */
+        template<typename T, typename Key, typename Before, typename Proj>
+        static size_t bound(const T* items, size_t count, const Key& key,
+            Before&& before, Proj&& proj) noexcept
+        {
+            static_assert(std::is_arithmetic<Key>::value,
+                "interpolation_search_policy requires arithmetic keys");
+
+            if (count == 0 || !before(items[0])) return 0;
+            if (before(items[count - 1])) return count;
+
+            // The answer now lies within [1, count - 1]
+            double low = static_cast<double>(proj(items[0]));
+            double span = static_cast<double>(proj(items[count - 1])) - low;
+            double guess = span > 0 ? (static_cast<double>(key) - low) / span * (count - 1) : 0;
+
+            size_t pos = guess < 1 ? 1 : static_cast<size_t>(guess);
+            if (pos > count - 1) pos = count - 1;
+
+            size_t first, last;
+            if (before(items[pos]))
+            {
+                // Gallop right until an item is not before the key
+                size_t step = 1;
+                first = pos + 1;
+                last = count - 1;
+                while (pos + step < count - 1)
+                {
+                    if (!before(items[pos + step])) {
+                        last = pos + step; break;
+                    }
+                    first = pos + step + 1;
+                    step *= 2;
+                }
+            }
+            else
+            {
+                // Gallop left until an item is before the key
+                size_t step = 1;
+                first = 1;
+                last = pos;
+                while (step < pos)
+                {
+                    if (before(items[pos - step])) {
+                        first = pos - step + 1; break;
+                    }
+                    last = pos - step;
+                    step *= 2;
+                }
+            }
+
+            auto iter = std::partition_point(items + first, items + last, before);
+            return static_cast<size_t>(iter - items);
+        }
+    };
+}
@@ -0,0 +1,626 @@
+/* secondary_index.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "pages.hpp"
+#include "posting_list.hpp"
+#include <tuple>
+#include <limits>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <utility>
+#include <algorithm>
+#include <type_traits>
+#include <unordered_set>
+
+namespace osdb
+{
+    /*
+    Declares a secondary index on field Field of the records of a heap,
+    keyed by the field's value. Key is either trivially copyable, read
+    from a field of exactly sizeof(Key) bytes, or std::string.
+    */
+    template<size_t Field, typename Key, size_t Order = 16, size_t LeafSize = 32>
+    struct secondary_index
+    {
+        static constexpr const size_t field = Field;
+        using key_type = Key;
+
+        template<typename Value>
+        using tree_type = posting_bplus_tree<Key, Value, Order, LeafSize>;
+    };
+
+    namespace detail
+    {
+        template<typename T>
+        struct field_codec
+        {
+            static_assert(std::is_trivially_copyable<T>::value,
+                "Fields must be trivially copyable or std::string");
+
+            static size_t size(const T&) noexcept {
+                return sizeof(T);
+            }
+            static void write(uint8_t* output, const T& value) noexcept {
+                std::memcpy(output, &value, sizeof(T));
+            }
+            static bool read(const uint8_t* input, size_t size, T& output) noexcept
+            {
+                if (size != sizeof(T)) return false;
+                std::memcpy(&output, input, sizeof(T));
+                return true;
+            }
+        };
+
+        template<>
+        struct field_codec<std::string>
+        {
+            static size_t size(const std::string& value) noexcept {
+                return value.size();
+            }
+            static void write(uint8_t* output, const std::string& value) noexcept {
+                std::memcpy(output, value.data(), value.size());
+            }
+            static bool read(const uint8_t* input, size_t size, std::string& output)
+            {
+                output.assign(reinterpret_cast<const char*>(input), size);
+                return true;
+            }
+        };
+
+        template<typename Func, size_t... Is>
+        error for_each_index(Func&& func, std::index_sequence<Is...>)
+        {
+            error output = error::None;
+            int unused[] = { 0, (output = output != error::None ? output :
+                func(std::integral_constant<size_t, Is>{}), 0)... };
+            (void)unused;
+            return output;
+        }
+
+        /*
+        Invokes func(i) for each i in [0, count), each on its own thread.
+        */
+        template<typename Func>
+        void run_parallel(size_t count, Func&& func)
+        {
+            std::vector<std::thread> workers{};
+            for (size_t i = 1; i < count; i++) {
+                workers.emplace_back([&func, i]() { func(i); });
+            }
+            if (count != 0) func(0);
+            for (auto& worker : workers) worker.join();
+        }
+
+        /*
+        Sorts items using up to the given number of threads, by sorting
+        equal runs concurrently and then merging neighbouring runs, each
+        round of merges also running concurrently.
+        */
+        template<typename T, typename Compare>
+        void parallel_sort(std::vector<T>& items, size_t threads, Compare less)
+        {
+            // Runs shorter than this are not worth a thread
+            constexpr size_t min_run = 4096;
+            size_t runs = std::max<size_t>(1, std::min(threads, items.size() / min_run));
+
+            std::vector<size_t> bounds(runs + 1);
+            for (size_t i = 0; i <= runs; i++) {
+                bounds[i] = items.size() * i / runs;
+            }
+            run_parallel(runs, [&](size_t i) {
+                std::sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less);
+            });
+
+            for (size_t width = 1; width < runs; width *= 2)
+            {
+                run_parallel((runs + width * 2 - 1) / (width * 2), [&](size_t i)
+                {
+                    size_t first = i * width * 2;
+                    size_t middle = std::min(first + width, runs);
+                    size_t last = std::min(first + width * 2, runs);
+                    std::inplace_merge(items.begin() + bounds[first],
+                        items.begin() + bounds[middle], items.begin() + bounds[last], less);
+                });
+            }
+        }
+    }
+
+    template<typename Manager, size_t FieldCount, typename... Indexes>
+    class indexed_heap;
+
+    /*
+    A heap of records with FieldCount fields each, held in a chain of
+    pages of the given page_manager beginning at firstPage, together with
+    secondary indexes on some of those fields. The indexes map field
+    values to record locations and are kept up to date as records are
+    inserted, removed and updated.
+    index<I>().search_range() scans an index without reading the heap, so
+    queries needing only indexed fields are answered from the index alone.
+
+    Records are laid out as read by get_field: the size of each field,
+    followed by the field data. A removed record keeps its slot, so that
+    the locations of later records are unchanged, and has its first field
+    size replaced by removed_size.
+
+    The indexes are held in memory. After reopening a heap, build_indexes()
+    recreates them from its records. An index build may also proceed
+    online, a batch of pages at a time through build_step(), while records
+    continue to be inserted, removed and updated between batches. Changes
+    to records on pages the build has yet to reach are left for it to
+    find; all other changes are held in a side log, replayed once the
+    indexes have been bulk-loaded by finish_build().
+
+    The heap is not thread-safe. Builds read pages on the calling thread,
+    and use worker threads to extract and sort keys.
+    */
+    template<typename pid_type, typename size_type, typename page_intf,
+        size_t FieldCount, typename... Indexes>
+    class indexed_heap<page_manager<pid_type, size_type, page_intf>, FieldCount, Indexes...>
+    {
+        static_assert(FieldCount != 0, "Records must have at least one field");
+
+    public:
+        using record_type = record_index<pid_type, size_type>;
+        using manager_type = page_manager<pid_type, size_type, page_intf>;
+
+        static constexpr const size_type removed_size = std::numeric_limits<size_type>::max();
+
+    private:
+        using pinned_type = typename manager_type::pinned_page;
+        using footer_type = typename manager_type::footer_t;
+        using index_sequence = std::index_sequence_for<Indexes...>;
+
+        template<typename Key>
+        struct change
+        {
+            bool add;
+            Key key;
+            record_type record;
+        };
+
+        using item_lists = std::tuple<
+            std::vector<std::pair<typename Indexes::key_type, record_type>>...>;
+        using change_logs = std::tuple<std::vector<change<typename Indexes::key_type>>...>;
+
+        struct build_state
+        {
+            // Pages of the heap when the build began, in chain order
+            std::vector<pid_type> pages{};
+            size_t next{};
+            std::unordered_set<pid_type> unscanned{};
+
+            // Records from this slot of the last page on were added later
+            pid_type lastPage{};
+            size_type lastRecords{};
+
+            item_lists items{};
+            change_logs log{};
+        };
+
+        manager_type* mgr;
+        pid_type firstPage;
+
+        // Page from which to look for free space
+        pid_type lastPage;
+        size_t _size{};
+
+        std::tuple<typename Indexes::template tree_type<record_type>...> indexes{};
+        std::unique_ptr<build_state> build{};
+
+    public:
+        indexed_heap(manager_type& mgr, pid_type firstPage) noexcept
+            : mgr(&mgr), firstPage(firstPage), lastPage(firstPage) { }
+
+        indexed_heap(const indexed_heap&) = delete;
+        indexed_heap& operator =(const indexed_heap&) = delete;
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        template<size_t I>
+        const auto& index() const noexcept {
+            return std::get<I>(indexes);
+        }
+
+        bool building() const noexcept {
+            return build != nullptr;
+        }
+
+        /*
+        Recreates the indexes from every live record of the heap, using up
+        to the given number of threads.
+        */
+        error build_indexes(size_t threads = 1)
+        {
+            // Number of pages read between each round of extraction
+            constexpr size_t batch_pages = 64;
+
+            error e = begin_build();
+            while (e == error::None)
+            {
+                auto done = build_step(batch_pages * threads, threads);
+                if (!done) e = done.error();
+                else if (done.value()) break;
+            }
+            if (e == error::None) return finish_build(threads);
+            build.reset();
+            return e;
+        }
+
+        /*
+        Begins an online rebuild of the indexes, which are empty until
+        finish_build() is called.
+        */
+        error begin_build()
+        {
+            auto state = std::make_unique<build_state>();
+            pid_type next = firstPage;
+            while (next != 0)
+            {
+                auto ex = mgr->pin_page(next);
+                if (!ex) return ex.error();
+
+                auto footer = read_footer(ex.value().data(), ex.value().size());
+                state->pages.push_back(next);
+                state->unscanned.insert(next);
+                state->lastPage = lastPage = next;
+                state->lastRecords = footer.records;
+                next = footer.next_page;
+            }
+
+            detail::for_each_index([&](auto i) {
+                std::get<decltype(i)::value>(indexes).clear();
+                return error::None;
+            }, index_sequence{});
+            _size = 0;
+            build = std::move(state);
+            return error::None;
+        }
+
+        /*
+        Scans up to the given number of pages for the build in progress,
+        extracting keys from them on up to the given number of threads.
+        Returns true once every page has been scanned.
+        */
+        expected<bool, error> build_step(size_t pages, size_t threads = 1)
+        {
+            if (!build) return unexpected<error>(error::Some);
+
+            // Copy the batch, as the page manager is used by this thread only
+            size_t first = build->next;
+            size_t last = std::min(build->pages.size(), first + pages);
+            std::vector<std::vector<uint8_t>> copies{};
+            for (size_t i = first; i < last; i++)
+            {
+                auto ex = mgr->pin_page(build->pages[i]);
+                if (!ex) return ex.forward_error();
+
+                copies.emplace_back(ex.value().data(), ex.value().data() + ex.value().size());
+                build->unscanned.erase(build->pages[i]);
+            }
+            build->next = last;
+
+            size_t parts = std::max<size_t>(1, std::min(threads, copies.size()));
+            std::vector<item_lists> items(parts);
+            std::vector<size_t> counts(parts);
+            std::vector<error> errors(parts, error::None);
+
+            detail::run_parallel(parts, [&](size_t part)
+            {
+                size_t end = copies.size() * (part + 1) / parts;
+                for (size_t i = copies.size() * part / parts; i < end && errors[part] == error::None; i++)
+                {
+                    errors[part] = extract(copies[i], build->pages[first + i],
+                        items[part], counts[part]);
+                }
+            });
+
+            for (size_t part = 0; part < parts; part++)
+            {
+                if (errors[part] != error::None) return unexpected<error>(errors[part]);
+                detail::for_each_index([&](auto i)
+                {
+                    auto& output = std::get<decltype(i)::value>(build->items);
+                    auto& input = std::get<decltype(i)::value>(items[part]);
+                    output.insert(output.end(), std::make_move_iterator(input.begin()),
+                        std::make_move_iterator(input.end()));
+                    return error::None;
+                }, index_sequence{});
+                _size += counts[part];
+            }
+            return last == build->pages.size();
+        }
+
+        /*
+        Sorts the keys extracted by the build on up to the given number of
+        threads, bulk-loads them into the indexes and replays the changes
+        made since the build began. Fails if a logged removal finds nothing
+        to remove, leaving indexes which must be built again.
+        */
+        error finish_build(size_t threads = 1)
+        {
+            if (!build || build->next != build->pages.size()) return error::Some;
+
+            error e = detail::for_each_index([&](auto i)
+            {
+                auto& items = std::get<decltype(i)::value>(build->items);
+                detail::parallel_sort(items, threads, [](const auto& a, const auto& b) {
+                    return a.first < b.first || (!(b.first < a.first) &&
+                        posting_codec<record_type>::less(a.second, b.second));
+                });
+
+                auto& tree = std::get<decltype(i)::value>(indexes);
+                tree.assign_sorted(items);
+
+                // Only changes to scanned or new records are logged, so each
+                // removal finds the record extracted or added before it
+                for (auto& entry : std::get<decltype(i)::value>(build->log))
+                {
+                    if (entry.add) tree.add(std::move(entry.key), entry.record);
+                    else if (!tree.remove(entry.key, entry.record)) return error::Some;
+                }
+                return error::None;
+            }, index_sequence{});
+
+            build.reset();
+            return e;
+        }
+
+        /*
+        Adds a record holding the given field values, in field order.
+        */
+        template<typename... Fields>
+        expected<record_type, error> insert(const Fields&... fields)
+        {
+            static_assert(sizeof...(Fields) == FieldCount, "A value is required for each field");
+
+            auto data = encode(fields...);
+            auto record = add_record(*mgr, lastPage, data.data(), static_cast<size_type>(data.size()));
+            if (!record) return record.forward_error();
+            lastPage = record.value().pageid;
+
+            auto ex = mgr->pin_page(record.value().pageid);
+            if (!ex) return ex.forward_error();
+
+            error e = update_indexes(ex.value(), record.value(), true);
+            if (e != error::None) return unexpected<error>(e);
+            if (!build || logged(record.value())) _size++;
+            return record;
+        }
+
+        error remove(const record_type& record)
+        {
+            auto ex = mgr->pin_page(record.pageid);
+            if (!ex) return ex.error();
+            auto page = std::move(ex.value());
+            if (removed(page, record)) return error::Some;
+
+            // Keys must be read before the record is marked
+            error e = update_indexes(page, record, false);
+            if (e != error::None) return e;
+
+            write_value<size_type>(page.data() + record.offset, size_type{ removed_size });
+            page.mark_dirty();
+            if (!build || logged(record)) _size--;
+            return error::None;
+        }
+
+        /*
+        Replaces the field values of a record, returning its new location.
+        A record whose size is unchanged is rewritten in place, and only
+        the indexes of fields whose values changed are updated.
+        */
+        template<typename... Fields>
+        expected<record_type, error> update(const record_type& record, const Fields&... fields)
+        {
+            static_assert(sizeof...(Fields) == FieldCount, "A value is required for each field");
+
+            auto data = encode(fields...);
+            if (data.size() != record.size)
+            {
+                error e = remove(record);
+                if (e != error::None) return unexpected<error>(e);
+                return insert(fields...);
+            }
+
+            auto ex = mgr->pin_page(record.pageid);
+            if (!ex) return ex.forward_error();
+            auto page = std::move(ex.value());
+            if (removed(page, record)) return unexpected<error>(error::Some);
+
+            // Unindex changed fields, rewrite, then index them again
+            std::vector<uint8_t> old(page.data() + record.offset,
+                page.data() + record.offset + record.size);
+            auto changed = [&](size_t field)
+            {
+                auto before = field_bytes(old.data(), field);
+                auto after = field_bytes(data.data(), field);
+                return before.second != after.second ||
+                    std::memcmp(before.first, after.first, after.second) != 0;
+            };
+
+            error e = update_indexes(page, record, false, changed);
+            if (e != error::None) return unexpected<error>(e);
+
+            std::memcpy(page.data() + record.offset, data.data(), data.size());
+            page.mark_dirty();
+
+            e = update_indexes(page, record, true, changed);
+            if (e != error::None) return unexpected<error>(e);
+            return record;
+        }
+
+        /*
+        Reads the value of a field of a record.
+        */
+        template<typename T>
+        expected<T, error> get(const record_type& record, size_type field)
+        {
+            auto ex = mgr->pin_page(record.pageid);
+            if (!ex) return ex.forward_error();
+            if (removed(ex.value(), record)) return unexpected<error>(error::Some);
+            return read_field<T>(ex.value(), record, field);
+        }
+
+    private:
+        template<typename... Fields>
+        static std::vector<uint8_t> encode(const Fields&... fields)
+        {
+            size_type sizes[] = { static_cast<size_type>(
+                detail::field_codec<Fields>::size(fields))... };
+
+            size_t total = sizeof(sizes);
+            for (auto size : sizes) total += size;
+
+            std::vector<uint8_t> output(total);
+            std::memcpy(output.data(), sizes, sizeof(sizes));
+
+            size_t offset = sizeof(sizes);
+            int unused[] = { 0, (detail::field_codec<Fields>::write(output.data() + offset, fields),
+                offset += detail::field_codec<Fields>::size(fields), 0)... };
+            (void)unused;
+            return output;
+        }
+
+        // Gets the data of a field of an encoded record
+        static std::pair<const uint8_t*, size_type> field_bytes(const uint8_t* data, size_t field)
+        {
+            size_type offset = FieldCount * sizeof(size_type);
+            for (size_t i = 0; i < field; i++) {
+                offset += read_value<size_type>(data + i * sizeof(size_type));
+            }
+            return { data + offset, read_value<size_type>(data + field * sizeof(size_type)) };
+        }
+
+        static bool removed(pinned_type& page, const record_type& record) noexcept {
+            return read_value<size_type>(page.data() + record.offset) == removed_size;
+        }
+
+        static footer_type read_footer(const uint8_t* page, size_t pageSize) noexcept {
+            return read_value<footer_type>(page + pageSize - sizeof(footer_type));
+        }
+
+        /*
+        Gets whether a change to a record during a build must be logged,
+        rather than being found when the build scans the record's page.
+        */
+        bool logged(const record_type& record) const
+        {
+            if (build->unscanned.count(record.pageid) == 0) return true;
+            return record.pageid == build->lastPage && record.slot_index >= build->lastRecords;
+        }
+
+        /*
+        Extracts the keys of each live record of a copy of a page, up to
+        the last record present when the build began.
+        */
+        error extract(const std::vector<uint8_t>& page, pid_type pageid,
+            item_lists& items, size_t& count) const
+        {
+            auto footer = read_footer(page.data(), page.size());
+            size_type records = pageid == build->lastPage ? build->lastRecords : footer.records;
+
+            const uint8_t* sizes = page.data() + page.size() - sizeof(footer_type);
+            size_type offset = 0;
+            for (size_type slot = 0; slot < records; slot++)
+            {
+                sizes -= sizeof(size_type);
+                record_type record{ pageid, slot, offset, read_value<size_type>(sizes) };
+                offset += record.size;
+
+                const uint8_t* data = page.data() + record.offset;
+                if (read_value<size_type>(data) == removed_size) continue;
+                count++;
+
+                error e = detail::for_each_index([&](auto i)
+                {
+                    using index_type = std::tuple_element_t<decltype(i)::value, std::tuple<Indexes...>>;
+                    auto field = field_bytes(data, index_type::field);
+
+                    typename index_type::key_type key{};
+                    if (!detail::field_codec<typename index_type::key_type>::read(
+                        field.first, field.second, key)) return error::Some;
+
+                    std::get<decltype(i)::value>(items).emplace_back(std::move(key), record);
+                    return error::None;
+                }, index_sequence{});
+                if (e != error::None) return e;
+            }
+            return error::None;
+        }
+
+        template<typename T>
+        static expected<T, error> read_field(pinned_type& page, const record_type& record,
+            size_type field)
+        {
+            auto ex = get_field<pid_type, size_type, static_cast<size_type>(FieldCount)>(page, record, field);
+            if (!ex) return ex.forward_error();
+
+            T output{};
+            auto* data = page.data() + record.offset + FieldCount * sizeof(size_type);
+            if (!detail::field_codec<T>::read(data + ex.value().offset, ex.value().size, output)) {
+                return unexpected<error>(error::Some);
+            }
+            return output;
+        }
+
+        error update_indexes(pinned_type& page, const record_type& record, bool add)
+        {
+            return update_indexes(page, record, add, [](size_t) { return true; });
+        }
+
+        /*
+        Adds the record to, or removes it from, each index on a field for
+        which include(field) is true. Every key is read, and every removal
+        found, before any index is changed, so that on failure the indexes
+        are left as they were.
+        */
+        template<typename Func>
+        error update_indexes(pinned_type& page, const record_type& record, bool add,
+            Func&& include)
+        {
+            std::tuple<typename Indexes::key_type...> keys{};
+            error e = detail::for_each_index([&](auto i)
+            {
+                using index_type = std::tuple_element_t<decltype(i)::value, std::tuple<Indexes...>>;
+                static_assert(index_type::field < FieldCount, "Index on a field which does not exist");
+                if (!include(index_type::field)) return error::None;
+
+                auto key = read_field<typename index_type::key_type>(page, record,
+                    static_cast<size_type>(index_type::field));
+                if (!key) return key.error();
+
+                if (!build && !add &&
+                    !std::get<decltype(i)::value>(indexes).contains(key.value(), record)) {
+                    return error::Some;
+                }
+                std::get<decltype(i)::value>(keys) = std::move(key.value());
+                return error::None;
+            }, index_sequence{});
+            if (e != error::None) return e;
+
+            return detail::for_each_index([&](auto i)
+            {
+                using index_type = std::tuple_element_t<decltype(i)::value, std::tuple<Indexes...>>;
+                if (!include(index_type::field)) return error::None;
+
+                // During a build, changes are logged or left for the scan
+                auto& key = std::get<decltype(i)::value>(keys);
+                auto& tree = std::get<decltype(i)::value>(indexes);
+                if (build)
+                {
+                    if (logged(record)) {
+                        std::get<decltype(i)::value>(build->log).push_back(
+                            change<typename index_type::key_type>{ add, std::move(key), record });
+                    }
+                }
+                else if (add) tree.add(std::move(key), record);
+                else if (!tree.remove(key, record)) return error::Some;
+                return error::None;
+            }, index_sequence{});
+        }
+    };
+}
@@ -0,0 +1,573 @@
+/* string_btree.hpp - (c) 2018 James Renwick */
+#pragma once
+#include "btree.hpp"
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+namespace osdb
+{
+    /*
+    A B+ tree with std::string keys whose nodes hold their keys inline.
+    Each node stores the longest prefix common to all of its keys once,
+    followed by the remaining suffix of each key packed into a fixed
+    NodeBytes region. Separators in inner nodes are suffix-truncated to
+    the shortest string that still divides their children, so inner nodes
+    hold little more than the distinguishing bytes of each key.
+
+    Nodes split when they run out of either slots or bytes. Keys may be at
+    most NodeBytes / 4 bytes long.
+    */
+    template<typename Value, size_t Order, size_t LeafSize, size_t NodeBytes = 512>
+    class string_bplus_tree
+    {
+        static_assert(Order % 2 == 0, "Order must be a factor of two");
+        static_assert(LeafSize >= 2, "LeafSize must be at least two");
+        static_assert(NodeBytes >= 16 && NodeBytes <= 0xFFFF,
+            "NodeBytes must be between 16 and 65535");
+
+    public:
+        using key_type = std::string;
+        using value_type = Value;
+
+        class iterator;
+        class iterable;
+
+    private:
+        /*
+        Keys stored as a shared prefix in bytes[0, offsets[0]) followed by
+        the suffix of key i in bytes[offsets[i], offsets[i + 1]).
+        */
+        template<size_t Count>
+        struct packed_keys
+        {
+            std::array<uint16_t, Count + 1> offsets{};
+            size_t count{};
+            std::array<char, NodeBytes> bytes;
+
+            size_t prefix() const noexcept {
+                return offsets[0];
+            }
+
+            size_t used() const noexcept {
+                return offsets[count];
+            }
+
+            std::string key(size_t index) const
+            {
+                std::string output(bytes.data(), prefix());
+                output.append(bytes.data() + offsets[index], offsets[index + 1] - offsets[index]);
+                return output;
+            }
+
+            /*
+            Compares the key against the shared prefix. Returns less than
+            zero if it orders before every key held, greater than zero if
+            after, and zero if it begins with the prefix.
+            */
+            int compare_prefix(const char* key, size_t size) const noexcept
+            {
+                size_t length = std::min(size, prefix());
+                int result = std::memcmp(key, bytes.data(), length);
+                if (result != 0) return result;
+                return size < prefix() ? -1 : 0;
+            }
+
+            int compare_suffix(size_t index, const char* suffix, size_t size) const noexcept
+            {
+                size_t length = offsets[index + 1] - offsets[index];
+                int result = std::memcmp(bytes.data() + offsets[index], suffix,
+                    std::min(length, size));
+                if (result != 0) return result;
+                return length < size ? -1 : (length == size ? 0 : 1);
+            }
+
+            size_t bound(const std::string& key, bool upper) const noexcept
+            {
+                int result = compare_prefix(key.data(), key.size());
+                if (result != 0) return result < 0 ? 0 : count;
+
+                const char* suffix = key.data() + prefix();
+                size_t size = key.size() - prefix();
+
+                size_t first = 0, length = count;
+                while (length != 0)
+                {
+                    size_t half = length / 2;
+                    int order = compare_suffix(first + half, suffix, size);
+                    if (upper ? order <= 0 : order < 0)
+                    {
+                        first += half + 1;
+                        length -= half + 1;
+                    }
+                    else length = half;
+                }
+                return first;
+            }
+
+            /*
+            Inserts a key in place if it shares the prefix and fits.
+            */
+            bool try_insert(size_t index, const std::string& key) noexcept
+            {
+                if (count == Count || compare_prefix(key.data(), key.size()) != 0) return false;
+
+                size_t size = key.size() - prefix();
+                if (size > NodeBytes - used()) return false;
+
+                std::memmove(bytes.data() + offsets[index] + size, bytes.data() + offsets[index],
+                    used() - offsets[index]);
+                std::memcpy(bytes.data() + offsets[index], key.data() + prefix(), size);
+
+                for (size_t i = count + 1; i != index; i--) {
+                    offsets[i] = static_cast<uint16_t>(offsets[i - 1] + size);
+                }
+                count++;
+                return true;
+            }
+
+            static size_t packed_size(const std::string* first, const std::string* last) noexcept
+            {
+                if (first == last) return 0;
+
+                size_t shared = common_prefix(*first, *(last - 1));
+                size_t output = shared;
+                for (; first != last; ++first) output += first->size() - shared;
+                return output;
+            }
+
+            static bool fits(const std::string* first, const std::string* last) noexcept {
+                return static_cast<size_t>(last - first) <= Count && packed_size(first, last) <= NodeBytes;
+            }
+
+            void assign(const std::string* first, const std::string* last) noexcept
+            {
+                size_t shared = first == last ? 0 : common_prefix(*first, *(last - 1));
+                if (shared != 0) std::memcpy(bytes.data(), first->data(), shared);
+
+                count = 0;
+                offsets[0] = static_cast<uint16_t>(shared);
+                for (; first != last; ++first)
+                {
+                    size_t size = first->size() - shared;
+                    std::memcpy(bytes.data() + offsets[count], first->data() + shared, size);
+                    offsets[count + 1] = static_cast<uint16_t>(offsets[count] + size);
+                    count++;
+                }
+            }
+
+            std::vector<std::string> unpack() const
+            {
+                std::vector<std::string> output{};
+                output.reserve(count + 1);
+                for (size_t i = 0; i < count; i++) output.push_back(key(i));
+                return output;
+            }
+        };
+
+        struct node
+        {
+            const bool isLeaf;
+
+            explicit node(bool isLeaf) noexcept
+                : isLeaf(isLeaf) { }
+            virtual ~node() = default;
+        };
+
+        struct leaf : node
+        {
+            packed_keys<LeafSize> keys{};
+            std::array<Value, LeafSize> values{};
+            leaf* rightLeaf{};
+
+            leaf() : node(true) { }
+        };
+
+        struct inner : node
+        {
+            packed_keys<Order> keys{};
+            std::array<std::unique_ptr<node>, Order + 1> children{};
+
+            inner() : node(false) { }
+        };
+
+        // A new right sibling and the separator dividing it from its left
+        struct split_entry
+        {
+            std::string separator;
+            std::unique_ptr<node> sibling;
+        };
+
+        std::unique_ptr<node> root{};
+        size_t _size{};
+        size_t _height{};
+
+    public:
+        static constexpr size_t max_key_size() noexcept {
+            return NodeBytes / 4;
+        }
+
+        constexpr size_t order() const noexcept {
+            return Order;
+        }
+
+        constexpr size_t leaf_size() const noexcept {
+            return LeafSize;
+        }
+
+        size_t height() const noexcept {
+            return _height;
+        }
+
+        size_t size() const noexcept {
+            return _size;
+        }
+
+        /*
+        Adds the key and value. Returns false, without adding them, if the
+        key is longer than max_key_size().
+        */
+        bool add(const std::string& key, Value value) &
+        {
+            if (key.size() > max_key_size()) return false;
+            if (root == nullptr) root = std::make_unique<leaf>();
+
+            auto entries = insert(*root, key, value);
+            while (!entries.empty())
+            {
+                auto output = std::make_unique<inner>();
+                output->children[0] = std::move(root);
+                entries = absorb(*output, 0, entries);
+                root = std::move(output);
+                _height++;
+            }
+            _size++;
+            return true;
+        }
+
+        const value_type* find(const key_type& key) const
+        {
+            auto range = search_range(key, key);
+            auto iter = range.begin();
+            return iter != range.end() ? &iter.value() : nullptr;
+        }
+
+        iterable search_range(range_start = range_start{}, range_end = range_end{},
+            bool = true, bool = true) const &
+        {
+            return iterable(first_position(), last_position());
+        }
+
+        iterable search_range(const key_type& start, range_end = range_end{},
+            bool inclusiveStart = true, bool = true) const &
+        {
+            return iterable(find_position(start, !inclusiveStart), last_position());
+        }
+
+        iterable search_range(range_start, const key_type& end, bool = true,
+            bool inclusiveEnd = true) const &
+        {
+            return iterable(first_position(), find_position(end, inclusiveEnd));
+        }
+
+        iterable search_range(const key_type& start, const key_type& end,
+            bool inclusiveStart = true, bool inclusiveEnd = true) const &
+        {
+            if (end < start || (!(start < end) && !(inclusiveStart && inclusiveEnd))) {
+                return iterable(last_position(), last_position());
+            }
+            return iterable(find_position(start, !inclusiveStart),
+                find_position(end, inclusiveEnd));
+        }
+
+    private:
+        using position = std::pair<const leaf*, size_t>;
+
+        static size_t common_prefix(const std::string& a, const std::string& b) noexcept
+        {
+            size_t length = std::min(a.size(), b.size());
+            size_t i = 0;
+            while (i < length && a[i] == b[i]) i++;
+            return i;
+        }
+
+        /*
+        Gets the shortest prefix of right which orders after left.
+        */
+        static std::string truncate_separator(const std::string& left, const std::string& right)
+        {
+            size_t shared = common_prefix(left, right);
+            return right.substr(0, std::min(shared + 1, right.size()));
+        }
+
+        /*
+        Gets the start of each of the fewest evenly-sized pieces of items
+        whose keys fit in a node. Pieces of inner nodes exclude the
+        separator promoted before each piece.
+        */
+        template<typename Keys>
+        static std::vector<size_t> plan_pieces(const std::vector<std::string>& keys,
+            size_t items, bool promote)
+        {
+            std::vector<size_t> output{};
+            for (size_t parts = 1; ; parts++)
+            {
+                output.clear();
+                bool fits = true;
+                for (size_t part = 0; part < parts && fits; part++)
+                {
+                    size_t begin = items * part / parts;
+                    size_t end = items * (part + 1) / parts;
+                    output.push_back(begin);
+
+                    // Inner pieces of n children hold n - 1 separators
+                    size_t last = promote ? end - 1 : end;
+                    fits = Keys::fits(keys.data() + begin, keys.data() + last);
+                }
+                if (fits) return output;
+            }
+        }
+
+        std::vector<split_entry> insert(node& target, const std::string& key, Value& value)
+        {
+            if (!target.isLeaf)
+            {
+                auto& parent = static_cast<inner&>(target);
+                size_t index = parent.keys.bound(key, true);
+
+                auto entries = insert(*parent.children[index], key, value);
+                if (entries.empty()) return entries;
+                return absorb(parent, index, entries);
+            }
+
+            auto& output = static_cast<leaf&>(target);
+            auto& keys = output.keys;
+            size_t index = keys.bound(key, true);
+
+            if (keys.try_insert(index, key))
+            {
+                std::move_backward(output.values.begin() + index,
+                    output.values.begin() + keys.count - 1, output.values.begin() + keys.count);
+                output.values[index] = std::move(value);
+                return {};
+            }
+
+            // Re-pack the leaf, splitting it if it no longer fits
+            auto unpacked = keys.unpack();
+            unpacked.insert(unpacked.begin() + index, key);
+
+            std::vector<Value> values{};
+            values.reserve(unpacked.size());
+            for (size_t i = 0; i < index; i++) values.push_back(std::move(output.values[i]));
+            values.push_back(std::move(value));
+            for (size_t i = index; i < keys.count; i++) values.push_back(std::move(output.values[i]));
+
+            auto pieces = plan_pieces<packed_keys<LeafSize>>(unpacked, unpacked.size(), false);
+            pieces.push_back(unpacked.size());
+
+            std::vector<split_entry> entries{};
+            leaf* previous = &output;
+            for (size_t part = 0; part + 1 < pieces.size(); part++)
+            {
+                size_t begin = pieces[part], end = pieces[part + 1];
+                leaf* current = &output;
+
+                if (part != 0)
+                {
+                    auto sibling = std::make_unique<leaf>();
+                    current = sibling.get();
+                    current->rightLeaf = previous->rightLeaf;
+                    previous->rightLeaf = current;
+                    entries.push_back(split_entry{ truncate_separator(
+                        unpacked[begin - 1], unpacked[begin]), std::move(sibling) });
+                }
+
+                current->keys.assign(unpacked.data() + begin, unpacked.data() + end);
+                for (size_t i = begin; i < end; i++) {
+                    current->values[i - begin] = std::move(values[i]);
+                }
+                previous = current;
+            }
+            return entries;
+        }
+
+        /*
+        Inserts new siblings of parent.children[index] after it, returning
+        any new siblings of parent itself.
+        */
+        std::vector<split_entry> absorb(inner& parent, size_t index,
+            std::vector<split_entry>& entries)
+        {
+            auto& keys = parent.keys;
+            if (entries.size() == 1 && keys.try_insert(index, entries[0].separator))
+            {
+                std::move_backward(parent.children.begin() + index + 1,
+                    parent.children.begin() + keys.count, parent.children.begin() + keys.count + 1);
+                parent.children[index + 1] = std::move(entries[0].sibling);
+                return {};
+            }
+
+            auto unpacked = keys.unpack();
+            std::vector<std::unique_ptr<node>> children{};
+            for (size_t i = 0; i <= keys.count; i++) children.push_back(std::move(parent.children[i]));
+
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                unpacked.insert(unpacked.begin() + index + i, std::move(entries[i].separator));
+                children.insert(children.begin() + index + 1 + i, std::move(entries[i].sibling));
+            }
+
+            auto pieces = plan_pieces<packed_keys<Order>>(unpacked, children.size(), true);
+            pieces.push_back(children.size());
+
+            std::vector<split_entry> output{};
+            for (size_t part = 0; part + 1 < pieces.size(); part++)
+            {
+                size_t begin = pieces[part], end = pieces[part + 1];
+                inner* current = &parent;
+
+                if (part != 0)
+                {
+                    auto sibling = std::make_unique<inner>();
+                    current = sibling.get();
+                    output.push_back(split_entry{ std::move(unpacked[begin - 1]), std::move(sibling) });
+                }
+
+                current->keys.assign(unpacked.data() + begin, unpacked.data() + end - 1);
+                for (size_t i = begin; i < end; i++) {
+                    current->children[i - begin] = std::move(children[i]);
+                }
+            }
+            return output;
+        }
+
+        position normalize(const leaf* current, size_t index) const noexcept
+        {
+            if (index == current->keys.count && current->rightLeaf != nullptr) {
+                return position(current->rightLeaf, 0);
+            }
+            return position(current, index);
+        }
+
+        position first_position() const noexcept
+        {
+            if (root == nullptr) return position(nullptr, 0);
+
+            const node* current = root.get();
+            while (!current->isLeaf) {
+                current = static_cast<const inner&>(*current).children[0].get();
+            }
+            return normalize(static_cast<const leaf*>(current), 0);
+        }
+
+        position last_position() const noexcept
+        {
+            if (root == nullptr) return position(nullptr, 0);
+
+            const node* current = root.get();
+            while (!current->isLeaf)
+            {
+                auto& parent = static_cast<const inner&>(*current);
+                current = parent.children[parent.keys.count].get();
+            }
+            auto& output = static_cast<const leaf&>(*current);
+            return position(&output, output.keys.count);
+        }
+
+        /*
+        Finds the first item not less than (or, if upper, greater than) key.
+        */
+        position find_position(const std::string& key, bool upper) const noexcept
+        {
+            if (root == nullptr) return position(nullptr, 0);
+
+            const node* current = root.get();
+            while (!current->isLeaf)
+            {
+                auto& parent = static_cast<const inner&>(*current);
+                current = parent.children[parent.keys.bound(key, upper)].get();
+            }
+
+            auto* output = static_cast<const leaf*>(current);
+            size_t index = output->keys.bound(key, upper);
+            while (index == output->keys.count && output->rightLeaf != nullptr)
+            {
+                output = output->rightLeaf;
+                index = output->keys.bound(key, upper);
+            }
+            return position(output, index);
+        }
+
+    public:
+        class iterator
+        {
+            friend iterable;
+
+            const leaf* current;
+            size_t index;
+
+            explicit iterator(position at) noexcept
+                : current(at.first), index(at.second) { }
+
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::pair<std::string, const Value&>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = void;
+            using reference = value_type;
+
+            std::string key() const {
+                return current->keys.key(index);
+            }
+
+            const Value& value() const noexcept {
+                return current->values[index];
+            }
+
+            value_type operator *() const {
+                return value_type(key(), value());
+            }
+
+            bool operator ==(const iterator& other) const noexcept {
+                return current == other.current && index == other.index;
+            }
+            bool operator !=(const iterator& other) const noexcept {
+                return !(operator ==(other));
+            }
+
+            iterator& operator ++() noexcept
+            {
+                if (++index == current->keys.count && current->rightLeaf != nullptr)
+                {
+                    current = current->rightLeaf;
+                    index = 0;
+                }
+                return *this;
+            }
+        };
+
+        class iterable
+        {
+            friend string_bplus_tree;
+
+            position first;
+            position last;
+
+            iterable(position first, position last) noexcept
+                : first(first), last(last) { }
+
+        public:
+            iterator begin() const noexcept {
+                return iterator(first);
+            }
+            iterator end() const noexcept {
+                return iterator(last);
+            }
+        };
+    };
+}
@@ -0,0 +1,118 @@
+/* art-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <art.hpp>
+#include <string>
+#include <vector>
+
+using T1 = int;
+
+TEST_SUITE(RadixTreeSuite);
+
+TEST(RadixTreeSuite, EmptyTest)
+{
+    osdb::radix_tree<T1, T1> tree{};
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_EQ(tree.find(0), nullptr);
+
+    for (auto& pair : tree.search_range()) {
+        (void)pair; ASSERT(false);
+    }
+    for (auto& pair : tree.search_range(0, 0)) {
+        (void)pair; ASSERT(false);
+    }
+}
+
+TEST(RadixTreeSuite, AddManySearch)
+{
+    constexpr const T1 count = 1000;
+    osdb::radix_tree<T1, T1> tree{};
+
+    // Negative and widely spaced keys exercise every node size
+    for (T1 i = 0; i < count; i++) {
+        tree.add(((i * 37) % count - count / 2) * 1031, i);
+    }
+    EXPECT_EQ(tree.size(), count);
+
+    T1 expected = -count / 2;
+    for (auto& pair : tree.search_range())
+    {
+        ASSERT_LT(expected, count / 2);
+        EXPECT_EQ(pair.first, expected * 1031);
+        ++expected;
+    }
+    EXPECT_EQ(expected, count / 2);
+
+    expected = 101;
+    for (auto& pair : tree.search_range(100 * 1031, 200 * 1031, false, true))
+    {
+        ASSERT_LT(expected, 201);
+        EXPECT_EQ(pair.first, expected * 1031);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 201);
+
+    expected = -count / 2;
+    for (auto& pair : tree.search_range(osdb::range_start{}, -5, true, false))
+    {
+        EXPECT_EQ(pair.first, expected * 1031);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 0);
+
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* value = tree.find(((i * 37) % count - count / 2) * 1031);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i);
+    }
+    EXPECT_EQ(tree.find(1), nullptr);
+}
+
+TEST(RadixTreeSuite, SearchSame)
+{
+    osdb::radix_tree<T1, T1> tree{};
+    for (T1 i = 0; i < 30; i++) {
+        tree.add(i % 3, i);
+    }
+
+    T1 expected = 1;
+    for (auto& pair : tree.search_range(1, 1))
+    {
+        EXPECT_EQ(pair.first, 1);
+        EXPECT_EQ(pair.second, expected);
+        expected += 3;
+    }
+    EXPECT_EQ(expected, 31);
+}
+
+TEST(RadixTreeSuite, StringKeys)
+{
+    osdb::radix_tree<std::string, T1> tree{};
+    std::vector<std::string> keys{ "", std::string("\0", 1), "a", std::string("a\0", 2),
+        "ab", "abc", "abd", "b", "ba" };
+
+    for (size_t i = keys.size(); i != 0; i--) {
+        tree.add(keys[i - 1], static_cast<T1>(i - 1));
+    }
+
+    size_t index = 0;
+    for (auto& pair : tree.search_range())
+    {
+        ASSERT_LT(index, keys.size());
+        EXPECT_EQ(pair.first, keys[index]);
+        EXPECT_EQ(pair.second, index);
+        index++;
+    }
+    EXPECT_EQ(index, keys.size());
+
+    index = 4;
+    for (auto& pair : tree.search_range(std::string("a\0", 2), "b", false, false))
+    {
+        EXPECT_EQ(pair.first, keys[index]);
+        index++;
+    }
+    EXPECT_EQ(index, 7);
+
+    EXPECT_NEQ(tree.find("abd"), nullptr);
+    EXPECT_EQ(tree.find("abe"), nullptr);
+}
@@ -0,0 +1,127 @@
+/* betree-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <betree.hpp>
+#include <btree.hpp>
+#include <random>
+
+using T1 = int;
+
+TEST_SUITE(BufferedBtreeSuite);
+
+TEST(BufferedBtreeSuite, EmptyTest)
+{
+    osdb::buffered_bplus_tree<T1, T1, 4, 8, 16> tree{};
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_EQ(tree.height(), 0);
+    EXPECT_EQ(tree.find(0), nullptr);
+
+    for (auto& pair : tree.search_range()) {
+        (void)pair; ASSERT(false);
+    }
+    for (auto& pair : tree.search_range(0, 0)) {
+        (void)pair; ASSERT(false);
+    }
+    tree.flush_all();
+}
+
+TEST(BufferedBtreeSuite, AddManySearch)
+{
+    constexpr const T1 count = 1000;
+
+    osdb::buffered_bplus_tree<T1, T1, 4, 8, 16> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_GT(tree.height(), 0);
+
+    // Twice, so that both pending and flushed items are searched
+    for (int pass = 0; pass < 2; pass++)
+    {
+        T1 expected = 0;
+        for (auto& pair : tree.search_range())
+        {
+            ASSERT_LT(expected, count);
+            EXPECT_EQ(pair.first, expected);
+            EXPECT_EQ((pair.second * 37) % count, expected);
+            ++expected;
+        }
+        EXPECT_EQ(expected, count);
+
+        expected = 101;
+        for (auto& pair : tree.search_range(100, 200, false, true))
+        {
+            ASSERT_LT(expected, 201);
+            EXPECT_EQ(pair.first, expected);
+            ++expected;
+        }
+        EXPECT_EQ(expected, 201);
+
+        expected = 0;
+        for (auto& pair : tree.search_range(osdb::range_start{}, 50, true, false))
+        {
+            ASSERT_LT(expected, 50);
+            EXPECT_EQ(pair.first, expected);
+            ++expected;
+        }
+        EXPECT_EQ(expected, 50);
+
+        for (T1 i = 0; i < count; i++)
+        {
+            auto* value = tree.find(i);
+            ASSERT_NEQ(value, nullptr);
+            EXPECT_EQ((*value * 37) % count, i);
+        }
+        EXPECT_EQ(tree.find(count), nullptr);
+
+        tree.flush_all();
+    }
+}
+
+TEST(BufferedBtreeSuite, AddManySame)
+{
+    constexpr const T1 count = 300;
+
+    osdb::buffered_bplus_tree<T1, T1, 4, 8, 16> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i % 3, i);
+    }
+
+    size_t found = 0;
+    for (auto& pair : tree.search_range(1, 1))
+    {
+        EXPECT_EQ(pair.first, 1);
+        EXPECT_EQ(pair.second % 3, 1);
+        found++;
+    }
+    EXPECT_EQ(found, count / 3);
+
+    found = 0;
+    for (auto& pair : tree.search_range(0, 2, false, false))
+    {
+        EXPECT_EQ(pair.first, 1);
+        found++;
+    }
+    EXPECT_EQ(found, count / 3);
+}
+
+TEST(BufferedBtreeSuite, BatchedLeafWrites)
+{
+    constexpr const T1 count = 4096;
+
+    osdb::buffered_bplus_tree<T1, T1, 8, 32, 256> tree{};
+    osdb::bplus_tree<T1, T1, 8, 32> plain{};
+    std::mt19937 random(7);
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = static_cast<T1>(random() % (count * 4));
+        tree.add(key, i);
+        plain.add(key, i);
+    }
+    tree.flush_all();
+
+    // Counted as leaf_writes() does, a plain tree writes one leaf per add
+    // and one more for each leaf split off
+    size_t plainWrites = static_cast<size_t>(count) + plain.stats().leaves - 1;
+    EXPECT_LT(tree.leaf_writes() * 10, plainWrites);
+}
@@ -328,3 +328,631 @@ TEST(BtreeSuite, FillLeafSameScan)
     }
     EXPECT_EQ(count, leafSize);
 }
+
+TEST(BtreeSuite, AddManySplit)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_GT(tree.height(), 0);
+
+    T1 expected = 0;
+    for (auto& pair : tree.search_range())
+    {
+        ASSERT_LT(expected, count);
+        EXPECT_EQ(pair.first, expected);
+        EXPECT_EQ((pair.second * 37) % count, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, count);
+
+    expected = 50;
+    for (auto& pair : tree.search_range(50, 99))
+    {
+        ASSERT_LT(expected, 100);
+        EXPECT_EQ(pair.first, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 100);
+
+    expected = 51;
+    for (auto& pair : tree.search_range(50, 99, false, false))
+    {
+        ASSERT_LT(expected, 99);
+        EXPECT_EQ(pair.first, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 99);
+
+    for (auto& pair : tree.search_range(count)) {
+        (void)pair; ASSERT(false);
+    }
+}
+
+TEST(BtreeSuite, AddManySame)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 key{0x5AD};
+    constexpr const size_t count = 100;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    for (size_t i = 0; i < count; i++)
+    {
+        tree.add(key - 1, 0);
+        tree.add(key, 1);
+        tree.add(key + 1, 2);
+    }
+    EXPECT_GT(tree.height(), 0);
+
+    size_t found = 0;
+    for (auto& pair : tree.search_range(key, key))
+    {
+        ASSERT_LT(found, count);
+        EXPECT_EQ(pair.first, key);
+        EXPECT_EQ(pair.second, 1);
+        ++found;
+    }
+    EXPECT_EQ(found, count);
+}
+
+TEST(BtreeSuite, Find)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    EXPECT_EQ(tree.find(0), nullptr);
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i * 2, i);
+    }
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* value = tree.find(i * 2);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i);
+        EXPECT_EQ(tree.find(i * 2 + 1), nullptr);
+    }
+    EXPECT_EQ(tree.find(-1), nullptr);
+}
+
+TEST(BtreeSuite, FindBatch)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    EXPECT_EQ(tree.find_batch(std::vector<T1>{0, 1}).size(), 2);
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i * 2, i);
+    }
+
+    std::vector<T1> keys{};
+    for (T1 i = count * 2; i != -2; i--) {
+        keys.push_back(i);
+    }
+    auto values = tree.find_batch(keys);
+    ASSERT_EQ(values.size(), keys.size());
+
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        if (keys[i] % 2 != 0 || keys[i] >= count * 2) {
+            EXPECT_EQ(values[i], nullptr);
+        }
+        else
+        {
+            ASSERT_NEQ(values[i], nullptr);
+            EXPECT_EQ(*values[i], keys[i] / 2);
+        }
+    }
+}
+
+TEST(BtreeSuite, Scan)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    std::vector<T1> keys{};
+    tree.search_range().scan([&](auto& pair) { keys.push_back(pair.first); });
+    EXPECT(keys.empty());
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    tree.search_range().scan([&](auto& pair) { keys.push_back(pair.first); });
+    ASSERT_EQ(keys.size(), count);
+    for (T1 i = 0; i < count; i++) {
+        EXPECT_EQ(keys[i], i);
+    }
+
+    keys.clear();
+    tree.search_range(50, 149, false).scan([&](auto& pair) {
+        keys.push_back(pair.first);
+    });
+    ASSERT_EQ(keys.size(), 99);
+    for (T1 i = 0; i < 99; i++) {
+        EXPECT_EQ(keys[i], i + 51);
+    }
+}
+
+TEST(BtreeSuite, ScanLeaves)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    std::vector<size_t> sizes{};
+    std::vector<T1> keys{};
+    tree.search_range(20, 179).scan_leaves([&](auto span)
+    {
+        sizes.push_back(span.size());
+        for (auto& pair : span) keys.push_back(pair.first);
+    });
+
+    EXPECT_GT(sizes.size(), 160 / leafSize - 1);
+    for (auto size : sizes) {
+        EXPECT(size != 0 && size <= leafSize);
+    }
+    ASSERT_EQ(keys.size(), 160);
+    for (T1 i = 0; i < 160; i++) {
+        EXPECT_EQ(keys[i], i + 20);
+    }
+}
+
+TEST(BtreeSuite, PartitionRange)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 1000;
+    constexpr const size_t parts = 4;
+
+    osdb::bplus_tree<T1, T1, order, leafSize> tree{};
+    EXPECT_EQ(tree.partition_range(parts).size(), 1);
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    auto partitions = tree.partition_range(parts);
+    EXPECT_EQ(partitions.size(), parts);
+
+    T1 expected = 0;
+    for (auto& partition : partitions)
+    {
+        size_t size = 0;
+        for (auto& pair : partition)
+        {
+            ASSERT_LT(expected, count);
+            EXPECT_EQ(pair.first, expected);
+            ++expected;
+            ++size;
+        }
+        EXPECT_GT(size, count / parts / 4);
+    }
+    EXPECT_EQ(expected, count);
+
+    partitions = tree.partition_range(parts, 100, 200, false, true);
+    EXPECT_GT(partitions.size(), 1);
+    EXPECT(partitions.size() <= parts);
+
+    expected = 101;
+    for (auto& partition : partitions)
+    {
+        for (auto& pair : partition)
+        {
+            ASSERT_LT(expected, 201);
+            EXPECT_EQ(pair.first, expected);
+            ++expected;
+        }
+    }
+    EXPECT_EQ(expected, 201);
+}
+
+TEST(BtreeSuite, CountedRank)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 500;
+
+    osdb::bplus_tree<T1, T1, order, leafSize, true> tree{};
+    EXPECT_EQ(tree.rank(0), 0);
+    EXPECT_EQ(tree.select(0), nullptr);
+
+    // Add each even key twice
+    for (T1 i = 0; i < count; i++)
+    {
+        tree.add(((i * 37) % count) * 2, i);
+        tree.add(((i * 37) % count) * 2, i);
+    }
+    EXPECT_GT(tree.height(), 0);
+
+    for (T1 i = 0; i < count; i++)
+    {
+        EXPECT_EQ(tree.rank(i * 2), static_cast<size_t>(i * 2));
+        EXPECT_EQ(tree.rank(i * 2, true), static_cast<size_t>(i * 2 + 2));
+        EXPECT_EQ(tree.rank(i * 2 + 1), static_cast<size_t>(i * 2 + 2));
+    }
+    EXPECT_EQ(tree.rank(-1), 0);
+    EXPECT_EQ(tree.rank(count * 2), tree.size());
+}
+
+TEST(BtreeSuite, CountedSelect)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 500;
+
+    osdb::bplus_tree<T1, T1, order, leafSize, true> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* pair = tree.select(static_cast<size_t>(i));
+        ASSERT_NEQ(pair, nullptr);
+        EXPECT_EQ(pair->first, i);
+    }
+    EXPECT_EQ(tree.select(count), nullptr);
+}
+
+TEST(BtreeSuite, CountedCountRange)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 500;
+
+    osdb::bplus_tree<T1, T1, order, leafSize, true> tree{};
+    EXPECT_EQ(tree.count_range(0, count), 0);
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    EXPECT_EQ(tree.count_range(0, count), count);
+    EXPECT_EQ(tree.count_range(100, 199), 100);
+    EXPECT_EQ(tree.count_range(100, 199, false), 99);
+    EXPECT_EQ(tree.count_range(100, 199, false, false), 98);
+    EXPECT_EQ(tree.count_range(100, 100), 1);
+    EXPECT_EQ(tree.count_range(100, 100, true, false), 0);
+    EXPECT_EQ(tree.count_range(200, 100), 0);
+}
+
+TEST(BtreeSuite, InterpolationSearch)
+{
+    constexpr const size_t order = 8;
+    constexpr const size_t leafSize = 16;
+    constexpr const T1 count = 2000;
+
+    osdb::bplus_tree<T1, T1, order, leafSize, false,
+        osdb::interpolation_search_policy> tree{};
+    EXPECT_EQ(tree.find(0), nullptr);
+
+    // Mix evenly spaced, clustered and repeated keys
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = i < count / 2 ? ((i * 37) % (count / 2)) * 10 : i * i;
+        tree.add(key, i);
+        if (i % 10 == 0) tree.add(key, -i);
+    }
+
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = i < count / 2 ? ((i * 37) % (count / 2)) * 10 : i * i;
+        auto* value = tree.find(key);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i);
+        if (i < count / 2) EXPECT_EQ(tree.find(key + 1), nullptr);
+    }
+    EXPECT_EQ(tree.find(-1), nullptr);
+
+    T1 expected = 101;
+    for (auto& pair : tree.search_range(1000, 2000, false, true))
+    {
+        EXPECT_EQ(pair.first, expected * 10);
+        if (expected % 10 != 0 || pair.second < 0) expected++;
+    }
+    EXPECT_EQ(expected, 201);
+}
+
+TEST(BtreeSuite, AssignSorted)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+
+    for (T1 count : { 0, 1, 8, 9, 45, 1000 })
+    {
+        std::vector<std::pair<T1, T1>> items{};
+        for (T1 i = 0; i < count; i++) {
+            items.emplace_back(i * 2, i);
+        }
+
+        osdb::bplus_tree<T1, T1, order, leafSize, true> tree{};
+        tree.add(-5, 0);
+        tree.assign_sorted(items);
+        EXPECT_EQ(tree.size(), count);
+        EXPECT_EQ(tree.find(-5), nullptr);
+
+        // The built tree must accept further inserts between its items
+        for (T1 i = 0; i < count; i++) {
+            tree.add(i * 2 + 1, -i);
+        }
+
+        T1 expected = 0;
+        for (auto& pair : tree.search_range())
+        {
+            EXPECT_EQ(pair.first, expected);
+            EXPECT_EQ(pair.second, expected % 2 == 0 ? expected / 2 : -(expected / 2));
+            expected++;
+        }
+        EXPECT_EQ(expected, count * 2);
+
+        for (T1 i = 0; i < count * 2; i += 7)
+        {
+            EXPECT_EQ(tree.rank(i), i);
+            ASSERT_NEQ(tree.select(i), nullptr);
+            EXPECT_EQ(tree.select(i)->first, i);
+        }
+    }
+}
+
+#include <memory>
+
+// A value that cannot be default-constructed and counts its moves
+struct counted_value
+{
+    static size_t moves;
+    T1 value;
+
+    explicit counted_value(T1 value) noexcept : value(value) { }
+    counted_value(counted_value&& other) noexcept : value(other.value) {
+        moves++;
+    }
+    counted_value& operator =(counted_value&& other) noexcept
+    {
+        value = other.value;
+        moves++;
+        return *this;
+    }
+};
+size_t counted_value::moves = 0;
+
+TEST(BtreeSuite, EmplaceMoveOnly)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 500;
+
+    osdb::bplus_tree<T1, std::unique_ptr<T1>, order, leafSize> tree{};
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = (i * 37) % count;
+        auto value = tree.emplace(key, new T1(key));
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(**value, key);
+    }
+    tree.add(count, std::unique_ptr<T1>(new T1(count)));
+
+    T1 expected = 0;
+    for (auto& pair : tree.search_range())
+    {
+        EXPECT_EQ(pair.first, expected);
+        EXPECT_EQ(*pair.second, expected);
+        expected++;
+    }
+    EXPECT_EQ(expected, count + 1);
+}
+
+TEST(BtreeSuite, EmplaceInPlace)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+
+    osdb::bplus_tree<T1, counted_value, order, leafSize> tree{};
+
+    // Appending in order never shifts items, so nothing is moved
+    // but the halves of split leaves
+    counted_value::moves = 0;
+    for (T1 i = 0; i < 4; i++) {
+        EXPECT_EQ(tree.emplace(i, i * 10)->value, i * 10);
+    }
+    EXPECT_EQ(counted_value::moves, 0);
+
+    auto added = tree.try_emplace(1, 99);
+    EXPECT(!added.second);
+    EXPECT_EQ(added.first->value, 10);
+
+    added = tree.try_emplace(7, 70);
+    EXPECT(added.second);
+    EXPECT_EQ(added.first->value, 70);
+    EXPECT_EQ(counted_value::moves, 0);
+
+    auto assigned = tree.insert_or_assign(2, counted_value(22));
+    EXPECT(!assigned.second);
+    EXPECT_EQ(assigned.first->value, 22);
+    EXPECT_EQ(counted_value::moves, 1);
+
+    assigned = tree.insert_or_assign(9, counted_value(90));
+    EXPECT(assigned.second);
+    EXPECT_EQ(tree.find(9)->value, 90);
+    EXPECT_EQ(counted_value::moves, 2);
+
+    EXPECT_EQ(tree.size(), 6);
+    for (T1 i = 100; i < 200; i++) {
+        tree.emplace(i, i);
+    }
+    for (T1 i = 100; i < 200; i++) {
+        EXPECT_EQ(tree.find(i)->value, i);
+    }
+}
+
+TEST(BtreeSuite, Merge)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    using tree_type = osdb::bplus_tree<T1, T1, order, leafSize, true>;
+
+    // Interleaved, disjoint after, disjoint before, and either side empty
+    struct { T1 start, step, otherStart, otherStep, count, otherCount; } cases[] = {
+        { 0, 2, 1, 2, 300, 300 },
+        { 0, 1, 1000, 1, 300, 50 },
+        { 1000, 1, 0, 1, 300, 50 },
+        { 0, 1, 0, 1, 0, 100 },
+        { 0, 1, 0, 1, 100, 0 },
+        { 0, 3, 0, 5, 200, 200 },
+    };
+
+    for (auto& test : cases)
+    {
+        tree_type tree{};
+        tree_type other{};
+        std::vector<std::pair<T1, T1>> expected{};
+        for (T1 i = 0; i < test.count; i++)
+        {
+            tree.add(test.start + i * test.step, 1);
+            expected.emplace_back(test.start + i * test.step, 1);
+        }
+        for (T1 i = test.otherCount; i != 0; i--)
+        {
+            other.add(test.otherStart + (i - 1) * test.otherStep, 2);
+            expected.emplace_back(test.otherStart + (i - 1) * test.otherStep, 2);
+        }
+        // Items of the tree merged into come first among equal keys
+        std::sort(expected.begin(), expected.end(),
+            [](const std::pair<T1, T1>& a, const std::pair<T1, T1>& b) {
+                return a.first < b.first || (a.first == b.first && a.second < b.second);
+            });
+
+        tree.merge(other);
+        EXPECT_EQ(other.size(), 0);
+        EXPECT_EQ(tree.size(), expected.size());
+
+        size_t i = 0;
+        for (auto& pair : tree.search_range())
+        {
+            ASSERT(i < expected.size());
+            EXPECT_EQ(pair.first, expected[i].first);
+            EXPECT_EQ(pair.second, expected[i].second);
+            i++;
+        }
+        EXPECT_EQ(i, expected.size());
+
+        for (i = 0; i < expected.size(); i += 5)
+        {
+            EXPECT_EQ(tree.select(i)->first, expected[i].first);
+            EXPECT_EQ(tree.rank(expected[i].first, true) - 1,
+                std::upper_bound(expected.begin(), expected.end(), expected[i],
+                    [](const std::pair<T1, T1>& a, const std::pair<T1, T1>& b) {
+                        return a.first < b.first;
+                    }) - expected.begin() - 1);
+        }
+
+        // Both trees remain usable
+        tree.add(-1, 0);
+        other.add(5, 5);
+        EXPECT_EQ(tree.find(-1) != nullptr, true);
+        EXPECT_EQ(*other.find(5), 5);
+    }
+}
+
+TEST(BtreeSuite, Stats)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    using tree_type = osdb::bplus_tree<T1, T1, order, leafSize>;
+
+    tree_type tree{};
+    auto stats = tree.stats();
+    EXPECT_EQ(stats.items, 0);
+    EXPECT_EQ(stats.nodes, 1);
+    EXPECT_EQ(stats.leaves, 0);
+    EXPECT_EQ(stats.bytes, 0);
+    EXPECT_EQ(stats.levels.size(), 2);
+
+    for (T1 i = 0; i < 1000; i++) {
+        tree.add((i * 37) % 1000, i);
+    }
+    stats = tree.stats();
+    EXPECT_EQ(stats.items, 1000);
+    EXPECT_EQ(stats.levels.size(), tree.height() + 2);
+    EXPECT_EQ(stats.levels.front(), 1);
+    EXPECT_EQ(stats.levels.back(), stats.leaves);
+
+    size_t nodes = 0;
+    for (size_t i = 0; i + 1 < stats.levels.size(); i++) {
+        nodes += stats.levels[i];
+    }
+    EXPECT_EQ(stats.nodes, nodes);
+
+    size_t leaves = 0;
+    tree.search_range().scan_leaves([&](const auto&) { leaves++; });
+    EXPECT_EQ(stats.leaves, leaves);
+    EXPECT(stats.leafFill > 0.5 && stats.leafFill <= 1.0);
+    EXPECT(stats.nodeFill > 0.0 && stats.nodeFill <= 1.0);
+    EXPECT(stats.bytes > stats.leaves * leafSize * sizeof(std::pair<T1, T1>));
+
+    // A bulk-built tree packs its leaves
+    tree_type packed{};
+    std::vector<std::pair<T1, T1>> items{};
+    for (T1 i = 0; i < 1000; i++) items.emplace_back(i, i);
+    packed.assign_sorted(items);
+    stats = packed.stats();
+    EXPECT_EQ(stats.leaves, 1000 / leafSize);
+    EXPECT_EQ(stats.leafFill, 1.0);
+}
+
+// Checks that the largest fan-out that fits the target is chosen
+template<typename Key, typename Value, size_t TargetBytes, bool Counted>
+static bool fanout_fits()
+{
+    using fanout = osdb::bplus_fanout<Key, Value, TargetBytes, Counted>;
+    using node = osdb::bplus_node<Key, Value, fanout::order, fanout::leaf_size, Counted>;
+    using leaf = osdb::bplus_leaf<Key, Value, fanout::order, fanout::leaf_size, Counted>;
+    using larger_node = osdb::bplus_node<Key, Value, fanout::order + 2, fanout::leaf_size, Counted>;
+    using larger_leaf = osdb::bplus_leaf<Key, Value, fanout::order, fanout::leaf_size + 1, Counted>;
+
+    return sizeof(node) <= TargetBytes && sizeof(leaf) <= TargetBytes &&
+        sizeof(larger_node) > TargetBytes && sizeof(larger_leaf) > TargetBytes;
+}
+
+TEST(BtreeSuite, FanoutForTarget)
+{
+    EXPECT((fanout_fits<uint64_t, uint64_t, 256, false>()));
+    EXPECT((fanout_fits<uint64_t, uint64_t, 4096, false>()));
+    EXPECT((fanout_fits<uint64_t, uint64_t, 4096, true>()));
+    EXPECT((fanout_fits<uint32_t, uint8_t, 512, false>()));
+    EXPECT((fanout_fits<uint16_t, uint64_t, 1024, true>()));
+
+    // Too small a target falls back to the smallest valid tree
+    using tiny = osdb::bplus_fanout<uint64_t, uint64_t, 16>;
+    EXPECT_EQ(tiny::order, 2);
+    EXPECT_EQ(tiny::leaf_size, 2);
+
+    using page_fanout = osdb::bplus_fanout<uint64_t, uint64_t, 4096>;
+    osdb::bplus_tree_for<uint64_t, uint64_t, 4096> tree{};
+    EXPECT_EQ(tree.order(), page_fanout::order);
+    EXPECT_EQ(tree.leaf_size(), page_fanout::leaf_size);
+    for (uint64_t i = 0; i < 10000; i++) {
+        tree.add((i * 7919) % 10000, i);
+    }
+    EXPECT_EQ(tree.size(), 10000);
+    EXPECT_EQ(*tree.find(7919), 1);
+}
@@ -0,0 +1,241 @@
+/* cow-btree-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <cow_btree.hpp>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+using T1 = int;
+
+TEST_SUITE(CowBtreeSuite);
+
+TEST(CowBtreeSuite, EmptyTest)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+
+    osdb::cow_bplus_tree<T1, T1, order, leafSize> tree{};
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_EQ(tree.height(), 0);
+
+    auto view = tree.snapshot();
+    EXPECT_EQ(view.size(), 0);
+    EXPECT_EQ(view.find(0), nullptr);
+
+    for (auto& pair : view.search_range()) {
+        (void)pair; ASSERT(false);
+    }
+    for (auto& pair : view.search_range(0, 0)) {
+        (void)pair; ASSERT(false);
+    }
+}
+
+TEST(CowBtreeSuite, AddManySearch)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 500;
+
+    osdb::cow_bplus_tree<T1, T1, order, leafSize> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_GT(tree.height(), 0);
+
+    auto view = tree.snapshot();
+    T1 expected = 0;
+    for (auto& pair : view.search_range())
+    {
+        ASSERT_LT(expected, count);
+        EXPECT_EQ(pair.first, expected);
+        EXPECT_EQ((pair.second * 37) % count, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, count);
+
+    expected = 101;
+    for (auto& pair : view.search_range(100, 200, false, true))
+    {
+        ASSERT_LT(expected, 201);
+        EXPECT_EQ(pair.first, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 201);
+
+    expected = 0;
+    for (auto& pair : view.search_range(osdb::range_start{}, 50, true, false))
+    {
+        ASSERT_LT(expected, 50);
+        EXPECT_EQ(pair.first, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, 50);
+
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* value = view.find(i);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ((*value * 37) % count, i);
+    }
+    EXPECT_EQ(view.find(count), nullptr);
+}
+
+TEST(CowBtreeSuite, SearchSame)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 key{0x5AD};
+    constexpr const size_t count = 100;
+
+    osdb::cow_bplus_tree<T1, T1, order, leafSize> tree{};
+    for (size_t i = 0; i < count; i++)
+    {
+        tree.add(key - 1, 0);
+        tree.add(key, 1);
+        tree.add(key + 1, 2);
+    }
+
+    size_t found = 0;
+    for (auto& pair : tree.snapshot().search_range(key, key))
+    {
+        ASSERT_LT(found, count);
+        EXPECT_EQ(pair.first, key);
+        EXPECT_EQ(pair.second, 1);
+        ++found;
+    }
+    EXPECT_EQ(found, count);
+}
+
+TEST(CowBtreeSuite, SnapshotIsolation)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    osdb::cow_bplus_tree<T1, T1, order, leafSize> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i * 2, i);
+    }
+    auto before = tree.snapshot();
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i * 2 + 1, i);
+    }
+    auto after = tree.snapshot();
+
+    EXPECT_EQ(before.size(), count);
+    EXPECT_EQ(after.size(), count * 2);
+
+    T1 expected = 0;
+    for (auto& pair : before.search_range())
+    {
+        ASSERT_LT(expected, count * 2);
+        EXPECT_EQ(pair.first, expected);
+        expected += 2;
+    }
+    EXPECT_EQ(expected, count * 2);
+    EXPECT_EQ(before.find(1), nullptr);
+
+    expected = 0;
+    for (auto& pair : after.search_range())
+    {
+        ASSERT_LT(expected, count * 2);
+        EXPECT_EQ(pair.first, expected);
+        ++expected;
+    }
+    EXPECT_EQ(expected, count * 2);
+    EXPECT_NEQ(after.find(1), nullptr);
+}
+
+TEST(CowBtreeSuite, ConcurrentSnapshots)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 20000;
+    constexpr const size_t readerCount = 3;
+
+    osdb::cow_bplus_tree<T1, T1, order, leafSize> tree{};
+    std::vector<T1> keys(count);
+    for (T1 i = 0; i < count; i++) keys[i] = i;
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(5));
+
+    std::atomic<bool> done{ false };
+    std::atomic<size_t> failures{}, snapshots{};
+
+    // Each view must be sorted, match its size and never shrink
+    std::vector<std::thread> readers{};
+    for (size_t r = 0; r < readerCount; r++)
+    {
+        readers.emplace_back([&]()
+        {
+            size_t last = 0;
+            while (!done.load())
+            {
+                auto view = tree.snapshot();
+                size_t found = 0;
+                T1 previous = -1;
+                for (auto& pair : view.search_range())
+                {
+                    if (pair.first <= previous || pair.second != pair.first * 3) failures++;
+                    previous = pair.first;
+                    found++;
+                }
+                if (found != view.size() || view.size() < last) failures++;
+                last = view.size();
+                snapshots++;
+            }
+        });
+    }
+
+    std::thread writer([&]()
+    {
+        for (T1 key : keys) tree.add(key, key * 3);
+        done = true;
+    });
+    writer.join();
+    for (auto& reader : readers) reader.join();
+
+    EXPECT_EQ(failures.load(), 0);
+    EXPECT_GT(snapshots.load(), 0);
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_EQ(tree.snapshot().size(), count);
+}
+
+struct LiveCounted
+{
+    static size_t live;
+
+    LiveCounted() noexcept { ++live; }
+    LiveCounted(const LiveCounted&) noexcept { ++live; }
+    LiveCounted& operator =(const LiveCounted&) = default;
+    ~LiveCounted() { --live; }
+};
+size_t LiveCounted::live = 0;
+
+TEST(CowBtreeSuite, ReclaimVersions)
+{
+    constexpr const size_t order = 4;
+    constexpr const size_t leafSize = 8;
+    constexpr const T1 count = 200;
+
+    {
+        osdb::cow_bplus_tree<T1, LiveCounted, order, leafSize> tree{};
+        for (T1 i = 0; i < count; i++) {
+            tree.add(i, LiveCounted{});
+        }
+        size_t current = LiveCounted::live;
+
+        // An outstanding snapshot keeps the paths it shares alive
+        auto view = tree.snapshot();
+        tree.add(count, LiveCounted{});
+        EXPECT_GT(LiveCounted::live, current);
+
+        // Releasing it reclaims the superseded leaf
+        view = tree.snapshot();
+        EXPECT(LiveCounted::live <= current + leafSize);
+    }
+    EXPECT_EQ(LiveCounted::live, 0);
+}
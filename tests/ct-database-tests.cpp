@@ -0,0 +1,361 @@
+/* ct-database-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#define CT_DATABASE_NO_MAIN
+#include <ct_database.hpp>
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <random>
+#include <vector>
+
+using ab_table = Table<FieldDefinition<OSDB_STR("a"), int>, FieldDefinition<OSDB_STR("b"), double>>;
+
+// A key with equality but without std::hash
+struct point
+{
+    int x, y;
+
+    bool operator ==(const point& other) const noexcept {
+        return x == other.x && y == other.y;
+    }
+};
+
+using point_table = Table<FieldDefinition<OSDB_STR("p"), point>, FieldDefinition<OSDB_STR("a"), int>>;
+
+template<size_t NTables>
+using row_list = std::vector<row_type<NTables>>;
+
+// Gets the plan of the query func would build over tables of the given types
+template<typename Func, typename ...Tables, size_t ...Indices>
+static auto plan_of(const Func& func, std::index_sequence<Indices...>)
+{
+    using operation = decltype(func(table_ref<Tables, Indices>{}...));
+    return query_plan<sizeof...(Tables), operation>::steps;
+}
+
+template<typename ...Tables, typename Func>
+static auto plan_of(const Func& func)
+{
+    return plan_of<Func, Tables...>(func, std::index_sequence_for<Tables...>());
+}
+
+template<size_t N>
+static bool same_plan(const std::array<instr_type, N>& steps,
+    std::initializer_list<instr_type> expected)
+{
+    return steps.size() == expected.size() && std::equal(steps.begin(), steps.end(),
+        expected.begin(), [](const instr_type& a, const instr_type& b) {
+            return a.code == b.code && a.table == b.table && a.term == b.term;
+        });
+}
+
+static ab_table random_table(size_t count, int range, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    ab_table output{};
+    for (size_t i = 0; i < count; i++) {
+        output.insert(int(random() % range), double(random() % range) / 2);
+    }
+    return output;
+}
+
+// Sorts the rows of a result, whose order is not defined across joins
+template<size_t NTables>
+static row_list<NTables> sorted(row_list<NTables> rows)
+{
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
+TEST_SUITE(CtDatabaseSuite);
+
+TEST(CtDatabaseSuite, PlanPushesDownFilters)
+{
+    // Filters on one table run before any join, the most selective first
+    auto steps = plan_of<ab_table>([](auto p) {
+        return p["a"_nm] < 40 && p["b"_nm] == 2.0 && p["a"_nm] != 3;
+    });
+    EXPECT(same_plan(steps, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Filter, 0, 1 }, { Opcode::Filter, 0, 0 },
+        { Opcode::Filter, 0, 2 }, { Opcode::Product, 0, 0 }, { Opcode::Project, 0, 0 } }));
+
+    auto joined = plan_of<ab_table, ab_table>([](auto p, auto q) {
+        return p["a"_nm] == q["a"_nm] && q["b"_nm] < 4.0 && p["b"_nm].between(1.0, 2.0);
+    });
+    EXPECT(same_plan(joined, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Filter, 0, 2 }, { Opcode::Scan, 1, 0 },
+        { Opcode::Filter, 1, 1 }, { Opcode::Product, 0, 0 }, { Opcode::HashJoin, 1, 0 },
+        { Opcode::Project, 0, 0 } }));
+}
+
+TEST(CtDatabaseSuite, PlanOrdersEquiJoins)
+{
+    // Each table joined next is linked by an equi-join to those already joined
+    auto steps = plan_of<ab_table, ab_table, ab_table>([](auto p, auto q, auto s) {
+        return q["a"_nm] == s["a"_nm] && p["a"_nm] == q["a"_nm] &&
+            p["b"_nm] < s["b"_nm] && p["a"_nm] < 30;
+    });
+    EXPECT(same_plan(steps, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Filter, 0, 3 }, { Opcode::Scan, 1, 0 },
+        { Opcode::Scan, 2, 0 }, { Opcode::Product, 0, 0 }, { Opcode::HashJoin, 1, 1 },
+        { Opcode::HashJoin, 2, 0 }, { Opcode::Residual, 0, 2 }, { Opcode::Project, 0, 0 } }));
+}
+
+TEST(CtDatabaseSuite, PlanPlacesResiduals)
+{
+    // The most selective linking term joins, and the rest apply once bound
+    auto steps = plan_of<ab_table, ab_table>([](auto p, auto q) {
+        return p["a"_nm] != q["a"_nm] && p["b"_nm] < q["b"_nm];
+    });
+    EXPECT(same_plan(steps, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Scan, 1, 0 }, { Opcode::Product, 0, 0 },
+        { Opcode::Join, 1, 1 }, { Opcode::Residual, 0, 0 }, { Opcode::Project, 0, 0 } }));
+
+    // Keys of different types are joined by nested loops rather than hashing
+    auto mixed = plan_of<ab_table, ab_table>([](auto p, auto q) {
+        return p["a"_nm] == q["b"_nm];
+    });
+    EXPECT(same_plan(mixed, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Scan, 1, 0 }, { Opcode::Product, 0, 0 },
+        { Opcode::Join, 1, 0 }, { Opcode::Project, 0, 0 } }));
+
+    // As are keys which cannot be hashed
+    auto unhashable = plan_of<point_table, point_table>([](auto p, auto q) {
+        return p["p"_nm] == q["p"_nm] && p["a"_nm] < 5;
+    });
+    EXPECT(same_plan(unhashable, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Filter, 0, 1 }, { Opcode::Scan, 1, 0 },
+        { Opcode::Product, 0, 0 }, { Opcode::Join, 1, 0 }, { Opcode::Project, 0, 0 } }));
+
+    // Without any linking term, the tables are paired by a product
+    auto product = plan_of<ab_table, ab_table>([](auto p, auto q) {
+        return p["a"_nm] < 3 && q["a"_nm] > 5;
+    });
+    EXPECT(same_plan(product, {
+        { Opcode::Scan, 0, 0 }, { Opcode::Filter, 0, 0 }, { Opcode::Scan, 1, 0 },
+        { Opcode::Filter, 1, 1 }, { Opcode::Product, 0, 0 }, { Opcode::Product, 1, 0 },
+        { Opcode::Project, 0, 0 } }));
+}
+
+TEST(CtDatabaseSuite, SingleTableQuery)
+{
+    ab_table t = random_table(500, 100, 1);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+
+    auto result = query([](auto p) {
+        return (p["a"_nm] < 40 || p["b"_nm].in(3.0, 7.5)) && !(p["a"_nm] == 10) &&
+            p["a"_nm] != p["b"_nm];
+    }, t);
+
+    row_list<1> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        if ((a[i] < 40 || b[i] == 3.0 || b[i] == 7.5) && !(a[i] == 10) && a[i] != b[i]) {
+            expected.push_back({ i });
+        }
+    }
+    EXPECT(result == expected);
+}
+
+TEST(CtDatabaseSuite, TwoTableQuery)
+{
+    ab_table t = random_table(400, 60, 2), u = random_table(300, 60, 3);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+    auto& c = std::get<0>(u.columns);
+    auto& d = std::get<1>(u.columns);
+
+    auto result = query([](auto p, auto q) {
+        return p["a"_nm] == q["a"_nm] && p["b"_nm] < 20.0 &&
+            (p["b"_nm] < q["b"_nm] || !(q["a"_nm] > 5));
+    }, t, u);
+
+    row_list<2> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            if (a[i] == c[k] && b[i] < 20.0 && (b[i] < d[k] || !(c[k] > 5))) {
+                expected.push_back({ i, k });
+            }
+        }
+    }
+    EXPECT(!expected.empty());
+    EXPECT(sorted(result) == expected);
+}
+
+TEST(CtDatabaseSuite, ThreeTableQuery)
+{
+    ab_table t = random_table(120, 40, 4), u = random_table(100, 40, 5), v = random_table(80, 40, 6);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+    auto& c = std::get<0>(u.columns);
+    auto& d = std::get<1>(u.columns);
+    auto& e = std::get<0>(v.columns);
+    auto& f = std::get<1>(v.columns);
+
+    // Hash joined, then joined by nested loops on keys of different types
+    auto result = query([](auto p, auto q, auto s) {
+        return p["a"_nm] == q["a"_nm] && q["b"_nm] < s["b"_nm] &&
+            s["a"_nm] == p["b"_nm] && p["a"_nm] < 30;
+    }, t, u, v);
+
+    row_list<3> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            for (size_t l = 0; l < v.size(); l++)
+            {
+                if (a[i] == c[k] && d[k] < f[l] && e[l] == b[i] && a[i] < 30) {
+                    expected.push_back({ i, k, l });
+                }
+            }
+        }
+    }
+    EXPECT(!expected.empty());
+    EXPECT(sorted(result) == expected);
+}
+
+TEST(CtDatabaseSuite, UnhashableJoinQuery)
+{
+    std::mt19937 random(12);
+    point_table t{}, u{};
+    for (int i = 0; i < 200; i++) t.insert(point{ int(random() % 8), int(random() % 8) }, i);
+    for (int i = 0; i < 150; i++) u.insert(point{ int(random() % 8), int(random() % 8) }, i);
+    auto& p = std::get<0>(t.columns);
+    auto& a = std::get<1>(t.columns);
+    auto& q = std::get<0>(u.columns);
+
+    auto result = query([](auto l, auto r) {
+        return l["p"_nm] == r["p"_nm] && l["a"_nm] < 100;
+    }, t, u);
+
+    row_list<2> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            if (p[i] == q[k] && a[i] < 100) expected.push_back({ i, k });
+        }
+    }
+    EXPECT(!expected.empty());
+    EXPECT(sorted(result) == expected);
+}
+
+// A table whose every seventh value of b is NaN
+static ab_table table_with_nan(size_t count, uint32_t seed)
+{
+    ab_table output = random_table(count, 40, seed);
+    auto& b = std::get<1>(output.columns);
+    for (size_t i = 0; i < count; i += 7) b[i] = std::nan("");
+    return output;
+}
+
+TEST(CtDatabaseSuite, UnorderedValues)
+{
+    // NaN satisfies no ordering, whether filtered by kernel or by loop
+    ab_table t = table_with_nan(300, 7), u = table_with_nan(200, 8);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+    auto& c = std::get<0>(u.columns);
+    auto& d = std::get<1>(u.columns);
+
+    auto ranged = query([](auto p) {
+        return p["b"_nm] >= 10.0 || p["b"_nm].between(2.0, 4.0) || p["b"_nm] <= 0.5;
+    }, t);
+    row_list<1> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        if (b[i] >= 10.0 || (2.0 <= b[i] && b[i] <= 4.0) || b[i] <= 0.5) {
+            expected.push_back({ i });
+        }
+    }
+    EXPECT(ranged == expected);
+
+    auto joined = query([](auto p, auto q) {
+        return p["a"_nm] == q["a"_nm] && p["b"_nm] <= q["b"_nm] && q["b"_nm] >= 3.0;
+    }, t, u);
+    row_list<2> pairs{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            if (a[i] == c[k] && b[i] <= d[k] && d[k] >= 3.0) pairs.push_back({ i, k });
+        }
+    }
+    EXPECT(!pairs.empty());
+    EXPECT(sorted(joined) == pairs);
+}
+
+TEST(CtDatabaseSuite, ManyBatchFilters)
+{
+    // Three batches, the last partial, each filtered through OR, IN and NOT
+    ab_table t = random_table(3000, 40, 9);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+    EXPECT_GT(t.size(), 2 * batch_size);
+
+    auto result = query([](auto p) {
+        return (p["a"_nm] < 10 || p["b"_nm].in(3.0, 7.5, 12.0)) &&
+            !(p["a"_nm] == 20 || p["b"_nm] > 15.0) && p["a"_nm] != 5;
+    }, t);
+
+    row_list<1> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        if ((a[i] < 10 || b[i] == 3.0 || b[i] == 7.5 || b[i] == 12.0) &&
+            !(a[i] == 20 || b[i] > 15.0) && a[i] != 5) {
+            expected.push_back({ i });
+        }
+    }
+    EXPECT(result == expected);
+}
+
+TEST(CtDatabaseSuite, ManyBatchJoins)
+{
+    ab_table t = random_table(600, 40, 10), u = random_table(2100, 40, 11);
+    auto& a = std::get<0>(t.columns);
+    auto& b = std::get<1>(t.columns);
+    auto& c = std::get<0>(u.columns);
+    auto& d = std::get<1>(u.columns);
+
+    // Nested loops over several batches of candidates, then a residual over many rows
+    auto looped = query([](auto p, auto q) {
+        return p["a"_nm] == q["b"_nm] && !q["a"_nm].in(1, 2, 3) &&
+            (p["b"_nm] < q["b"_nm] || !(p["a"_nm] > 5));
+    }, t, u);
+
+    row_list<2> expected{};
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            if (a[i] == d[k] && !(c[k] == 1 || c[k] == 2 || c[k] == 3) &&
+                (b[i] < d[k] || !(a[i] > 5))) {
+                expected.push_back({ i, k });
+            }
+        }
+    }
+    EXPECT_GT(expected.size(), batch_size);
+    EXPECT(sorted(looped) == expected);
+
+    // Hash joined, the residual again spanning many batches
+    auto hashed = query([](auto p, auto q) {
+        return p["a"_nm] == q["a"_nm] && (!(p["b"_nm] < q["b"_nm]) || q["b"_nm].in(1.5, 2.0));
+    }, t, u);
+
+    expected.clear();
+    for (size_t i = 0; i < t.size(); i++)
+    {
+        for (size_t k = 0; k < u.size(); k++)
+        {
+            if (a[i] == c[k] && (!(b[i] < d[k]) || d[k] == 1.5 || d[k] == 2.0)) {
+                expected.push_back({ i, k });
+            }
+        }
+    }
+    EXPECT_GT(expected.size(), batch_size);
+    EXPECT(sorted(hashed) == expected);
+}
@@ -0,0 +1,208 @@
+/* filter-kernels-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <filter_kernels.hpp>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace osdb;
+
+static const filter_op all_ops[] = {
+    filter_op::eq, filter_op::ne, filter_op::lt, filter_op::le,
+    filter_op::gt, filter_op::ge, filter_op::between
+};
+
+template<typename T>
+static bool reference(filter_op op, T value, T low, T high)
+{
+    switch (op)
+    {
+        case filter_op::eq: return value == low;
+        case filter_op::ne: return value != low;
+        case filter_op::lt: return value < low;
+        case filter_op::le: return value <= low;
+        case filter_op::gt: return value > low;
+        case filter_op::ge: return value >= low;
+        default: return low <= value && value <= high;
+    }
+}
+
+/*
+Counts the results of the kernels at the given level which differ from a
+plain loop, over every predicate and a range of lengths and alignments.
+*/
+template<typename T>
+static size_t mismatches(simd_level level, const std::vector<T>& values, T low, T high)
+{
+    size_t output = 0;
+    for (size_t offset : { 0, 1, 3 })
+    {
+        for (size_t count : { 0, 1, 7, 8, 15, 16, 17, 63, 64, 65, 200, 1000 })
+        {
+            const T* data = values.data() + offset;
+            for (filter_op op : all_ops)
+            {
+                std::vector<uint32_t> expected{};
+                for (size_t i = 0; i < count; i++) {
+                    if (reference(op, data[i], low, high)) expected.push_back(uint32_t(i));
+                }
+
+                std::vector<uint32_t> selection(count + 1, 0xFFFFFFFF);
+                size_t selected = filter_select(op, data, count, low, high, selection.data(), level);
+                selection.resize(selected);
+                if (selection != expected) output++;
+
+                std::vector<uint64_t> mask((count + 63) / 64 + 1, ~uint64_t{});
+                size_t set = filter_mask(op, data, count, low, high, mask.data(), level);
+                if (set != expected.size() || mask.back() != ~uint64_t{}) output++;
+                for (size_t i = 0; i < count; i++)
+                {
+                    bool bit = (mask[i / 64] >> (i % 64)) & 1;
+                    if (bit != reference(op, data[i], low, high)) output++;
+                }
+            }
+        }
+    }
+    return output;
+}
+
+template<typename T>
+static std::vector<T> random_values(T range)
+{
+    std::mt19937 random(7);
+    std::vector<T> output(1003);
+    for (auto& value : output) {
+        value = static_cast<T>(static_cast<int64_t>(random() % (2 * uint64_t(range) + 1)) - int64_t(range));
+    }
+    return output;
+}
+
+static std::vector<simd_level> supported_levels()
+{
+    std::vector<simd_level> output{ simd_level::scalar };
+    if (detect_simd_level() != simd_level::scalar) output.push_back(simd_level::avx2);
+    if (detect_simd_level() == simd_level::avx512) output.push_back(simd_level::avx512);
+    return output;
+}
+
+TEST_SUITE(FilterKernelsSuite);
+
+TEST(FilterKernelsSuite, Integers)
+{
+    auto ints = random_values<int32_t>(20);
+    auto longs = random_values<int64_t>(20);
+    longs[10] = int64_t(1) << 40;
+    longs[11] = -(int64_t(1) << 40);
+    auto shorts = random_values<int16_t>(20);
+
+    for (simd_level level : supported_levels())
+    {
+        EXPECT_EQ(mismatches<int32_t>(level, ints, -3, 5), 0);
+        EXPECT_EQ(mismatches<int32_t>(level, ints, 7, 2), 0);
+        EXPECT_EQ(mismatches<int64_t>(level, longs, -3, 5), 0);
+        EXPECT_EQ(mismatches<int64_t>(level, longs, 0, int64_t(1) << 41), 0);
+        EXPECT_EQ(mismatches<int16_t>(level, shorts, -3, 5), 0);
+    }
+}
+
+TEST(FilterKernelsSuite, FloatingPoint)
+{
+    auto floats = random_values<float>(20);
+    auto doubles = random_values<double>(20);
+    for (size_t i = 0; i < floats.size(); i += 13)
+    {
+        floats[i] = std::nanf("");
+        doubles[i] = std::nan("");
+        floats[i + 1] += 0.5f;
+        doubles[i + 1] -= 0.25;
+    }
+
+    for (simd_level level : supported_levels())
+    {
+        EXPECT_EQ(mismatches<float>(level, floats, -3.5f, 5.0f), 0);
+        EXPECT_EQ(mismatches<float>(level, floats, 2.0f, std::nanf("")), 0);
+        EXPECT_EQ(mismatches<double>(level, doubles, -3.0, 4.75), 0);
+        EXPECT_EQ(mismatches<double>(level, doubles, std::nan(""), 0.0), 0);
+    }
+}
+
+using position_list = std::vector<uint32_t>;
+
+// Values 0 to 19, but for NaN at 2, 9 and 17, in and after whole vectors
+template<typename T>
+static std::vector<T> values_with_nan()
+{
+    std::vector<T> output{};
+    for (int i = 0; i < 20; i++) output.push_back(static_cast<T>(i));
+    for (size_t i : { 2, 9, 17 }) output[i] = std::numeric_limits<T>::quiet_NaN();
+    return output;
+}
+
+// Selects with a kernel, checking that its mask agrees
+template<typename T>
+static position_list select_all(simd_level level, filter_op op, const std::vector<T>& values,
+    T low, T high)
+{
+    position_list output(values.size());
+    output.resize(filter_select(op, values.data(), values.size(), low, high, output.data(), level));
+
+    uint64_t mask = 0;
+    size_t set = filter_mask(op, values.data(), values.size(), low, high, &mask, level);
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        bool selected = std::find(output.begin(), output.end(), uint32_t(i)) != output.end();
+        if (((mask >> i) & 1) != selected || set != output.size()) return { 0xFFFFFFFF };
+    }
+    return output;
+}
+
+template<typename T>
+static bool unordered_results(simd_level level)
+{
+    auto values = values_with_nan<T>();
+    T nan = std::numeric_limits<T>::quiet_NaN();
+    position_list all{};
+    for (uint32_t i = 0; i < 20; i++) all.push_back(i);
+
+    return select_all<T>(level, filter_op::eq, values, 5, 12) == position_list{ 5 } &&
+        select_all<T>(level, filter_op::ne, values, 5, 12) == position_list{
+            0, 1, 2, 3, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19 } &&
+        select_all<T>(level, filter_op::lt, values, 5, 12) == position_list{ 0, 1, 3, 4 } &&
+        select_all<T>(level, filter_op::le, values, 5, 12) == position_list{ 0, 1, 3, 4, 5 } &&
+        select_all<T>(level, filter_op::gt, values, 5, 12) == position_list{
+            6, 7, 8, 10, 11, 12, 13, 14, 15, 16, 18, 19 } &&
+        select_all<T>(level, filter_op::ge, values, 5, 12) == position_list{
+            5, 6, 7, 8, 10, 11, 12, 13, 14, 15, 16, 18, 19 } &&
+        select_all<T>(level, filter_op::between, values, 5, 12) == position_list{
+            5, 6, 7, 8, 10, 11, 12 } &&
+        select_all<T>(level, filter_op::le, values, nan, nan).empty() &&
+        select_all<T>(level, filter_op::ge, values, nan, nan).empty() &&
+        select_all<T>(level, filter_op::between, values, 5, nan).empty() &&
+        select_all<T>(level, filter_op::ne, values, nan, nan) == all;
+}
+
+TEST(FilterKernelsSuite, UnorderedValues)
+{
+    // NaN satisfies ne alone, as with the C++ operators
+    for (simd_level level : supported_levels())
+    {
+        EXPECT(unordered_results<float>(level));
+        EXPECT(unordered_results<double>(level));
+    }
+}
+
+TEST(FilterKernelsSuite, Dispatch)
+{
+    int32_t values[] = { 5, 1, 5, 9, 5 };
+    uint32_t selection[5];
+    ASSERT_EQ(filter_select(filter_op::eq, values, 5, 5, selection), 3);
+    EXPECT_EQ(selection[0], 0);
+    EXPECT_EQ(selection[1], 2);
+    EXPECT_EQ(selection[2], 4);
+
+    uint64_t mask = 0;
+    EXPECT_EQ(filter_mask(filter_op::between, values, 5, 2, 6, &mask), 3);
+    EXPECT_EQ(mask, 0x15);
+}
@@ -0,0 +1,129 @@
+/* frozen-index-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <frozen_index.hpp>
+#include <cstring>
+#include <vector>
+
+using T1 = int;
+
+TEST_SUITE(FrozenIndexSuite);
+
+TEST(FrozenIndexSuite, Empty)
+{
+    osdb::bplus_tree<T1, T1, 4, 8> tree{};
+    auto index = tree.freeze();
+
+    EXPECT_EQ(index.size(), 0);
+    EXPECT_EQ(index.find(0), nullptr);
+    EXPECT_EQ(index.lower_bound(0), 0);
+    EXPECT_EQ(index.upper_bound(0), 0);
+}
+
+TEST(FrozenIndexSuite, FindBounds)
+{
+    constexpr const T1 count = 5000;
+    osdb::bplus_tree<T1, T1, 4, 8> tree{};
+
+    // Keys are even, with every tenth key repeated
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = ((i * 37) % count) * 2;
+        tree.add(key, key / 2);
+        if (key % 20 == 0) tree.add(key, -1);
+    }
+    auto index = tree.freeze();
+    ASSERT_EQ(index.size(), tree.size());
+
+    size_t position = 0;
+    for (auto& pair : tree.search_range())
+    {
+        EXPECT_EQ(index.keys().begin()[position], pair.first);
+        position++;
+    }
+
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* value = index.find(i * 2);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i);
+        EXPECT_EQ(index.find(i * 2 + 1), nullptr);
+
+        // Two items for every tenth key precede key i
+        size_t before = i + (i + 9) / 10;
+        size_t same = i % 10 == 0 ? 2 : 1;
+        EXPECT_EQ(index.lower_bound(i * 2), before);
+        EXPECT_EQ(index.upper_bound(i * 2), before + same);
+        EXPECT_EQ(index.lower_bound(i * 2 + 1), before + same);
+    }
+    EXPECT_EQ(index.lower_bound(-1), 0);
+    EXPECT_EQ(index.lower_bound(count * 2), index.size());
+}
+
+TEST(FrozenIndexSuite, SaveLoad)
+{
+    constexpr const T1 count = 1000;
+    osdb::bplus_tree<T1, T1, 4, 8> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i, i * 3);
+    }
+
+    // Stand-in for a file mapped into memory
+    std::vector<uint64_t> file{};
+    {
+        auto index = tree.freeze();
+        file.resize((index.bytes() + 7) / 8);
+        std::memcpy(file.data(), index.data(), index.bytes());
+    }
+    auto* data = reinterpret_cast<const uint8_t*>(file.data());
+
+    using index_type = osdb::frozen_index<T1, T1>;
+    auto loaded = index_type::load(data, file.size() * 8);
+    ASSERT(loaded.operator bool());
+    EXPECT_EQ(loaded.value().size(), count);
+    EXPECT_EQ(loaded.value().data(), data);
+
+    for (T1 i = 0; i < count; i++)
+    {
+        auto* value = loaded.value().find(i);
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i * 3);
+    }
+
+    // Truncated buffers and mismatched types are rejected
+    EXPECT(!index_type::load(data, 64).operator bool());
+    using wide_index = osdb::frozen_index<T1, int64_t>;
+    EXPECT(!wide_index::load(data, file.size() * 8).operator bool());
+}
+
+TEST(FrozenIndexSuite, Snapshot)
+{
+    constexpr const T1 count = 3000;
+    osdb::bplus_tree<T1, T1, 4, 8> tree{};
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % count, i);
+    }
+
+    std::vector<uint64_t> file{};
+    {
+        auto index = tree.freeze();
+        file.resize((index.bytes() + 7) / 8);
+        std::memcpy(file.data(), index.data(), index.bytes());
+    }
+    auto* data = reinterpret_cast<const uint8_t*>(file.data());
+
+    osdb::bplus_tree<T1, T1, 4, 8> loaded{};
+    ASSERT_EQ(osdb::load_snapshot(loaded, data, file.size() * 8), osdb::error::None);
+    EXPECT_EQ(loaded.size(), count);
+    EXPECT(!(tree.height() < loaded.height()));
+
+    auto expected = tree.search_range().begin();
+    for (auto& pair : loaded.search_range())
+    {
+        EXPECT_EQ(pair.first, expected->first);
+        EXPECT_EQ(pair.second, expected->second);
+        ++expected;
+    }
+    EXPECT(expected == tree.search_range().end());
+
+    EXPECT_EQ(osdb::load_snapshot(loaded, data, 64), osdb::error::Some);
+}
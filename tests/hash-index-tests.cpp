@@ -0,0 +1,166 @@
+/* hash-index-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <hash_index.hpp>
+#include <vector>
+
+using namespace osdb;
+
+using pid_type = uint32_t;
+using size_type = size_t;
+using record_type = record_index<pid_type, size_type>;
+
+namespace
+{
+// Pages held in memory, indexed by page ID
+struct page_store
+{
+    std::vector<std::vector<uint8_t>> pages{ std::vector<uint8_t>() };
+    size_t reads{};
+};
+
+auto make_manager(page_store& store, size_t poolSize, size_type pageSize)
+{
+    return make_page_manager<pid_type, size_type>(poolSize, pageSize,
+        [&store](pid_type page, uint8_t* data, size_type size)
+        {
+            if (page >= store.pages.size()) return error::Some;
+            std::copy(store.pages[page].begin(), store.pages[page].begin() + size, data);
+            store.reads++;
+            return error::None;
+        },
+        [&store](pid_type page, const uint8_t* data, size_type size)
+        {
+            store.pages[page].assign(data, data + size);
+            return error::None;
+        },
+        [&store](size_type size)
+        {
+            store.pages.emplace_back(size);
+            return static_cast<pid_type>(store.pages.size() - 1);
+        },
+        [](pid_type, size_type) {
+            return error::None;
+        }
+    );
+}
+}
+
+static record_type make_record(uint32_t i)
+{
+    return record_type{ i / 16 + 1, i % 16, (i % 16) * 8, 8 };
+}
+
+TEST_SUITE(HashIndexSuite);
+
+TEST(HashIndexSuite, Empty)
+{
+    page_store store{};
+    auto mgrEx = make_manager(store, 4, 256);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    auto index = make_hash_index<uint64_t>(mgr);
+    ASSERT(index.operator bool());
+    EXPECT_EQ(index.value().size(), 0);
+    EXPECT_EQ(index.value().global_depth(), 0);
+    EXPECT(!index.value().find(7).operator bool());
+}
+
+TEST(HashIndexSuite, InsertFindMany)
+{
+    constexpr const uint32_t count = 5000;
+    page_store store{};
+    auto mgrEx = make_manager(store, 8, 256);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    auto indexEx = make_hash_index<uint64_t>(mgr);
+    ASSERT(indexEx.operator bool());
+    auto& index = indexEx.value();
+
+    for (uint32_t i = 0; i < count; i++) {
+        ASSERT_EQ(index.insert(uint64_t(i) * 7919, make_record(i)), error::None);
+    }
+    EXPECT_EQ(index.size(), count);
+    EXPECT_GT(index.global_depth(), 0);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto record = index.find(uint64_t(i) * 7919);
+        ASSERT(record.operator bool());
+        EXPECT(record.value() == make_record(i));
+    }
+    EXPECT(!index.find(1).operator bool());
+}
+
+TEST(HashIndexSuite, DuplicatesOverflow)
+{
+    constexpr const uint32_t count = 100;
+    page_store store{};
+    auto mgrEx = make_manager(store, 8, 128);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    auto indexEx = make_hash_index<uint64_t>(mgr);
+    ASSERT(indexEx.operator bool());
+    auto& index = indexEx.value();
+
+    // More copies of one key than fit in a bucket
+    for (uint32_t i = 0; i < count; i++)
+    {
+        ASSERT_EQ(index.insert(42, make_record(i)), error::None);
+        ASSERT_EQ(index.insert(i + 1000, make_record(i)), error::None);
+    }
+
+    auto all = index.find_all(42);
+    ASSERT(all.operator bool());
+    EXPECT_EQ(all.value().size(), count);
+
+    auto removed = index.erase(42);
+    ASSERT(removed.operator bool());
+    EXPECT_EQ(removed.value(), count);
+    EXPECT_EQ(index.size(), count);
+    EXPECT(!index.find(42).operator bool());
+
+    for (uint32_t i = 0; i < count; i++) {
+        EXPECT(index.find(i + 1000).operator bool());
+    }
+}
+
+TEST(HashIndexSuite, Reopen)
+{
+    constexpr const uint32_t count = 2000;
+    page_store store{};
+    pid_type header{};
+    {
+        auto mgrEx = make_manager(store, 8, 512);
+        ASSERT(mgrEx.operator bool());
+        auto& mgr = mgrEx.value();
+
+        auto indexEx = make_hash_index<uint64_t>(mgr);
+        ASSERT(indexEx.operator bool());
+        for (uint32_t i = 0; i < count; i++) {
+            ASSERT_EQ(indexEx.value().insert(i, make_record(i)), error::None);
+        }
+        header = indexEx.value().header_page();
+    }
+
+    auto mgrEx = make_manager(store, 8, 512);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    auto indexEx = open_hash_index<uint64_t>(mgr, header);
+    ASSERT(indexEx.operator bool());
+    auto& index = indexEx.value();
+    EXPECT_EQ(index.size(), count);
+
+    // Each lookup reads just its bucket page
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t reads = store.reads;
+        auto record = index.find(i);
+        ASSERT(record.operator bool());
+        EXPECT(record.value() == make_record(i));
+        EXPECT(store.reads - reads <= 1);
+    }
+}
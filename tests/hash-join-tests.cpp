@@ -0,0 +1,118 @@
+/* hash-join-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <hash_join.hpp>
+#include <algorithm>
+#include <random>
+#include <utility>
+#include <vector>
+
+using namespace osdb;
+
+using pair_list = std::vector<std::pair<size_t, size_t>>;
+
+static std::vector<uint64_t> hash_all(const std::vector<uint32_t>& keys)
+{
+    std::vector<uint64_t> output{};
+    for (auto key : keys) output.push_back(join_hash(key));
+    return output;
+}
+
+// Pairs of (probe, build) indexes with equal keys, found by nested loops
+static pair_list expected_pairs(const std::vector<uint32_t>& build,
+    const std::vector<uint32_t>& probe)
+{
+    pair_list output{};
+    for (size_t i = 0; i < probe.size(); i++) {
+        for (size_t j = 0; j < build.size(); j++) {
+            if (probe[i] == build[j]) output.emplace_back(i, j);
+        }
+    }
+    return output;
+}
+
+static std::vector<uint32_t> random_keys(size_t count, uint32_t range, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    std::vector<uint32_t> output(count);
+    for (auto& key : output) key = random() % range;
+    return output;
+}
+
+// Joins by the given number of radix bits, comparing keys as callers must
+static pair_list join(const std::vector<uint32_t>& build, const std::vector<uint32_t>& probe,
+    size_t bits)
+{
+    auto buildHashes = hash_all(build);
+    auto probeHashes = hash_all(probe);
+
+    pair_list output{};
+    hash_join_partitioned(buildHashes.data(), build.size(), probeHashes.data(), probe.size(),
+        bits, [&](size_t i, size_t j) {
+            if (probe[i] == build[j]) output.emplace_back(i, j);
+        });
+    std::sort(output.begin(), output.end());
+    return output;
+}
+
+TEST_SUITE(HashJoinSuite);
+
+TEST(HashJoinSuite, Empty)
+{
+    std::vector<uint32_t> none{}, some{ 1, 2, 3 };
+    EXPECT(join(none, some, 0).empty());
+    EXPECT(join(some, none, 0).empty());
+    EXPECT(join(none, some, 4).empty());
+    EXPECT(join(some, none, 4).empty());
+}
+
+TEST(HashJoinSuite, Duplicates)
+{
+    // Many equal keys on both sides
+    auto build = random_keys(300, 10, 1);
+    auto probe = random_keys(200, 15, 2);
+    auto expected = expected_pairs(build, probe);
+
+    for (size_t bits : { 0, 1, 3, 8 }) {
+        EXPECT(join(build, probe, bits) == expected);
+    }
+}
+
+TEST(HashJoinSuite, Partitioned)
+{
+    auto build = random_keys(3000, 5000, 3);
+    auto probe = random_keys(2000, 5000, 4);
+    auto expected = expected_pairs(build, probe);
+    EXPECT(!expected.empty());
+
+    for (size_t bits : { 0, 2, 6, 10 }) {
+        EXPECT(join(build, probe, bits) == expected);
+    }
+
+    // A tiny cache forces hash_join to partition
+    auto buildHashes = hash_all(build);
+    auto probeHashes = hash_all(probe);
+    pair_list output{};
+    hash_join(buildHashes.data(), build.size(), probeHashes.data(), probe.size(),
+        [&](size_t i, size_t j) {
+            if (probe[i] == build[j]) output.emplace_back(i, j);
+        }, 1024);
+    std::sort(output.begin(), output.end());
+    EXPECT(output == expected);
+}
+
+TEST(HashJoinSuite, TableProbe)
+{
+    uint64_t hashes[] = { 0, 5, 5, 9 };
+    size_t positions[] = { 10, 11, 12, 13 };
+    join_hash_table table{};
+    table.build(hashes, positions, 4);
+    EXPECT(table.capacity() >= 8);
+
+    uint64_t probes[] = { 5, 7, 0 };
+    pair_list output{};
+    table.probe(probes, nullptr, 3, [&](size_t i, size_t j) { output.emplace_back(i, j); });
+    std::sort(output.begin(), output.end());
+
+    pair_list expected{ { 0, 11 }, { 0, 12 }, { 2, 10 } };
+    EXPECT(output == expected);
+}
@@ -0,0 +1,128 @@
+/* normalized-key-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <normalized_key.hpp>
+#include <limits>
+#include <string>
+#include <tuple>
+#include <vector>
+
+using key_type = osdb::normalized_key<32>;
+
+template<typename... Ts>
+static key_type make_key(const Ts&... columns)
+{
+    key_type output{};
+    osdb::normalize(output, columns...);
+    return output;
+}
+
+TEST_SUITE(NormalizedKeySuite);
+
+TEST(NormalizedKeySuite, SignedIntegers)
+{
+    std::vector<int64_t> values{ std::numeric_limits<int64_t>::min(), -1000, -1, 0, 1,
+        255, 256, 1000, std::numeric_limits<int64_t>::max() };
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        for (size_t j = 0; j < values.size(); j++)
+        {
+            EXPECT_EQ(make_key(values[i]) < make_key(values[j]), values[i] < values[j]);
+            EXPECT_EQ(make_key(values[i]) == make_key(values[j]), i == j);
+        }
+    }
+    EXPECT_EQ(make_key(int32_t(-5)).size(), 4);
+}
+
+TEST(NormalizedKeySuite, FloatingPoint)
+{
+    std::vector<double> values{ -std::numeric_limits<double>::infinity(), -1e100, -2.5,
+        -1e-300, 0.0, 1e-300, 2.5, 1e100, std::numeric_limits<double>::infinity() };
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        for (size_t j = 0; j < values.size(); j++) {
+            EXPECT_EQ(make_key(values[i]) < make_key(values[j]), values[i] < values[j]);
+        }
+    }
+    EXPECT(make_key(-0.0) == make_key(0.0));
+    EXPECT(make_key(std::numeric_limits<double>::infinity()) <
+        make_key(std::numeric_limits<double>::quiet_NaN()));
+    EXPECT(make_key(-1.5f) < make_key(1.5f));
+}
+
+TEST(NormalizedKeySuite, Strings)
+{
+    std::vector<std::string> values{ "", std::string("\0", 1), std::string("\0\0", 2),
+        "a", std::string("a\0", 2), std::string("a\0b", 3), "ab", "b" };
+
+    for (size_t i = 0; i < values.size(); i++)
+    {
+        for (size_t j = 0; j < values.size(); j++) {
+            EXPECT_EQ(make_key(values[i]) < make_key(values[j]), values[i] < values[j]);
+        }
+    }
+}
+
+TEST(NormalizedKeySuite, Composite)
+{
+    using tuple_type = std::tuple<std::string, int32_t, double>;
+    std::vector<tuple_type> values{};
+    const char* tenants[] = { "", "a", "ab", "b" };
+
+    for (auto* tenant : tenants)
+    {
+        for (int32_t time = -2; time <= 2; time++) {
+            values.emplace_back(tenant, time, time * -0.5);
+        }
+    }
+
+    for (auto& a : values)
+    {
+        for (auto& b : values)
+        {
+            auto keyA = make_key(std::get<0>(a), std::get<1>(a), std::get<2>(a));
+            auto keyB = make_key(std::get<0>(b), std::get<1>(b), std::get<2>(b));
+            EXPECT_EQ(keyA < keyB, a < b);
+        }
+    }
+}
+
+TEST(NormalizedKeySuite, Overflow)
+{
+    osdb::normalized_key<8> key{};
+    EXPECT(osdb::normalize(key, int32_t(1), int32_t(2)));
+    EXPECT_EQ(key.size(), 8);
+
+    EXPECT(!osdb::normalize(key, int32_t(1), int64_t(2)));
+    EXPECT_EQ(key.size(), 0);
+
+    EXPECT(key.append("abcdef"));
+    EXPECT(!key.append(uint8_t(1)));
+    EXPECT_EQ(key.size(), 8);
+}
+
+TEST(NormalizedKeySuite, Tree)
+{
+    constexpr const int count = 200;
+    osdb::normalized_bplus_tree<32, int, 4, 8> tree{};
+
+    for (int i = 0; i < count; i++)
+    {
+        int id = (i * 37) % count;
+        tree.add(make_key(std::string(id % 2 ? "odd" : "even"), id), id);
+    }
+
+    int expected = 0;
+    for (auto& pair : tree.search_range(make_key(std::string("even")),
+        make_key(std::string("even"), std::numeric_limits<int>::max())))
+    {
+        EXPECT_EQ(pair.second, expected);
+        expected += 2;
+    }
+    EXPECT_EQ(expected, count);
+
+    auto* value = tree.find(make_key(std::string("odd"), 51));
+    ASSERT_NEQ(value, nullptr);
+    EXPECT_EQ(*value, 51);
+}
@@ -0,0 +1,201 @@
+/* posting-list-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <posting_list.hpp>
+#include <pages.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using T1 = int;
+
+TEST_SUITE(PostingListSuite);
+
+TEST(PostingListSuite, DeltaEncoded)
+{
+    constexpr const uint32_t count = 1000;
+    osdb::posting_list<uint32_t> list{};
+
+    for (uint32_t i = 0; i < count; i++) {
+        list.add(100000 + i * 3);
+    }
+    EXPECT_EQ(list.size(), count);
+    EXPECT_LT(list.bytes(), count * 2);
+
+    uint32_t expected = 100000;
+    for (auto value : list)
+    {
+        EXPECT_EQ(value, expected);
+        expected += 3;
+    }
+    EXPECT_EQ(expected, 100000 + count * 3);
+}
+
+TEST(PostingListSuite, UnorderedAddRemove)
+{
+    osdb::posting_list<T1> list{};
+    T1 values[] = { 5, -3, 8, 5, 0, -10 };
+    for (auto value : values) list.add(value);
+
+    std::vector<T1> output(list.begin(), list.end());
+    EXPECT(output == std::vector<T1>({ -10, -3, 0, 5, 5, 8 }));
+
+    EXPECT(list.remove(5));
+    EXPECT(list.remove(-10));
+    EXPECT(!list.remove(7));
+
+    output.assign(list.begin(), list.end());
+    EXPECT(output == std::vector<T1>({ -3, 0, 5, 8 }));
+}
+
+TEST(PostingListSuite, RecordIndices)
+{
+    using record_type = osdb::record_index<uint32_t, uint16_t>;
+    osdb::posting_list<record_type> list{};
+
+    for (uint32_t page = 1; page <= 3; page++)
+    {
+        for (uint16_t slot = 0; slot < 10; slot++) {
+            list.add(record_type{ page, slot, static_cast<uint16_t>(slot * 16), 16 });
+        }
+    }
+    EXPECT_EQ(list.size(), 30);
+    EXPECT_LT(list.bytes(), 30 * sizeof(record_type));
+
+    size_t index = 0;
+    for (auto& record : list)
+    {
+        EXPECT_EQ(record.pageid, index / 10 + 1);
+        EXPECT_EQ(record.slot_index, index % 10);
+        EXPECT_EQ(record.offset, (index % 10) * 16);
+        EXPECT_EQ(record.size, 16);
+        index++;
+    }
+    EXPECT_EQ(index, 30);
+}
+
+TEST(PostingListSuite, RecordIndexRemove)
+{
+    // Padded after pageid, which must not take part in comparisons
+    using record_type = osdb::record_index<uint32_t, size_t>;
+    osdb::posting_list<record_type> list{};
+
+    auto make_record = [](uint32_t page, size_t slot)
+    {
+        record_type record;
+        std::memset(&record, 0xA5, sizeof(record));
+        record.pageid = page;
+        record.slot_index = slot;
+        record.offset = slot * 32;
+        record.size = 32;
+        return record;
+    };
+
+    for (uint32_t page = 1; page <= 3; page++)
+    {
+        for (size_t slot = 0; slot < 10; slot++) {
+            list.add(make_record(page, slot));
+        }
+    }
+
+    auto record = make_record(2, 4);
+    record.size = 16;
+    EXPECT(!list.remove(record));
+    EXPECT(!list.remove(make_record(4, 0)));
+
+    for (uint32_t page = 1; page <= 3; page++)
+    {
+        for (size_t slot = 0; slot < 10; slot += 2) {
+            EXPECT(list.remove(make_record(page, slot)));
+        }
+    }
+    EXPECT_EQ(list.size(), 15);
+
+    size_t index = 0;
+    for (auto& record : list)
+    {
+        EXPECT_EQ(record.pageid, index / 5 + 1);
+        EXPECT_EQ(record.slot_index, (index % 5) * 2 + 1);
+        index++;
+    }
+    EXPECT_EQ(index, 15);
+}
+
+TEST(PostingListSuite, Uncompressed)
+{
+    osdb::posting_list<std::string> list{};
+    list.add("b");
+    list.add("a");
+    EXPECT(!list.remove("c"));
+
+    std::vector<std::string> output(list.begin(), list.end());
+    EXPECT(output == std::vector<std::string>({ "b", "a" }));
+}
+
+TEST(PostingListSuite, TreeAddManySame)
+{
+    constexpr const T1 count = 300;
+    osdb::posting_bplus_tree<T1, T1, 4, 8> tree{};
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add(i % 3, i);
+    }
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_EQ(tree.key_count(), 3);
+    EXPECT_EQ(tree.height(), 0);
+
+    T1 expected = 1;
+    for (auto pair : tree.search_range(1, 1))
+    {
+        EXPECT_EQ(pair.first, 1);
+        EXPECT_EQ(pair.second, expected);
+        expected += 3;
+    }
+    EXPECT_EQ(expected, count + 1);
+
+    auto* list = tree.find(2);
+    ASSERT_NEQ(list, nullptr);
+    EXPECT_EQ(list->size(), count / 3);
+    EXPECT_EQ(tree.find(3), nullptr);
+}
+
+TEST(PostingListSuite, TreeSearchRemove)
+{
+    constexpr const T1 count = 500;
+    osdb::posting_bplus_tree<T1, T1, 4, 8> tree{};
+
+    for (T1 i = 0; i < count; i++) {
+        tree.add((i * 37) % 100, i);
+    }
+
+    size_t found = 0;
+    T1 last = 0;
+    for (auto pair : tree.search_range())
+    {
+        EXPECT(!(pair.first < last));
+        EXPECT_EQ((pair.second * 37) % 100, pair.first);
+        last = pair.first;
+        found++;
+    }
+    EXPECT_EQ(found, count);
+
+    // Empty every list in [10, 20)
+    for (T1 i = 0; i < count; i++)
+    {
+        T1 key = (i * 37) % 100;
+        if (key >= 10 && key < 20) EXPECT(tree.remove(key, i));
+    }
+    EXPECT(!tree.remove(10, 0));
+    EXPECT_EQ(tree.size(), count - 50);
+    EXPECT(!tree.contains((3 * 37) % 100, 3));
+    EXPECT(tree.contains((21 * 37) % 100, 21));
+    EXPECT(!tree.contains((21 * 37) % 100, 22));
+    EXPECT_EQ(tree.find(15), nullptr);
+
+    found = 0;
+    for (auto pair : tree.search_range(5, 25, true, false))
+    {
+        EXPECT(pair.first < 10 || pair.first >= 20);
+        found++;
+    }
+    EXPECT_EQ(found, 50);
+}
@@ -0,0 +1,321 @@
+/* secondary-index-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <secondary_index.hpp>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace osdb;
+
+using pid_type = uint32_t;
+using size_type = size_t;
+using record_type = record_index<pid_type, size_type>;
+
+namespace
+{
+// Pages held in memory, indexed by page ID
+struct page_store
+{
+    std::vector<std::vector<uint8_t>> pages{ std::vector<uint8_t>() };
+};
+
+auto make_manager(page_store& store)
+{
+    return make_page_manager<pid_type, size_type>(8, 512,
+        [&store](pid_type page, uint8_t* data, size_type size)
+        {
+            if (page >= store.pages.size()) return error::Some;
+            std::copy(store.pages[page].begin(), store.pages[page].begin() + size, data);
+            return error::None;
+        },
+        [&store](pid_type page, const uint8_t* data, size_type size)
+        {
+            store.pages[page].assign(data, data + size);
+            return error::None;
+        },
+        [&store](size_type size)
+        {
+            store.pages.emplace_back(size);
+            return static_cast<pid_type>(store.pages.size() - 1);
+        },
+        [](pid_type, size_type) {
+            return error::None;
+        }
+    );
+}
+}
+
+using manager_type = std::remove_reference_t<
+    decltype(make_manager(std::declval<page_store&>()).value())>;
+
+// People with an ID, name and age, indexed by name and by age
+using people_heap = indexed_heap<manager_type, 3,
+    secondary_index<1, std::string>, secondary_index<2, int32_t>>;
+
+static std::string name_of(uint32_t id)
+{
+    return "person" + std::to_string(id % 50);
+}
+
+TEST_SUITE(SecondaryIndexSuite);
+
+TEST(SecondaryIndexSuite, InsertLookup)
+{
+    constexpr const uint32_t count = 500;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    people_heap heap(mgr, first);
+
+    std::vector<record_type> records{};
+    for (uint32_t i = 0; i < count; i++)
+    {
+        auto record = heap.insert(i, name_of(i), int32_t(i % 80));
+        ASSERT(record.operator bool());
+        records.push_back(record.value());
+    }
+    EXPECT_EQ(heap.size(), count);
+    EXPECT_EQ(heap.index<0>().size(), count);
+    EXPECT_EQ(heap.index<1>().key_count(), 80);
+
+    // Each name is held by every fiftieth person
+    auto* list = heap.index<0>().find(name_of(7));
+    ASSERT_NEQ(list, nullptr);
+    EXPECT_EQ(list->size(), count / 50);
+    for (auto record : *list)
+    {
+        auto id = heap.get<uint32_t>(record, 0);
+        ASSERT(id.operator bool());
+        EXPECT_EQ(id.value() % 50, 7);
+    }
+
+    // Index-only: count ages in [10, 20) without visiting the heap
+    size_t found = 0;
+    for (auto pair : heap.index<1>().search_range(10, 20, true, false))
+    {
+        EXPECT(pair.first >= 10 && pair.first < 20);
+        found++;
+    }
+    EXPECT_EQ(found, 70);
+
+    auto name = heap.get<std::string>(records[123], 1);
+    ASSERT(name.operator bool());
+    EXPECT(name.value() == name_of(123));
+    EXPECT(!heap.get<int64_t>(records[123], 2).operator bool());
+}
+
+TEST(SecondaryIndexSuite, RemoveUpdate)
+{
+    constexpr const uint32_t count = 200;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    people_heap heap(mgr, first);
+
+    std::vector<record_type> records{};
+    for (uint32_t i = 0; i < count; i++) {
+        records.push_back(heap.insert(i, name_of(i), int32_t(i % 80)).value());
+    }
+
+    // Remove every person aged 5
+    for (uint32_t i = 5; i < count; i += 80) {
+        EXPECT_EQ(heap.remove(records[i]), error::None);
+    }
+    EXPECT_EQ(heap.remove(records[5]), error::Some);
+    EXPECT_EQ(heap.size(), count - 3);
+    EXPECT_EQ(heap.index<1>().find(5), nullptr);
+    EXPECT(!heap.get<uint32_t>(records[5], 0).operator bool());
+
+    // Same size, so rewritten in place with only the age reindexed
+    auto moved = heap.update(records[10], uint32_t(10), name_of(10), int32_t(99));
+    ASSERT(moved.operator bool());
+    EXPECT(moved.value() == records[10]);
+    ASSERT_NEQ(heap.index<1>().find(99), nullptr);
+    EXPECT(*heap.index<1>().find(99)->begin() == records[10]);
+
+    // A longer name moves the record
+    moved = heap.update(records[11], uint32_t(11), std::string("a much longer name"), int32_t(11));
+    ASSERT(moved.operator bool());
+    EXPECT(!(moved.value() == records[11]));
+    ASSERT_NEQ(heap.index<0>().find("a much longer name"), nullptr);
+    EXPECT(*heap.index<0>().find("a much longer name")->begin() == moved.value());
+    EXPECT_EQ(heap.index<0>().find(name_of(11))->size(), count / 50 - 1);
+    EXPECT_EQ(heap.size(), count - 3);
+
+    // Reopening rebuilds the same indexes from the live records
+    people_heap reopened(mgr, first);
+    ASSERT_EQ(reopened.build_indexes(), error::None);
+    EXPECT_EQ(reopened.size(), heap.size());
+    EXPECT_EQ(reopened.index<0>().size(), heap.index<0>().size());
+    EXPECT_EQ(reopened.index<1>().find(5), nullptr);
+    EXPECT_NEQ(reopened.index<1>().find(99), nullptr);
+    EXPECT_NEQ(reopened.index<0>().find("a much longer name"), nullptr);
+}
+
+// Copies a record location into one whose padding bytes are not zero
+static record_type with_padding(const record_type& record)
+{
+    record_type output;
+    std::memset(&output, 0xA5, sizeof(output));
+    output.pageid = record.pageid;
+    output.slot_index = record.slot_index;
+    output.offset = record.offset;
+    output.size = record.size;
+    return output;
+}
+
+TEST(SecondaryIndexSuite, RemoveUpdatePadded)
+{
+    constexpr const uint32_t count = 200;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    people_heap heap(mgr, first);
+
+    std::vector<record_type> records{};
+    for (uint32_t i = 0; i < count; i++) {
+        records.push_back(with_padding(heap.insert(i, name_of(i), int32_t(i % 80)).value()));
+    }
+
+    for (uint32_t i = 0; i < count; i += 4) {
+        EXPECT_EQ(heap.remove(records[i]), error::None);
+    }
+    EXPECT_EQ(heap.size(), count - count / 4);
+    EXPECT_EQ(heap.index<1>().find(int32_t(0)), nullptr);
+
+    auto moved = heap.update(records[1], uint32_t(1), name_of(1), int32_t(99));
+    ASSERT(moved.operator bool());
+    ASSERT_NEQ(heap.index<1>().find(99), nullptr);
+    EXPECT(*heap.index<1>().find(99)->begin() == records[1]);
+    EXPECT_EQ(heap.index<1>().find(1)->size(), count / 80);
+
+    moved = heap.update(records[2], uint32_t(2), std::string("a much longer name"), int32_t(2));
+    ASSERT(moved.operator bool());
+    // Of 2, 52, 102 and 152, the second and last were removed
+    EXPECT_EQ(heap.index<0>().find(name_of(2))->size(), 1);
+    EXPECT_EQ(heap.size(), count - count / 4);
+}
+
+TEST(SecondaryIndexSuite, RemoveUnindexed)
+{
+    constexpr const uint32_t count = 100;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    people_heap heap(mgr, first);
+
+    std::vector<record_type> records{};
+    for (uint32_t i = 0; i < count; i++) {
+        records.push_back(heap.insert(i, name_of(i), int32_t(i % 80)).value());
+    }
+
+    // Readable, but held by neither index, so neither is changed
+    record_type record = records[30];
+    record.size++;
+    EXPECT_EQ(heap.remove(record), error::Some);
+    EXPECT_EQ(heap.size(), count);
+    EXPECT(heap.index<0>().contains(name_of(30), records[30]));
+    EXPECT(heap.index<1>().contains(30, records[30]));
+    EXPECT_EQ(heap.index<0>().size(), count);
+    EXPECT_EQ(heap.index<1>().size(), count);
+    EXPECT_EQ(heap.remove(records[30]), error::None);
+}
+
+// Gets the (key, record) pairs of an index in order
+template<typename Index>
+static auto contents(const Index& index)
+{
+    std::vector<std::pair<typename Index::key_type, record_type>> output{};
+    for (auto pair : index.search_range()) {
+        output.emplace_back(pair.first, pair.second);
+    }
+    return output;
+}
+
+TEST(SecondaryIndexSuite, ParallelBuild)
+{
+    constexpr const uint32_t count = 3000;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    people_heap heap(mgr, first);
+    for (uint32_t i = 0; i < count; i++) {
+        ASSERT(heap.insert(i, name_of(i * 7), int32_t(i % 80)).operator bool());
+    }
+    for (uint32_t i = 0; i < count; i += 3) {
+        heap.remove(*heap.index<1>().find(int32_t(i % 80))->begin());
+    }
+
+    people_heap rebuilt(mgr, first);
+    ASSERT_EQ(rebuilt.build_indexes(4), error::None);
+    EXPECT(!rebuilt.building());
+    EXPECT_EQ(rebuilt.size(), heap.size());
+    EXPECT(contents(rebuilt.index<0>()) == contents(heap.index<0>()));
+    EXPECT(contents(rebuilt.index<1>()) == contents(heap.index<1>()));
+}
+
+TEST(SecondaryIndexSuite, OnlineBuild)
+{
+    constexpr const uint32_t count = 2000;
+    page_store store{};
+    auto mgrEx = make_manager(store);
+    ASSERT(mgrEx.operator bool());
+    auto& mgr = mgrEx.value();
+
+    pid_type first = mgr.new_pinned_page().value().id();
+    std::vector<record_type> records{};
+    {
+        people_heap heap(mgr, first);
+        for (uint32_t i = 0; i < count; i++) {
+            records.push_back(heap.insert(i, name_of(i), int32_t(i % 80)).value());
+        }
+    }
+
+    people_heap heap(mgr, first);
+    ASSERT_EQ(heap.begin_build(), error::None);
+    EXPECT(heap.building());
+
+    // Change records both behind and ahead of the scan between each step
+    uint32_t next = count;
+    for (uint32_t step = 0; ; step++)
+    {
+        auto done = heap.build_step(4, 2);
+        ASSERT(done.operator bool());
+        if (done.value()) break;
+
+        uint32_t behind = (step * 97) % count, ahead = count - 1 - (step * 89) % count;
+        records.push_back(heap.insert(next, name_of(next), int32_t(next % 80)).value());
+        next++;
+
+        heap.remove(records[behind]);
+        heap.remove(records[ahead]);
+        heap.update(records[behind + 1], behind + 1, name_of(behind + 1), int32_t(-1));
+        heap.update(records[ahead - 1], ahead - 1, name_of(ahead - 1), int32_t(-2));
+    }
+    ASSERT_EQ(heap.finish_build(2), error::None);
+    EXPECT(!heap.building());
+
+    // Must match an offline build of the final records
+    people_heap check(mgr, first);
+    ASSERT_EQ(check.build_indexes(), error::None);
+    EXPECT_EQ(heap.size(), check.size());
+    EXPECT(contents(heap.index<0>()) == contents(check.index<0>()));
+    EXPECT(contents(heap.index<1>()) == contents(check.index<1>()));
+    EXPECT_NEQ(heap.index<1>().find(-1), nullptr);
+    EXPECT_NEQ(heap.index<1>().find(-2), nullptr);
+}
@@ -0,0 +1,112 @@
+/* string-btree-tests.cpp - (c) 2018 James Renwick */
+#include "ostest/ostest.hpp"
+#include <string_btree.hpp>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static std::string make_name(int i)
+{
+    std::string output = std::to_string(i);
+    return "tenant/" + std::to_string(i % 3) + "/user/" +
+        std::string(6 - output.size(), '0') + output;
+}
+
+TEST_SUITE(StringBtreeSuite);
+
+TEST(StringBtreeSuite, EmptyTest)
+{
+    osdb::string_bplus_tree<int, 4, 8, 128> tree{};
+    EXPECT_EQ(tree.size(), 0);
+    EXPECT_EQ(tree.height(), 0);
+    EXPECT_EQ(tree.find(""), nullptr);
+
+    for (auto pair : tree.search_range()) {
+        (void)pair; ASSERT(false);
+    }
+    for (auto pair : tree.search_range("a", "b")) {
+        (void)pair; ASSERT(false);
+    }
+}
+
+TEST(StringBtreeSuite, AddManySearch)
+{
+    constexpr const int count = 1000;
+    osdb::string_bplus_tree<int, 4, 8, 128> tree{};
+
+    std::vector<std::string> names{};
+    for (int i = 0; i < count; i++)
+    {
+        int id = (i * 37) % count;
+        EXPECT(tree.add(make_name(id), id));
+        names.push_back(make_name(id));
+    }
+    std::sort(names.begin(), names.end());
+    EXPECT_EQ(tree.size(), count);
+    EXPECT_GT(tree.height(), 0);
+
+    size_t index = 0;
+    for (auto pair : tree.search_range())
+    {
+        ASSERT_LT(index, names.size());
+        EXPECT_EQ(pair.first, names[index]);
+        EXPECT_EQ(make_name(pair.second), names[index]);
+        index++;
+    }
+    EXPECT_EQ(index, names.size());
+
+    // Every user of one tenant, excluding the first
+    index = 0;
+    for (auto pair : tree.search_range(make_name(1), "tenant/1/user0", false, false))
+    {
+        EXPECT_EQ(pair.second % 3, 1);
+        EXPECT_GT(pair.second, 1);
+        index++;
+    }
+    EXPECT_EQ(index, count / 3 - 1);
+
+    for (int i = 0; i < count; i++)
+    {
+        auto* value = tree.find(make_name(i));
+        ASSERT_NEQ(value, nullptr);
+        EXPECT_EQ(*value, i);
+    }
+    EXPECT_EQ(tree.find("tenant/"), nullptr);
+    EXPECT_EQ(tree.find(make_name(count)), nullptr);
+}
+
+TEST(StringBtreeSuite, AddManySame)
+{
+    constexpr const int count = 200;
+    osdb::string_bplus_tree<int, 4, 8, 128> tree{};
+
+    const char* keys[] = { "", "a", "ab" };
+    for (int i = 0; i < count; i++) {
+        tree.add(keys[i % 3], i);
+    }
+
+    size_t found = 0;
+    for (auto pair : tree.search_range("a", "a"))
+    {
+        EXPECT_EQ(pair.first, "a");
+        EXPECT_EQ(pair.second % 3, 1);
+        found++;
+    }
+    EXPECT_EQ(found, 67);
+
+    found = 0;
+    for (auto pair : tree.search_range(osdb::range_start{}, "a", true, false))
+    {
+        EXPECT_EQ(pair.first, "");
+        found++;
+    }
+    EXPECT_EQ(found, 67);
+}
+
+TEST(StringBtreeSuite, KeyTooLong)
+{
+    osdb::string_bplus_tree<int, 4, 8, 128> tree{};
+    EXPECT(tree.add(std::string(tree.max_key_size(), 'a'), 1));
+    EXPECT(!tree.add(std::string(tree.max_key_size() + 1, 'a'), 2));
+    EXPECT_EQ(tree.size(), 1);
+}